@@ -0,0 +1,131 @@
+#ifndef FREE_RUNNING_ADC_H
+#define FREE_RUNNING_ADC_H
+
+#include <Arduino.h>
+
+#ifndef ADC_CHANNELS_MAX
+#define ADC_CHANNELS_MAX        4
+#endif
+#ifndef ADC_OVERSAMPLE_BITS
+#define ADC_OVERSAMPLE_BITS     2                   // 4^n conversions per reading, n bits gained
+#endif
+#ifndef ADC_FILTER_SHIFT
+#define ADC_FILTER_SHIFT        3                   // low-pass weight of a new reading: 1 / 2^n
+#endif
+
+#define ADC_READING_MAX         (1023 << ADC_OVERSAMPLE_BITS)
+
+#if ADC_CHANNELS_MAX > 8
+#error "ADC_CHANNELS_MAX above 8: primed has one bit per channel"
+#endif
+
+// Analog inputs sampled in the background by the ADC in free-running mode.
+//
+//   const uint8_t channels[] = {0, 1};             // ADC0, ADC1
+//   FreeRunningAdc adc(channels, 2);
+//   ISR(ADC_vect) { adc.onConversion(ADC); }
+//   ...
+//   adc.begin();
+//   uint16_t v = adc.read(0);                      // 0..ADC_READING_MAX, never waits
+//
+// The ADC converts back to back at a 125 kHz ADC clock (16 MHz / 128), one
+// conversion every 104 us, and interrupts after each one. The interrupt
+// sums 4^ADC_OVERSAMPLE_BITS conversions of a channel. It shifts the sum
+// right by ADC_OVERSAMPLE_BITS, which decimates the sum into a reading with
+// that many bits more than the ADC. Then it moves on to the next channel.
+// In free-running mode the conversion after the one that just finished has
+// already started on the old channel, so the first result after a switch
+// is dropped. Every reading passes a first-order low-pass before it is
+// published, which takes mains hum out that the short oversampling window
+// leaves in. With two channels, each one updates every 3.5 ms.
+//
+// read() takes no lock and never masks the interrupt. The interrupt bumps a
+// sequence count after each publish. A read that saw the count change under
+// it reads again, so it never returns a 16-bit value half old and half new.
+// AVcc is the reference, which suits ratiometric transducers on the same
+// 5 V supply. Only the first ADC_CHANNELS_MAX channels are sampled.
+class FreeRunningAdc {
+public:
+    FreeRunningAdc(const uint8_t* adcChannels, uint8_t channelCount)
+        : channels(adcChannels), count(channelCount < ADC_CHANNELS_MAX ? channelCount : ADC_CHANNELS_MAX),
+          current(0), skip(0), taken(0), sum(0), primed(0), published(0) {}
+
+    void begin() {
+        current = skip = taken = 0;
+        sum = 0;
+        primed = 0;
+        for (uint8_t i = 0; i < count; i++) {
+            // Digital input buffers off: they draw current at mid-rail.
+            if (channels[i] < 8) DIDR0 |= _BV(channels[i]);
+#ifdef DIDR2
+            else DIDR2 |= _BV(channels[i] - 8);
+#endif
+        }
+        select(channels[0]);
+        ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+    }
+
+    // The ADC interrupt, with the result register.
+    void onConversion(uint16_t raw) {
+        if (skip) {
+            skip--;
+            return;
+        }
+        sum += raw;
+        if (++taken < 1U << 2 * ADC_OVERSAMPLE_BITS) return;
+        publish(sum >> ADC_OVERSAMPLE_BITS);
+        sum = 0;
+        taken = 0;
+        if (count < 2) return;
+        if (++current == count) current = 0;
+        select(channels[current]);
+        skip = 1;
+    }
+
+    // Latest filtered reading of the i-th channel, 0 before the first one.
+    uint16_t read(uint8_t i) const {
+        uint8_t before;
+        uint16_t value;
+        do {
+            before = published;
+            value = filtered[i] >> ADC_FILTER_SHIFT;
+        } while (before != published);
+        return value;
+    }
+
+private:
+    const uint8_t* channels;
+    uint8_t count;
+    uint8_t current;
+    uint8_t skip;
+    uint8_t taken;
+    uint16_t sum;
+    uint8_t primed;                         // bit i: channel i has a reading
+    volatile uint16_t filtered[ADC_CHANNELS_MAX];   // readings << ADC_FILTER_SHIFT
+    volatile uint8_t published;
+
+    // AVcc reference, right adjusted, free-running trigger. Takes effect
+    // from the next conversion that starts.
+    void select(uint8_t channel) {
+        ADMUX = _BV(REFS0) | (channel & 0x07);
+#ifdef MUX5
+        ADCSRB = channel & 0x08 ? _BV(MUX5) : 0;
+#else
+        ADCSRB = 0;
+#endif
+    }
+
+    void publish(uint16_t reading) {
+        uint16_t scaled = reading << ADC_FILTER_SHIFT;
+        if (!(primed & _BV(current))) {
+            primed |= _BV(current);
+            filtered[current] = scaled;
+        } else {
+            int16_t step = ((int16_t)(scaled - filtered[current])) >> ADC_FILTER_SHIFT;
+            filtered[current] += step;
+        }
+        published++;
+    }
+};
+
+#endif
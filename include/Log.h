@@ -0,0 +1,119 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <Arduino.h>
+
+// Compile-time filtered logging into a TX ring buffer.
+//
+//   LOG_INFO(CONTROL, F("delay is "), ms);      // one line: "delay is 300"
+//
+// A statement is compiled in only if its level is at or below LOG_LEVEL and
+// its category's LOG_CAT_<name> is 1. Anything else expands to an empty
+// statement before the compiler sees it, arguments and string literals
+// included. Enabled statements format into logBuffer, which
+// logBuffer.drain(Serial) empties into the UART as far as its TX buffer has
+// room, so logging never waits for the wire. A line that does not fit the
+// ring is cut short and counted in logBuffer.dropped(). Wrap literals in F()
+// so they stay in flash on AVR.
+//
+// Configure before including: LOG_LEVEL, LOG_CAT_SENSORS, LOG_CAT_CONTROL,
+// LOG_CAT_DISPLAY (each exactly 0 or 1) and LOG_BUFFER_SIZE.
+
+#define LOG_LEVEL_NONE      0
+#define LOG_LEVEL_ERROR     1
+#define LOG_LEVEL_INFO      2
+#define LOG_LEVEL_DEBUG     3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL           LOG_LEVEL_INFO
+#endif
+#ifndef LOG_CAT_SENSORS
+#define LOG_CAT_SENSORS     1
+#endif
+#ifndef LOG_CAT_CONTROL
+#define LOG_CAT_CONTROL     1
+#endif
+#ifndef LOG_CAT_DISPLAY
+#define LOG_CAT_DISPLAY     1
+#endif
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE     128
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(category, ...)    LOG_IF(LOG_CAT_##category, __VA_ARGS__)
+#else
+#define LOG_ERROR(category, ...)    do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(category, ...)     LOG_IF(LOG_CAT_##category, __VA_ARGS__)
+#else
+#define LOG_INFO(category, ...)     do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(category, ...)    LOG_IF(LOG_CAT_##category, __VA_ARGS__)
+#else
+#define LOG_DEBUG(category, ...)    do {} while (0)
+#endif
+
+// Two steps so LOG_CAT_<name> is replaced by its 0 or 1 before pasting.
+#define LOG_IF(enabled, ...)        LOG_IF_(enabled, __VA_ARGS__)
+#define LOG_IF_(enabled, ...)       LOG_IF_##enabled(__VA_ARGS__)
+#define LOG_IF_0(...)               do {} while (0)
+#define LOG_IF_1(...)               logLine(__VA_ARGS__)
+
+class LogBuffer : public Print {
+public:
+    LogBuffer() : head(0), tail(0), lost(0) {}
+
+    size_t write(uint8_t c) {
+        uint16_t next = (head + 1) % LOG_BUFFER_SIZE;
+        if (next == tail) {
+            lost++;
+            return 0;
+        }
+        buffer[head] = c;
+        head = next;
+        return 1;
+    }
+    using Print::write;
+
+    // Moves to `port` what its TX buffer takes without waiting.
+    template <class Port>
+    void drain(Port& port) {
+        int room = port.availableForWrite();
+        while (room-- > 0 && tail != head) {
+            port.write(buffer[tail]);
+            tail = (tail + 1) % LOG_BUFFER_SIZE;
+        }
+    }
+
+    unsigned long dropped() const {
+        return lost;
+    }
+
+private:
+    uint8_t buffer[LOG_BUFFER_SIZE];
+    uint16_t head, tail;
+    unsigned long lost;
+};
+
+extern LogBuffer logBuffer;
+
+inline void logPrint() {}
+
+template <typename T, typename... Rest>
+void logPrint(T value, Rest... rest) {
+    logBuffer.print(value);
+    logPrint(rest...);
+}
+
+template <typename... Args>
+void logLine(Args... args) {
+    logPrint(args...);
+    logBuffer.println();
+}
+
+#endif // LOG_H
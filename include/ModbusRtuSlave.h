@@ -0,0 +1,209 @@
+#ifndef MODBUS_RTU_SLAVE_H
+#define MODBUS_RTU_SLAVE_H
+
+#include <Arduino.h>
+#include <string.h>
+
+#define MODBUS_FRAME_MAX            64                  // request or response, CRC included
+
+#define MODBUS_READ_HOLDING         0x03
+#define MODBUS_READ_INPUT           0x04
+#define MODBUS_WRITE_SINGLE         0x06
+#define MODBUS_WRITE_MULTIPLE       0x10
+
+#define MODBUS_ILLEGAL_FUNCTION     0x01
+#define MODBUS_ILLEGAL_ADDRESS      0x02
+#define MODBUS_ILLEGAL_VALUE        0x03
+
+// Register access for ModbusRtuSlave. A read returns false for an address
+// outside the map. A write returns 0 or an exception code and only changes
+// something when `apply` is set, so a multi-register write is checked whole
+// before any of it lands.
+typedef bool (*ModbusReadFn)(uint16_t reg, uint16_t& value);
+typedef uint8_t (*ModbusWriteFn)(uint16_t reg, uint16_t value, bool apply);
+
+// Modbus RTU slave on a serial port: read holding/input registers (03/04)
+// and write single/multiple holding registers (06/16).
+//
+//   modbus.begin(115200);
+//   ...
+//   modbus.poll();          // as often as possible; never waits
+//
+// The UART receive interrupt fills the core's RX ring. poll() takes whatever
+// is there and feeds it to a byte-at-a-time parser, so a frame may arrive
+// across any number of calls. A frame ends at 3.5 characters of silence
+// seen with the RX ring empty: bytes that sat in the ring while loop() was
+// busy are not mistaken for a gap. A request to this slave may end earlier,
+// at the length its function code implies. Other stations' frames, whose
+// lengths a slave cannot know, only end at the gap.
+//
+// While loop() is busy, the ring can hold another station's frame and the
+// request after it with no gap seen between them. The buffer keeps the
+// newest MODBUS_FRAME_MAX bytes. A buffer that is not one frame with a valid
+// CRC is searched for a whole request to this slave at its end. Replies are
+// built in the request buffer and fit the TX ring, so write() does not wait
+// either. RS-485 direction is left to the transceiver.
+class ModbusRtuSlave {
+public:
+    ModbusRtuSlave(Stream& serial, uint8_t slaveId,
+                   ModbusReadFn readInput, ModbusReadFn readHolding, ModbusWriteFn writeHolding)
+        : port(serial), id(slaveId), readInputFn(readInput), readHoldingFn(readHolding),
+          writeHoldingFn(writeHolding), length(0), shifted(false), lastByteUs(0), gapUs(1750) {}
+
+    void begin(unsigned long baud) {
+        // Fixed 1.75 ms above 19200 baud, as the spec recommends.
+        gapUs = baud > 19200 ? 1750 : 38500000UL / baud;
+        length = 0;
+        shifted = false;
+    }
+
+    void poll() {
+        if (port.available() <= 0) {
+            if (length && micros() - lastByteUs > gapUs) endFrame();
+            return;
+        }
+        while (port.available() > 0) {
+            uint8_t b = port.read();
+            lastByteUs = micros();
+            if (length == MODBUS_FRAME_MAX) {
+                memmove(frame, frame + 1, MODBUS_FRAME_MAX - 1);
+                length--;
+                shifted = true;             // the buffer no longer starts a frame
+            }
+            frame[length++] = b;
+            if (!shifted && forUs(frame[0]) && length == expectedLength(frame, length)) endFrame();
+        }
+    }
+
+private:
+    Stream& port;
+    uint8_t id;
+    ModbusReadFn readInputFn;
+    ModbusReadFn readHoldingFn;
+    ModbusWriteFn writeHoldingFn;
+    uint8_t frame[MODBUS_FRAME_MAX];
+    uint8_t length;
+    bool shifted;
+    unsigned long lastByteUs;
+    unsigned long gapUs;
+
+    bool forUs(uint8_t address) const {
+        return address == id || address == 0;
+    }
+
+    // Length of the request in f for the supported function codes, 0 while
+    // its first n bytes do not tell.
+    static uint8_t expectedLength(const uint8_t* f, uint8_t n) {
+        if (n < 2) return 0;
+        switch (f[1]) {
+            case MODBUS_READ_HOLDING:
+            case MODBUS_READ_INPUT:
+            case MODBUS_WRITE_SINGLE:
+                return 8;
+            case MODBUS_WRITE_MULTIPLE:
+                if (n < 7 || f[6] > MODBUS_FRAME_MAX - 9) return 0;
+                return 9 + f[6];
+            default:
+                return 0;
+        }
+    }
+
+    static bool crcValid(const uint8_t* f, uint8_t n) {
+        return n >= 4 && crc16(f, n - 2) == (f[n - 2] | (uint16_t)f[n - 1] << 8);
+    }
+
+    // Offset of a whole request to this slave that ends the n buffered
+    // bytes, or n if there is none.
+    uint8_t requestAtEnd(uint8_t n) const {
+        for (uint8_t at = 1; at + 4 <= n; at++) {
+            const uint8_t* f = frame + at;
+            if (forUs(f[0]) && expectedLength(f, n - at) == n - at && crcValid(f, n - at)) return at;
+        }
+        return n;
+    }
+
+    uint16_t word(uint8_t at) const {
+        return (uint16_t)frame[at] << 8 | frame[at + 1];
+    }
+
+    static uint16_t crc16(const uint8_t* data, uint8_t n) {
+        uint16_t crc = 0xFFFF;
+        while (n--) {
+            crc ^= *data++;
+            for (uint8_t bit = 0; bit < 8; bit++) crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+        return crc;
+    }
+
+    void endFrame() {
+        uint8_t n = length;
+        bool whole = !shifted;
+        length = 0;
+        shifted = false;
+        if (!whole || !crcValid(frame, n)) {
+            uint8_t at = requestAtEnd(n);
+            if (at == n) return;
+            n -= at;
+            memmove(frame, frame + at, n);
+        }
+        const uint8_t address = frame[0];
+        if (!forUs(address)) return;
+
+        uint8_t reply = handle(n);
+        if (address == 0) return;           // broadcast: act, never answer
+        uint16_t crc = crc16(frame, reply);
+        frame[reply++] = crc & 0xFF;
+        frame[reply++] = crc >> 8;
+        port.write(frame, reply);
+    }
+
+    uint8_t exception(uint8_t code) {
+        frame[1] |= 0x80;
+        frame[2] = code;
+        return 3;
+    }
+
+    // Executes the request in frame and builds the reply in its place;
+    // returns the reply length without CRC.
+    uint8_t handle(uint8_t n) {
+        const uint8_t function = frame[1];
+        if (function != MODBUS_READ_HOLDING && function != MODBUS_READ_INPUT &&
+            function != MODBUS_WRITE_SINGLE && function != MODBUS_WRITE_MULTIPLE) {
+            return exception(MODBUS_ILLEGAL_FUNCTION);
+        }
+        if (n != expectedLength(frame, n)) return exception(MODBUS_ILLEGAL_VALUE);
+        const uint16_t start = word(2);
+        const uint16_t count = word(4);
+
+        if (function == MODBUS_READ_HOLDING || function == MODBUS_READ_INPUT) {
+            if (count < 1 || count > (MODBUS_FRAME_MAX - 5) / 2) return exception(MODBUS_ILLEGAL_VALUE);
+            ModbusReadFn read = function == MODBUS_READ_INPUT ? readInputFn : readHoldingFn;
+            for (uint16_t i = 0; i < count; i++) {
+                uint16_t value;
+                if (!read(start + i, value)) return exception(MODBUS_ILLEGAL_ADDRESS);
+                frame[3 + 2 * i] = value >> 8;
+                frame[4 + 2 * i] = value & 0xFF;
+            }
+            frame[2] = count * 2;
+            return 3 + count * 2;
+        }
+
+        if (function == MODBUS_WRITE_SINGLE) {
+            uint8_t code = writeHoldingFn(start, count, false);
+            if (code) return exception(code);
+            writeHoldingFn(start, count, true);
+            return 6;                       // echo of the request
+        }
+
+        // MODBUS_WRITE_MULTIPLE
+        if (count < 1 || frame[6] != count * 2) return exception(MODBUS_ILLEGAL_VALUE);
+        for (uint16_t i = 0; i < count; i++) {
+            uint8_t code = writeHoldingFn(start + i, word(7 + 2 * i), false);
+            if (code) return exception(code);
+        }
+        for (uint16_t i = 0; i < count; i++) writeHoldingFn(start + i, word(7 + 2 * i), true);
+        return 6;                           // address, function, start, count
+    }
+};
+
+#endif
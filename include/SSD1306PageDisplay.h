@@ -0,0 +1,189 @@
+#ifndef SSD1306_PAGE_DISPLAY_H
+#define SSD1306_PAGE_DISPLAY_H
+
+#include <string.h>
+#include <Adafruit_GFX.h>
+#include <Wire.h>
+
+#ifndef SSD1306_WHITE
+#define SSD1306_BLACK          0
+#define SSD1306_WHITE          1
+#define SSD1306_INVERSE        2
+#endif
+#ifndef SSD1306_SWITCHCAPVCC
+#define SSD1306_EXTERNALVCC    0x01
+#define SSD1306_SWITCHCAPVCC   0x02
+#endif
+
+#define SSD1306_PAGE_WIDTH     128                      // widest supported panel, one byte per column
+
+// Bytes per I2C transmission: the Wire buffer holds the 0x40 data prefix
+// plus this many pixel columns.
+#ifdef BUFFER_LENGTH
+#define SSD1306_PAGE_CHUNK     (BUFFER_LENGTH - 1)
+#else
+#define SSD1306_PAGE_CHUNK     31
+#endif
+
+// SSD1306 driven one 128x8 page at a time instead of from a full framebuffer.
+//
+//   display.firstPage();
+//   do {
+//       ...GFX drawing calls...
+//   } while (display.nextPage());
+//
+// The drawing code runs once per page, pixels outside the current page are
+// dropped and every finished page is streamed to the controller, so the
+// render costs 128 bytes of RAM instead of 1 KB. Output is identical to
+// Adafruit_SSD1306 drawing the same calls into its buffer.
+//
+// The same frame can also go out without blocking:
+//
+//   display.startFrame(drawScreen);     // drawScreen() is the loop body above
+//   ...
+//   display.flushStep();                // from the idle loop: one page per call
+//
+// Each flushStep() renders and sends one page (128 bytes, about 12 ms at
+// 100 kHz), so the caller never waits longer than that however much of
+// the screen changed.
+class SSD1306PageDisplay : public Adafruit_GFX {
+public:
+    SSD1306PageDisplay(int16_t w, int16_t h, TwoWire* twi)
+        : Adafruit_GFX(w, h), wire(twi), address(0x3C), page(0), frameDraw(NULL) {}
+
+    bool begin(uint8_t vccstate = SSD1306_SWITCHCAPVCC, uint8_t i2caddr = 0x3C) {
+        if (WIDTH > SSD1306_PAGE_WIDTH) return false;
+        address = i2caddr;
+        wire->begin();
+
+        const bool external = vccstate == SSD1306_EXTERNALVCC;
+        const uint8_t init[] = {
+            0xAE,                           // DISPLAYOFF
+            0xD5, 0x80,                     // SETDISPLAYCLOCKDIV
+            0xA8, (uint8_t)(HEIGHT - 1),    // SETMULTIPLEX
+            0xD3, 0x00,                     // SETDISPLAYOFFSET
+            0x40,                           // SETSTARTLINE 0
+            0x8D, (uint8_t)(external ? 0x10 : 0x14),   // CHARGEPUMP
+            0x20, 0x00,                     // MEMORYMODE horizontal
+            0xA1,                           // SEGREMAP
+            0xC8,                           // COMSCANDEC
+            0xDA, (uint8_t)(HEIGHT == 64 ? 0x12 : 0x02),   // SETCOMPINS
+            0x81, (uint8_t)(external ? 0x9F : 0xCF),   // SETCONTRAST
+            0xD9, (uint8_t)(external ? 0x22 : 0xF1),   // SETPRECHARGE
+            0xDB, 0x40,                     // SETVCOMDETECT
+            0xA4,                           // DISPLAYALLON_RESUME
+            0xA6,                           // NORMALDISPLAY
+            0x2E,                           // DEACTIVATE_SCROLL
+            0xAF,                           // DISPLAYON
+        };
+        commandList(init, sizeof(init));
+        return true;
+    }
+
+    void firstPage() {
+        frameDraw = NULL;       // a blocking frame replaces a pending one
+        page = 0;
+        clearDisplay();
+    }
+
+    // Sends the finished page; false once the last page is out.
+    bool nextPage() {
+        sendPage();
+        if (++page >= (HEIGHT + 7) / 8) {
+            page = 0;
+            return false;
+        }
+        clearDisplay();
+        return true;
+    }
+
+    // Queues a frame drawn by draw(), replacing any frame still going out.
+    void startFrame(void (*draw)()) {
+        frameDraw = draw;
+        page = 0;
+    }
+
+    // Renders and sends the next page of the queued frame; false when
+    // there was nothing to send.
+    bool flushStep() {
+        if (!frameDraw) return false;
+        clearDisplay();
+        frameDraw();
+        if (!nextPage()) frameDraw = NULL;
+        return true;
+    }
+
+    bool flushing() const {
+        return frameDraw != NULL;
+    }
+
+    // Clears the page being rendered, so drawing code written for a full
+    // buffer can keep calling it at the top of every pass.
+    void clearDisplay() {
+        memset(buffer, 0, sizeof(buffer));
+    }
+
+    void drawPixel(int16_t x, int16_t y, uint16_t color) {
+        if (x < 0 || x >= WIDTH || (y >> 3) != page || y < 0) return;
+        uint8_t bit = 1 << (y & 7);
+        switch (color) {
+            case SSD1306_WHITE:   buffer[x] |= bit;  break;
+            case SSD1306_BLACK:   buffer[x] &= ~bit; break;
+            case SSD1306_INVERSE: buffer[x] ^= bit;  break;
+        }
+    }
+
+    // Scaled glyphs are drawn as rectangles; clipping them to the page here
+    // skips the pixel loop for the seven pages they do not touch.
+    void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+        int16_t top = page * 8;
+        if (y < top) { h -= top - y; y = top; }
+        if (y + h > top + 8) h = top + 8 - y;
+        if (h <= 0 || w <= 0) return;
+        for (int16_t i = x; i < x + w; i++) {
+            for (int16_t j = y; j < y + h; j++) drawPixel(i, j, color);
+        }
+    }
+
+private:
+    void commandList(const uint8_t* c, uint8_t n) {
+        wire->beginTransmission(address);
+        wire->write((uint8_t)0x00);
+        uint8_t bytesOut = 1;
+        while (n--) {
+            if (bytesOut >= SSD1306_PAGE_CHUNK + 1) {
+                wire->endTransmission();
+                wire->beginTransmission(address);
+                wire->write((uint8_t)0x00);
+                bytesOut = 1;
+            }
+            wire->write(*c++);
+            bytesOut++;
+        }
+        wire->endTransmission();
+    }
+
+    void sendPage() {
+        const uint8_t window[] = {
+            0x22, page, page,                   // PAGEADDR
+            0x21, 0x00, (uint8_t)(WIDTH - 1),   // COLUMNADDR
+        };
+        commandList(window, sizeof(window));
+
+        for (int16_t x = 0; x < WIDTH; x += SSD1306_PAGE_CHUNK) {
+            wire->beginTransmission(address);
+            wire->write((uint8_t)0x40);
+            int16_t end = x + SSD1306_PAGE_CHUNK < WIDTH ? x + SSD1306_PAGE_CHUNK : WIDTH;
+            for (int16_t i = x; i < end; i++) wire->write(buffer[i]);
+            wire->endTransmission();
+        }
+    }
+
+    TwoWire* wire;
+    uint8_t address;
+    uint8_t page;
+    void (*frameDraw)();
+    uint8_t buffer[SSD1306_PAGE_WIDTH];
+};
+
+#endif // SSD1306_PAGE_DISPLAY_H
@@ -1,32 +1,199 @@
 #include "Arduino.h"
-#include <chrono>
-#include <thread>
 #include <map>
+#include <string.h>
+#include <unistd.h>
 
 SerialClass Serial;
+bool simVerbose = true;
 static std::map<uint8_t, uint8_t> pinModes;
 static std::map<uint8_t, uint8_t> pinStates;
-static auto programStart = std::chrono::steady_clock::now();
 
 void pinMode(uint8_t pin, uint8_t mode) {
     pinModes[pin] = mode;
-    printf("Pin %d set to mode %d\n", pin, mode);
+    if (simVerbose) printf("Pin %d set to mode %d\n", pin, mode);
 }
 
 void digitalWrite(uint8_t pin, uint8_t val) {
     pinStates[pin] = val;
-    printf("Pin %d set to %d\n", pin, val);
+    if (simVerbose) printf("Pin %d set to %d\n", pin, val);
 }
 
 int digitalRead(uint8_t pin) {
     return pinStates[pin];
 }
 
+void analogWrite(uint8_t pin, int val) {
+    pinStates[pin] = val;
+    if (simVerbose) printf("Pin %d PWM %d\n", pin, val);
+}
+
+volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0, DIDR2;
+volatile uint16_t ADC;
+
+static uint16_t analogInputs[16];
+static bool adcRunning = false;
+static uint8_t adcConverting;               // channel latched by the conversion in progress
+static unsigned long long adcDoneUs;        // when it completes
+static unsigned long long adcSeenUs;        // clock at the last busAdcRun()
+
+// A wait longer than this replays only its last conversions; the inputs
+// did not change during it.
+#define ADC_CATCHUP_CONVERSIONS 1024
+
+// Firmware without an ADC interrupt links this one.
+__attribute__((weak)) void ADC_vect() {}
+
+void simAnalogInput(uint8_t channel, uint16_t counts) {
+    analogInputs[channel & 0x0F] = counts > 1023 ? 1023 : counts;
+}
+
+static uint8_t adcChannel() {
+    return (ADMUX & 0x07) | (ADCSRB & _BV(MUX5));
+}
+
+// 13 ADC clocks; prescaler 2^ADPS, with 0 meaning 2.
+static unsigned long adcConversionUs() {
+    unsigned long prescaler = 1UL << (ADCSRA & 0x07);
+    if (prescaler == 1) prescaler = 2;
+    return 13 * prescaler * 1000000UL / F_CPU;
+}
+
+// A conversion samples the channel ADMUX selects when it starts. In
+// free-running mode the next one starts as the last one completes, before
+// the interrupt runs, so a channel switched in the interrupt applies one
+// conversion later, as on the chip.
+void busAdcRun(unsigned long long us) {
+    const uint8_t on = _BV(ADEN) | _BV(ADSC);
+    unsigned long long seen = adcSeenUs;
+    adcSeenUs = us;
+    if ((ADCSRA & on) != on) {
+        adcRunning = false;
+        return;
+    }
+    unsigned long long period = adcConversionUs();
+    if (us < seen) {                                    // the clock was rewound
+        adcRunning = false;
+        seen = us;
+    }
+    if (!adcRunning) {
+        // Started by a register write since the last clock move.
+        adcRunning = true;
+        adcConverting = adcChannel();
+        adcDoneUs = seen + period;
+    }
+    unsigned long long behind = us >= adcDoneUs ? (us - adcDoneUs) / period : 0;
+    if (behind > ADC_CATCHUP_CONVERSIONS) adcDoneUs += (behind - ADC_CATCHUP_CONVERSIONS) * period;
+    while (adcRunning && adcDoneUs <= us) {
+        ADC = analogInputs[adcConverting];
+        adcDoneUs += period;
+        if (ADCSRA & _BV(ADATE)) {
+            adcConverting = adcChannel();
+        } else {
+            ADCSRA &= ~_BV(ADSC);
+            adcRunning = false;
+        }
+        if (ADCSRA & _BV(ADIE)) {
+            ADC_vect();
+        } else {
+            ADCSRA |= _BV(ADIF);
+        }
+    }
+}
+
 unsigned long millis() {
-    auto now = std::chrono::steady_clock::now();
-    return std::chrono::duration_cast<std::chrono::milliseconds>(now - programStart).count();
+    return (unsigned long)(simMicros() / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long)simMicros();
 }
 
 void delay(unsigned long ms) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    busCharge(COST_DELAY, ms * 1000ULL);
+}
+
+void delayMicroseconds(unsigned int us) {
+    busCharge(COST_DELAY, us);
+}
+
+size_t SerialClass::write(uint8_t c) {
+    busSerialWrite();
+    if (_fd >= 0) return ::write(_fd, &c, 1) == 1;
+    if (simVerbose && c != '\r') putchar(c);
+    return 1;
+}
+
+int SerialClass::available() {
+    if (_rxHead == _rxTail && _fd >= 0) {
+        ssize_t n = ::read(_fd, _rx, sizeof _rx);       // non-blocking
+        _rxHead = 0;
+        _rxTail = n > 0 ? n : 0;
+    }
+    return _rxTail - _rxHead;
+}
+
+int SerialClass::read() {
+    return available() ? _rx[_rxHead++] : -1;
+}
+
+int SerialClass::peek() {
+    return available() ? _rx[_rxHead] : -1;
+}
+
+size_t Print::write(const char* str) {
+    return write((const uint8_t*)str, strlen(str));
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+}
+
+size_t Print::print(long n, int base) {
+    if (base == DEC && n < 0) {
+        size_t t = print('-');
+        return t + printNumber(-(unsigned long)n, DEC);
+    }
+    return printNumber(n, base);
+}
+
+size_t Print::printNumber(unsigned long n, int base) {
+    char buf[8 * sizeof(long) + 1];
+    char* str = &buf[sizeof(buf) - 1];
+    *str = '\0';
+    if (base < 2) base = 10;
+    do {
+        char c = n % base;
+        n /= base;
+        *--str = c < 10 ? c + '0' : c + 'A' - 10;
+    } while (n);
+    return write(str);
+}
+
+size_t Print::printFloat(double number, int digits) {
+    if (std::isnan(number)) return print("nan");
+    if (std::isinf(number)) return print("inf");
+    if (number > 4294967040.0 || number < -4294967040.0) return print("ovf");
+
+    size_t n = 0;
+    if (number < 0.0) {
+        n += print('-');
+        number = -number;
+    }
+    double rounding = 0.5;
+    for (int i = 0; i < digits; i++) rounding /= 10.0;
+    number += rounding;
+
+    unsigned long intPart = (unsigned long)number;
+    double remainder = number - (double)intPart;
+    n += print(intPart);
+    if (digits > 0) n += print('.');
+    while (digits-- > 0) {
+        remainder *= 10.0;
+        unsigned int toPrint = (unsigned int)remainder;
+        n += print(toPrint);
+        remainder -= toPrint;
+    }
+    return n;
 }
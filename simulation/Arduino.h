@@ -3,27 +3,93 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <cmath>
+#include <cstdlib>
 #include <string>
+#include "bus_model.h"
+
+using std::abs;
 
 // Mock Arduino functions and types
 typedef uint8_t byte;
+typedef bool boolean;
 #define HIGH 0x1
 #define LOW  0x0
 #define INPUT 0x0
 #define OUTPUT 0x1
 #define INPUT_PULLUP 0x2
 
-// Mock Serial class
-class SerialClass {
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+using String = std::string;
+
+// Mock Print class, formats numbers the way the Arduino core does
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    size_t write(const char* str);
+    size_t write(const uint8_t* buffer, size_t size);
+
+    size_t print(const char* str) { return write(str); }
+    size_t print(const String& str) { return write(str.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char n, int base = DEC) { return printNumber(n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return printNumber(n, base); }
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC) { return printNumber(n, base); }
+    size_t print(double n, int digits = 2) { return printFloat(n, digits); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+    template <typename T> size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+
+private:
+    size_t printNumber(unsigned long n, int base);
+    size_t printFloat(double n, int digits);
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+// Simulator hook: false silences the pin log and the Serial echo on stdout.
+extern bool simVerbose;
+
+#define SERIAL_RX_BUFFER_SIZE 64
+
+// Mock Serial class. Output is echoed to stdout; once a file descriptor is
+// attached (a pty in the simulator) the port reads from and writes to it
+// instead, with the AVR 64-byte RX ring.
+class SerialClass : public Stream {
 public:
-    void begin(unsigned long baud) { printf("Serial initialized at %lu baud\n", baud); }
-    void println(const char* str) { printf("%s\n", str); }
-    void println(const std::string& str) { printf("%s\n", str.c_str()); }
-    void println(float val) { printf("%f\n", val); }
-    void println(int val) { printf("%d\n", val); }
-    void print(const char* str) { printf("%s", str); }
-    void print(float val) { printf("%f", val); }
-    void print(int val) { printf("%d", val); }
+    SerialClass() : _fd(-1), _rxHead(0), _rxTail(0) {}
+    void begin(unsigned long baud) {
+        busConfig.serialBaud = baud;
+        if (simVerbose) printf("Serial initialized at %lu baud\n", baud);
+    }
+    size_t write(uint8_t c);
+    using Print::write;
+    int available();
+    int read();
+    int peek();
+    int availableForWrite() { return busSerialTxFree(); }
+
+    // Simulator hook: connect the port to a file descriptor.
+    void attach(int fd) { _fd = fd; }
+
+private:
+    int _fd;
+    uint8_t _rx[SERIAL_RX_BUFFER_SIZE];
+    size_t _rxHead, _rxTail;
 };
 
 extern SerialClass Serial;
@@ -32,11 +98,48 @@ extern SerialClass Serial;
 void pinMode(uint8_t pin, uint8_t mode);
 void digitalWrite(uint8_t pin, uint8_t val);
 int digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int val);
 
-// Mock time functions
+// Mock time functions, driven by the virtual clock in bus_model.h
 unsigned long millis();
+unsigned long micros();
 void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
 
 #define F(str) str
 
+// avr/sleep.h: the simulated MCU sleeps until the next Timer0 tick.
+#define SLEEP_MODE_IDLE 0
+inline void set_sleep_mode(uint8_t) {}
+inline void sleep_mode() { busSleep(); }
+
+// avr/io.h: the ADC and its interrupt, modelled in Arduino.cpp on the
+// virtual clock.
+#define F_CPU 16000000UL
+#define _BV(bit) (1 << (bit))
+extern volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0, DIDR2;
+extern volatile uint16_t ADC;
+#define REFS0 6
+#define ADEN  7
+#define ADSC  6
+#define ADATE 5
+#define ADIF  4
+#define ADIE  3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define MUX5  3
+#define ISR(vector) void vector()
+void ADC_vect();
+
+// Simulator hook: the voltage on ADC channel 0..15 from now on, in counts
+// of 1/1024 of AVcc.
+void simAnalogInput(uint8_t channel, uint16_t counts);
+
+// Flash is ordinary memory on the host.
+#define PROGMEM
+#define memcpy_P memcpy
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+
 #endif
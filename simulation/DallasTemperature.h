@@ -0,0 +1,2 @@
+// Simulator stand-in for <DallasTemperature.h>; the mocks live in mock_libraries.h.
+#include "mock_libraries.h"
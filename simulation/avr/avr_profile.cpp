@@ -0,0 +1,364 @@
+// Cycle profile of the real AVR firmware under simavr.
+//
+// Loads the ELF built by `pio run -e profile`, puts the firmware's DS18B20
+// sensors on the OneWire pin and an acknowledging SSD1306 on TWI, runs
+// setup() and then profiles whole loop() calls instruction by instruction:
+// self and inclusive cycles, instructions and calls per function, with the
+// function names taken from the ELF symbol table.
+//
+//   ./avr_profile ../../.pio/build/profile/firmware.elf --skip 1 --loops 1
+
+#include <cxxabi.h>
+#include <fcntl.h>
+#include <gelf.h>
+#include <libelf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_time.h"
+#include "i2c_display.h"
+#include "onewire_bus.h"
+
+// Sensor addresses from src/main.cpp, T1..T5 (T6 shares T5's ROM there).
+static const uint8_t sensorRoms[5][8] = {
+    {0x28, 0x53, 0x8E, 0x95, 0xF0, 0x01, 0x3C, 0x34},
+    {0x28, 0x8A, 0x3D, 0x95, 0xF0, 0xFF, 0x3C, 0x22},
+    {0x28, 0xA6, 0x93, 0x95, 0xF0, 0x01, 0x3C, 0x3D},
+    {0x28, 0x66, 0xC6, 0x95, 0xF0, 0x01, 0x3C, 0xE5},
+    {0x28, 0x32, 0xBD, 0x56, 0xB5, 0x01, 0x3C, 0xBF},
+};
+
+struct Function {
+    std::string name;
+    uint32_t addr;              // byte address in flash
+    uint32_t size;
+    unsigned long long selfCycles;
+    unsigned long long inclusiveCycles;
+    unsigned long long instructions;
+    unsigned long calls;
+    int active;                 // frames on the shadow stack, for recursion
+};
+
+struct Frame {
+    int function;
+    avr_cycle_count_t enteredAt;
+};
+
+enum OpKind { OP_OTHER, OP_CALL, OP_RET, OP_PUSH };
+
+static std::vector<Function> functions;
+
+static std::string demangle(const char* name) {
+    int status = 0;
+    char* d = abi::__cxa_demangle(name, NULL, NULL, &status);
+    if (status != 0 || !d) return name;
+    std::string s(d);
+    free(d);
+    return s;
+}
+
+static bool byAddress(const Function& a, const Function& b) {
+    return a.addr < b.addr;
+}
+
+// Function symbols of the ELF. Assembly routines without a size (libgcc's
+// float emulation among them) extend to the next symbol.
+static bool readSymbols(const char* path) {
+    if (elf_version(EV_CURRENT) == EV_NONE) return false;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    Elf* elf = elf_begin(fd, ELF_C_READ, NULL);
+    Elf_Scn* scn = NULL;
+    while (elf && (scn = elf_nextscn(elf, scn))) {
+        GElf_Shdr shdr;
+        if (!gelf_getshdr(scn, &shdr) || shdr.sh_type != SHT_SYMTAB) continue;
+        Elf_Data* data = elf_getdata(scn, NULL);
+        size_t count = shdr.sh_entsize ? shdr.sh_size / shdr.sh_entsize : 0;
+        for (size_t i = 0; i < count; i++) {
+            GElf_Sym sym;
+            if (!gelf_getsym(data, i, &sym) || GELF_ST_TYPE(sym.st_info) != STT_FUNC) continue;
+            Function f = Function();
+            f.name = demangle(elf_strptr(elf, shdr.sh_link, sym.st_name));
+            f.addr = sym.st_value;
+            f.size = sym.st_size;
+            functions.push_back(f);
+        }
+    }
+    if (elf) elf_end(elf);
+    close(fd);
+
+    std::sort(functions.begin(), functions.end(), byAddress);
+    for (size_t i = 0; i < functions.size(); i++) {
+        if (!functions[i].size && i + 1 < functions.size()) {
+            functions[i].size = functions[i + 1].addr - functions[i].addr;
+        }
+    }
+    Function unknown = Function();
+    unknown.name = "[unknown]";
+    functions.push_back(unknown);
+    return functions.size() > 1;
+}
+
+static int lookup(uint32_t pc) {
+    size_t lo = 0, hi = functions.size() - 1;     // last entry is [unknown]
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (functions[mid].addr + functions[mid].size <= pc) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < functions.size() - 1 && functions[lo].addr <= pc && pc < functions[lo].addr + functions[lo].size) {
+        return lo;
+    }
+    return functions.size() - 1;
+}
+
+static int find(const char* name) {
+    for (size_t i = 0; i + 1 < functions.size(); i++) {
+        if (functions[i].name == name) return i;
+    }
+    return -1;
+}
+
+static OpKind classify(avr_t* avr, uint32_t pc) {
+    uint16_t op = avr->flash[pc] | (avr->flash[pc + 1] << 8);
+    if ((op & 0xFE0E) == 0x940E) return OP_CALL;        // CALL
+    if ((op & 0xF000) == 0xD000) return OP_CALL;        // RCALL
+    if (op == 0x9509 || op == 0x9519) return OP_CALL;   // ICALL, EICALL
+    if (op == 0x9508 || op == 0x9518) return OP_RET;    // RET, RETI
+    if ((op & 0xFE0F) == 0x920F) return OP_PUSH;
+    return OP_OTHER;
+}
+
+static uint16_t stackPointer(avr_t* avr) {
+    return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+}
+
+static void enter(std::vector<Frame>& stack, int function, avr_cycle_count_t now) {
+    Frame frame = {function, now};
+    stack.push_back(frame);
+    functions[function].calls++;
+    functions[function].active++;
+}
+
+static void leave(std::vector<Frame>& stack, avr_cycle_count_t now) {
+    Frame frame = stack.back();
+    stack.pop_back();
+    Function& f = functions[frame.function];
+    if (--f.active == 0) f.inclusiveCycles += now - frame.enteredAt;
+}
+
+static bool running(int state) {
+    return state != cpu_Done && state != cpu_Crashed;
+}
+
+struct Options {
+    const char* elf;
+    const char* mcu;
+    uint32_t frequency;
+    char onewirePort;
+    int onewireBit;
+    float temps[5];
+    int skip;
+    int loops;
+    int top;
+    double maxSeconds;
+    const char* csv;
+};
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s firmware.elf [--mcu NAME] [--freq HZ] [--onewire PORTBIT]\n"
+            "          [--temps T1,T2,T3,T4,T5] [--skip N] [--loops N] [--top N]\n"
+            "          [--max-seconds S] [--csv FILE]\n"
+            "  --mcu NAME         simavr core (default atmega2560)\n"
+            "  --freq HZ          clock (default 16000000)\n"
+            "  --onewire PORTBIT  OneWire pin, e.g. J1 for Mega pin 14 (default)\n"
+            "  --temps ...        sensor readings in degrees (default 30,35,5,50,2)\n"
+            "  --skip N           loop() calls to run before profiling (default 0)\n"
+            "  --loops N          loop() calls to profile (default 1)\n"
+            "  --top N            rows in the report (default 40)\n"
+            "  --max-seconds S    give up after S simulated seconds (default 120)\n"
+            "  --csv FILE         also write every function's counters as CSV\n",
+            argv0);
+}
+
+static bool parseTemps(const char* arg, float temps[5]) {
+    return sscanf(arg, "%f,%f,%f,%f,%f", &temps[0], &temps[1], &temps[2], &temps[3], &temps[4]) == 5;
+}
+
+static bool byInclusive(const Function* a, const Function* b) {
+    if (a->inclusiveCycles != b->inclusiveCycles) return a->inclusiveCycles > b->inclusiveCycles;
+    return a->selfCycles > b->selfCycles;
+}
+
+static void report(const Options& opt, unsigned long long total, uint32_t frequency,
+                   const OneWireBus& onewire, const I2CDisplay& display) {
+    std::vector<const Function*> rows;
+    for (size_t i = 0; i < functions.size(); i++) {
+        if (functions[i].selfCycles || functions[i].inclusiveCycles) rows.push_back(&functions[i]);
+    }
+    std::sort(rows.begin(), rows.end(), byInclusive);
+
+    printf("%d loop() call(s): %llu cycles, %.3f ms at %.1f MHz\n", opt.loops, total,
+           total * 1000.0 / frequency, frequency / 1e6);
+    printf("onewire: %lu resets, %lu slots | i2c: %lu transmissions, %lu bytes\n\n",
+           onewire.resets(), onewire.slots(), display.transmissions(), display.bytes());
+    printf("%-40s %8s %14s %6s %14s %6s %12s\n", "function", "calls", "inclusive", "%", "self", "%", "instructions");
+    for (size_t i = 0; i < rows.size() && (int)i < opt.top; i++) {
+        const Function* f = rows[i];
+        printf("%-40.40s %8lu %14llu %5.1f%% %14llu %5.1f%% %12llu\n", f->name.c_str(), f->calls,
+               f->inclusiveCycles, 100.0 * f->inclusiveCycles / total,
+               f->selfCycles, 100.0 * f->selfCycles / total, f->instructions);
+    }
+
+    if (!opt.csv) return;
+    FILE* out = fopen(opt.csv, "w");
+    if (!out) {
+        fprintf(stderr, "cannot write %s\n", opt.csv);
+        return;
+    }
+    fprintf(out, "function,calls,inclusive_cycles,self_cycles,instructions\n");
+    for (size_t i = 0; i < rows.size(); i++) {
+        fprintf(out, "\"%s\",%lu,%llu,%llu,%llu\n", rows[i]->name.c_str(), rows[i]->calls,
+                rows[i]->inclusiveCycles, rows[i]->selfCycles, rows[i]->instructions);
+    }
+    fclose(out);
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    opt.elf = NULL;
+    opt.mcu = "atmega2560";
+    opt.frequency = 0;
+    opt.onewirePort = 'J';
+    opt.onewireBit = 1;
+    const float defaultTemps[5] = {30, 35, 5, 50, 2};
+    memcpy(opt.temps, defaultTemps, sizeof opt.temps);
+    opt.skip = 0;
+    opt.loops = 1;
+    opt.top = 40;
+    opt.maxSeconds = 120;
+    opt.csv = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (!strcmp(argv[i], "--mcu") && more) opt.mcu = argv[++i];
+        else if (!strcmp(argv[i], "--freq") && more) opt.frequency = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--onewire") && more && strlen(argv[i + 1]) == 2) {
+            opt.onewirePort = argv[++i][0];
+            opt.onewireBit = argv[i][1] - '0';
+        }
+        else if (!strcmp(argv[i], "--temps") && more && parseTemps(argv[i + 1], opt.temps)) i++;
+        else if (!strcmp(argv[i], "--skip") && more) opt.skip = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--loops") && more) opt.loops = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--top") && more) opt.top = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--max-seconds") && more) opt.maxSeconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--csv") && more) opt.csv = argv[++i];
+        else if (argv[i][0] != '-' && !opt.elf) opt.elf = argv[i];
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!opt.elf || opt.loops < 1 || opt.onewireBit < 0 || opt.onewireBit > 7) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    elf_firmware_t firmware;
+    memset(&firmware, 0, sizeof firmware);
+    if (elf_read_firmware(opt.elf, &firmware) != 0) {
+        fprintf(stderr, "cannot load %s\n", opt.elf);
+        return 1;
+    }
+    // PlatformIO builds carry no .mmcu section.
+    if (!firmware.mmcu[0]) strncpy(firmware.mmcu, opt.mcu, sizeof firmware.mmcu - 1);
+    if (opt.frequency) firmware.frequency = opt.frequency;
+    if (!firmware.frequency) firmware.frequency = 16000000;
+
+    if (!readSymbols(opt.elf)) {
+        fprintf(stderr, "%s: no symbol table\n", opt.elf);
+        return 1;
+    }
+    int loopFunction = find("loop()");
+    if (loopFunction < 0) loopFunction = find("loop");
+    if (loopFunction < 0) {
+        fprintf(stderr, "%s: no loop() symbol\n", opt.elf);
+        return 1;
+    }
+    uint32_t loopAddr = functions[loopFunction].addr;
+
+    avr_t* avr = avr_make_mcu_by_name(firmware.mmcu);
+    if (!avr) {
+        fprintf(stderr, "unknown mcu %s\n", firmware.mmcu);
+        return 1;
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &firmware);
+
+    OneWireBus onewire;
+    I2CDisplay display;
+    if (!onewire.attach(avr, opt.onewirePort, opt.onewireBit) || !display.attach(avr)) {
+        fprintf(stderr, "%s has no port %c or no TWI\n", firmware.mmcu, opt.onewirePort);
+        return 1;
+    }
+    for (int i = 0; i < 5; i++) onewire.addSensor(sensorRoms[i], opt.temps[i]);
+
+    avr_cycle_count_t limit = (avr_cycle_count_t)(opt.maxSeconds * avr->frequency);
+    int state = cpu_Running;
+
+    // setup() and the loop() calls to skip.
+    for (int entered = 0; entered <= opt.skip; entered++) {
+        if (entered) state = avr_run(avr);      // step off the entry point
+        while (running(state) && avr->pc != loopAddr && avr->cycle < limit) state = avr_run(avr);
+    }
+    if (avr->pc != loopAddr) {
+        fprintf(stderr, "loop() not reached after %.1f simulated seconds\n", avr->cycle / (double)avr->frequency);
+        return 1;
+    }
+
+    std::vector<Frame> stack;
+    unsigned long long total = 0;
+    for (int n = 0; n < opt.loops && running(state); n++) {
+        while (running(state) && avr->pc != loopAddr && avr->cycle < limit) state = avr_run(avr);
+        avr_cycle_count_t start = avr->cycle;
+        enter(stack, loopFunction, start);
+
+        while (!stack.empty() && running(state) && avr->cycle < limit) {
+            uint32_t pc = avr->pc;
+            OpKind kind = classify(avr, pc);
+            uint16_t sp = stackPointer(avr);
+            avr_cycle_count_t before = avr->cycle;
+
+            state = avr_run(avr);
+
+            Function& f = functions[lookup(pc)];
+            f.selfCycles += avr->cycle - before;
+            f.instructions++;
+
+            if (kind == OP_CALL) {
+                enter(stack, lookup(avr->pc), avr->cycle);
+            } else if (kind == OP_RET) {
+                leave(stack, avr->cycle);
+            } else if (kind != OP_PUSH && stackPointer(avr) + avr->address_size == sp) {
+                // Interrupt entry: the return address went on the stack
+                // without a call instruction.
+                enter(stack, lookup(avr->pc), avr->cycle);
+            }
+        }
+        if (!stack.empty()) {
+            fprintf(stderr, "loop() did not return within %.1f simulated seconds\n", opt.maxSeconds);
+            return 1;
+        }
+        total += avr->cycle - start;
+    }
+
+    report(opt, total, avr->frequency, onewire, display);
+    return 0;
+}
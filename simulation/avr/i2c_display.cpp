@@ -0,0 +1,41 @@
+#include "i2c_display.h"
+#include "avr_twi.h"
+#include "sim_io.h"
+
+I2CDisplay::I2CDisplay(uint8_t address7)
+    : address(address7 << 1), selected(false), irq(NULL), transmissionCount(0), byteCount(0) {}
+
+bool I2CDisplay::attach(avr_t* avr) {
+    static const char* names[2] = {"=ssd1306.in", "=ssd1306.out"};
+    avr_irq_t* twiIn = avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT);
+    avr_irq_t* twiOut = avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT);
+    if (!twiIn || !twiOut) return false;
+
+    irq = avr_alloc_irq(&avr->irq_pool, 0, 2, names);
+    avr_irq_register_notify(irq + TWI_IRQ_OUTPUT, onMessage, this);
+    avr_connect_irq(irq + TWI_IRQ_INPUT, twiIn);
+    avr_connect_irq(twiOut, irq + TWI_IRQ_OUTPUT);
+    return true;
+}
+
+void I2CDisplay::onMessage(avr_irq_t*, uint32_t value, void* param) {
+    I2CDisplay* d = (I2CDisplay*)param;
+    avr_twi_msg_irq_t msg;
+    msg.u.v = value;
+
+    if (msg.u.twi.msg & TWI_COND_STOP) d->selected = false;
+
+    if (msg.u.twi.msg & TWI_COND_START) {
+        d->selected = (msg.u.twi.addr & 0xFE) == d->address;
+        if (d->selected) {
+            d->transmissionCount++;
+            d->byteCount++;
+            avr_raise_irq(d->irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, d->address, 1));
+        }
+    }
+
+    if (d->selected && (msg.u.twi.msg & TWI_COND_WRITE)) {
+        d->byteCount++;
+        avr_raise_irq(d->irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, d->address, 1));
+    }
+}
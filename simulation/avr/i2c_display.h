@@ -0,0 +1,30 @@
+#ifndef I2C_DISPLAY_H
+#define I2C_DISPLAY_H
+
+#include <stdint.h>
+#include "sim_avr.h"
+#include "sim_irq.h"
+
+// SSD1306 stand-in on the TWI bus of the simulated AVR: acknowledges its
+// address and every byte written to it and counts the traffic, so the
+// firmware's Wire transfers run at the real bus speed without a panel.
+class I2CDisplay {
+public:
+    explicit I2CDisplay(uint8_t address7 = 0x3C);
+
+    bool attach(avr_t* avr);
+
+    unsigned long transmissions() const { return transmissionCount; }
+    unsigned long bytes() const { return byteCount; }
+
+private:
+    static void onMessage(avr_irq_t* irq, uint32_t value, void* param);
+
+    uint8_t address;            // 8-bit form, as simavr reports it
+    bool selected;
+    avr_irq_t* irq;             // [TWI_IRQ_INPUT, TWI_IRQ_OUTPUT]
+    unsigned long transmissionCount;
+    unsigned long byteCount;
+};
+
+#endif
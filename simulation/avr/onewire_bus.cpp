@@ -0,0 +1,292 @@
+#include "onewire_bus.h"
+#include <math.h>
+#include <string.h>
+#include "avr_ioport.h"
+#include "sim_cycle_timers.h"
+#include "sim_io.h"
+#include "sim_time.h"
+
+// Slot decoding thresholds, in microseconds of the master holding the line.
+#define SLOT_ONE_MAX_US     15
+#define RESET_MIN_US        400
+
+// Slave responses.
+#define PRESENCE_DELAY_US   30
+#define PRESENCE_US         120
+#define READ_ZERO_US        30
+
+uint8_t oneWireCrc8(const uint8_t* data, int len) {
+    uint8_t crc = 0;
+    while (len--) {
+        uint8_t b = *data++;
+        for (int i = 0; i < 8; i++) {
+            uint8_t mix = (crc ^ b) & 0x01;
+            crc >>= 1;
+            if (mix) crc ^= 0x8C;
+            b >>= 1;
+        }
+    }
+    return crc;
+}
+
+static int romBit(const uint8_t* rom, int bit) {
+    return rom[bit / 8] >> (bit % 8) & 1;
+}
+
+OneWireBus::OneWireBus()
+    : avr(NULL), pin(NULL), mask(0), ddr(0), port(0), masterLow(false), slaveLow(false),
+      fellAt(0), phase(PHASE_IDLE), rxByte(0), rxBits(0), searchBit(0), searchStep(0),
+      txPos(0), resetCount(0), slotCount(0) {}
+
+bool OneWireBus::attach(avr_t* a, char portName, int bit) {
+    avr = a;
+    mask = 1 << bit;
+    avr_irq_t* direction = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(portName), IOPORT_IRQ_DIRECTION_ALL);
+    avr_irq_t* output = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(portName), IOPORT_IRQ_REG_PORT);
+    pin = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(portName), bit);
+    if (!direction || !output || !pin) return false;
+    avr_irq_register_notify(direction, onDirection, this);
+    avr_irq_register_notify(output, onPort, this);
+    drive();    // external pull-up
+    return true;
+}
+
+void OneWireBus::addSensor(const uint8_t rom[8], float tempC) {
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (!memcmp(devices[i].sensor.rom, rom, 8)) return;
+    }
+    Device d;
+    memset(&d, 0, sizeof d);
+    memcpy(d.sensor.rom, rom, 8);
+    d.sensor.tempC = tempC;
+    // Power-on scratchpad: 85 degrees, TH/TL defaults, 12-bit resolution.
+    const uint8_t powerOn[8] = {0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10};
+    memcpy(d.sensor.scratchpad, powerOn, 8);
+    d.sensor.scratchpad[8] = oneWireCrc8(d.sensor.scratchpad, 8);
+    devices.push_back(d);
+}
+
+void OneWireBus::onDirection(avr_irq_t*, uint32_t value, void* param) {
+    OneWireBus* bus = (OneWireBus*)param;
+    bus->ddr = value;
+    bus->update();
+}
+
+void OneWireBus::onPort(avr_irq_t*, uint32_t value, void* param) {
+    OneWireBus* bus = (OneWireBus*)param;
+    bus->port = value;
+    bus->update();
+}
+
+// Open drain: the master pulls low with DDR=1, PORT=0 and releases by
+// switching to input.
+void OneWireBus::update() {
+    bool low = (ddr & mask) && !(port & mask);
+    if (low == masterLow) return;
+    masterLow = low;
+    if (low) masterFell();
+    else masterRose();
+}
+
+void OneWireBus::masterFell() {
+    fellAt = avr->cycle;
+    if (txBit() == 0) slavePull(READ_ZERO_US);
+}
+
+void OneWireBus::masterRose() {
+    uint32_t us = avr_cycles_to_usec(avr, avr->cycle - fellAt);
+    if (us >= RESET_MIN_US) {
+        reset();
+        return;
+    }
+    slotCount++;
+    receiveBit(us < SLOT_ONE_MAX_US ? 1 : 0);
+}
+
+void OneWireBus::reset() {
+    resetCount++;
+    phase = devices.empty() ? PHASE_IDLE : PHASE_ROM_COMMAND;
+    rxByte = 0;
+    rxBits = 0;
+    rx.clear();
+    for (size_t i = 0; i < devices.size(); i++) devices[i].selected = false;
+    if (!devices.empty()) avr_cycle_timer_register_usec(avr, PRESENCE_DELAY_US, startPresence, this);
+}
+
+avr_cycle_count_t OneWireBus::startPresence(avr_t*, avr_cycle_count_t, void* param) {
+    ((OneWireBus*)param)->slavePull(PRESENCE_US);
+    return 0;
+}
+
+avr_cycle_count_t OneWireBus::releaseSlave(avr_t*, avr_cycle_count_t, void* param) {
+    OneWireBus* bus = (OneWireBus*)param;
+    bus->slaveLow = false;
+    bus->drive();
+    return 0;
+}
+
+void OneWireBus::slavePull(uint32_t usec) {
+    slaveLow = true;
+    drive();
+    avr_cycle_timer_register_usec(avr, usec, releaseSlave, this);
+}
+
+void OneWireBus::drive() {
+    avr_raise_irq(pin, slaveLow ? 0 : 1);
+}
+
+// The bit the selected sensors put on the line in this slot (wired AND),
+// or -1 when they are listening.
+int OneWireBus::txBit() {
+    int bit = 1;
+    switch (phase) {
+        case PHASE_SEND:
+            if (txPos < (int)tx.size() * 8) bit = tx[txPos / 8] >> (txPos % 8) & 1;
+            return bit;
+        case PHASE_CONVERTING:
+            for (size_t i = 0; i < devices.size(); i++) {
+                if (devices[i].selected && avr->cycle < devices[i].sensor.convertDone) bit = 0;
+            }
+            return bit;
+        case PHASE_SEARCH_ROM:
+            if (searchStep == 2) return -1;
+            for (size_t i = 0; i < devices.size(); i++) {
+                if (!devices[i].selected) continue;
+                int b = romBit(devices[i].sensor.rom, searchBit);
+                if ((searchStep == 0 ? b : !b) == 0) bit = 0;
+            }
+            return bit;
+        default:
+            return -1;
+    }
+}
+
+void OneWireBus::receiveBit(int bit) {
+    switch (phase) {
+        case PHASE_SEND:
+            txPos++;
+            if (txPos >= (int)tx.size() * 8) phase = PHASE_IDLE;
+            return;
+        case PHASE_SEARCH_ROM:
+            if (searchStep < 2) {
+                searchStep++;
+                return;
+            }
+            for (size_t i = 0; i < devices.size(); i++) {
+                if (romBit(devices[i].sensor.rom, searchBit) != bit) devices[i].selected = false;
+            }
+            searchStep = 0;
+            if (++searchBit == 64) phase = PHASE_IDLE;
+            return;
+        case PHASE_IDLE:
+        case PHASE_CONVERTING:
+            return;
+        default:
+            break;
+    }
+
+    rxByte |= bit << rxBits;
+    if (++rxBits < 8) return;
+    uint8_t byte = rxByte;
+    rxByte = 0;
+    rxBits = 0;
+
+    switch (phase) {
+        case PHASE_ROM_COMMAND:
+            for (size_t i = 0; i < devices.size(); i++) devices[i].selected = true;
+            if (byte == 0xCC) {                             // SKIP ROM
+                phase = PHASE_FUNCTION;
+            } else if (byte == 0x55) {                      // MATCH ROM
+                rx.clear();
+                phase = PHASE_MATCH_ROM;
+            } else if (byte == 0xF0) {                      // SEARCH ROM
+                searchBit = 0;
+                searchStep = 0;
+                phase = PHASE_SEARCH_ROM;
+            } else if (byte == 0x33 && devices.size() == 1) {   // READ ROM
+                tx.assign(devices[0].sensor.rom, devices[0].sensor.rom + 8);
+                txPos = 0;
+                phase = PHASE_SEND;
+            } else {
+                phase = PHASE_IDLE;
+            }
+            break;
+        case PHASE_MATCH_ROM:
+            rx.push_back(byte);
+            if (rx.size() < 8) break;
+            for (size_t i = 0; i < devices.size(); i++) {
+                devices[i].selected = !memcmp(devices[i].sensor.rom, rx.data(), 8);
+            }
+            phase = PHASE_FUNCTION;
+            break;
+        case PHASE_FUNCTION:
+            command(byte);
+            break;
+        case PHASE_WRITE_SCRATCHPAD:
+            rx.push_back(byte);
+            if (rx.size() < 3) break;
+            for (size_t i = 0; i < devices.size(); i++) {
+                if (!devices[i].selected) continue;
+                uint8_t* sp = devices[i].sensor.scratchpad;
+                sp[2] = rx[0];
+                sp[3] = rx[1];
+                sp[4] = (rx[2] & 0x60) | 0x1F;
+                sp[8] = oneWireCrc8(sp, 8);
+            }
+            phase = PHASE_IDLE;
+            break;
+        default:
+            break;
+    }
+}
+
+void OneWireBus::command(uint8_t cmd) {
+    switch (cmd) {
+        case 0x44:                                          // CONVERT T
+            for (size_t i = 0; i < devices.size(); i++) {
+                if (devices[i].selected) convert(devices[i]);
+            }
+            phase = PHASE_CONVERTING;
+            return;
+        case 0xBE:                                          // READ SCRATCHPAD
+            for (size_t i = 0; i < devices.size(); i++) {
+                if (!devices[i].selected) continue;
+                tx.assign(devices[i].sensor.scratchpad, devices[i].sensor.scratchpad + 9);
+                txPos = 0;
+                phase = PHASE_SEND;
+                return;
+            }
+            phase = PHASE_IDLE;
+            return;
+        case 0x4E:                                          // WRITE SCRATCHPAD
+            rx.clear();
+            phase = PHASE_WRITE_SCRATCHPAD;
+            return;
+        case 0xB4:                                          // READ POWER SUPPLY: external
+            tx.assign(1, 0xFF);
+            txPos = 0;
+            phase = PHASE_SEND;
+            return;
+        default:                                            // COPY SCRATCHPAD, RECALL E2
+            phase = PHASE_IDLE;
+            return;
+    }
+}
+
+// Measures tempC at the configured resolution; the result is readable once
+// the conversion time for that resolution has passed.
+void OneWireBus::convert(Device& d) {
+    int resolution = 9 + (d.sensor.scratchpad[4] >> 5 & 3);
+    d.sensor.convertDone = avr->cycle + avr_usec_to_cycles(avr, 750000 >> (12 - resolution));
+    fillScratchpad(d);
+}
+
+void OneWireBus::fillScratchpad(Device& d) {
+    int resolution = 9 + (d.sensor.scratchpad[4] >> 5 & 3);
+    int16_t raw = (int16_t)lroundf(d.sensor.tempC * 16.0f);
+    raw &= ~((1 << (12 - resolution)) - 1);     // undefined low bits read as 0
+    uint8_t* sp = d.sensor.scratchpad;
+    sp[0] = raw & 0xFF;
+    sp[1] = (uint16_t)raw >> 8;
+    sp[8] = oneWireCrc8(sp, 8);
+}
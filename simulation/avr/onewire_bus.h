@@ -0,0 +1,96 @@
+#ifndef ONEWIRE_BUS_H
+#define ONEWIRE_BUS_H
+
+#include <stdint.h>
+#include <vector>
+#include "sim_avr.h"
+#include "sim_irq.h"
+
+// DS18B20 sensors on a bit-banged OneWire pin of the simulated AVR.
+//
+// The master's side of the open-drain line is reconstructed from the DDR and
+// PORT bits the OneWire library toggles; the sensors pull the line low
+// through the pin's input IRQ. Slots are decoded from how long the master
+// holds the line low, using the library's timing (reset 480 us, write-0
+// 65 us, write-1/read 3-10 us). Supported: SKIP ROM, MATCH ROM, SEARCH ROM,
+// CONVERT T, READ/WRITE SCRATCHPAD, COPY SCRATCHPAD, READ POWER SUPPLY.
+
+struct DS18B20 {
+    uint8_t rom[8];
+    float tempC;                    // what the next conversion measures
+    uint8_t scratchpad[9];
+    avr_cycle_count_t convertDone;  // conversion busy until this cycle
+};
+
+class OneWireBus {
+public:
+    OneWireBus();
+
+    // Attaches to pin `bit` of port `port` ('A'..'L').
+    bool attach(avr_t* avr, char port, int bit);
+    void addSensor(const uint8_t rom[8], float tempC);
+
+    unsigned long resets() const { return resetCount; }
+    unsigned long slots() const { return slotCount; }
+
+private:
+    enum Phase {
+        PHASE_IDLE,             // waiting for a reset
+        PHASE_ROM_COMMAND,
+        PHASE_MATCH_ROM,
+        PHASE_SEARCH_ROM,
+        PHASE_FUNCTION,
+        PHASE_WRITE_SCRATCHPAD,
+        PHASE_SEND,             // shifting out txBits
+        PHASE_CONVERTING,       // read slots report busy/done
+    };
+
+    struct Device {
+        DS18B20 sensor;
+        bool selected;
+    };
+
+    static void onDirection(avr_irq_t* irq, uint32_t value, void* param);
+    static void onPort(avr_irq_t* irq, uint32_t value, void* param);
+    static avr_cycle_count_t releaseSlave(avr_t* avr, avr_cycle_count_t when, void* param);
+    static avr_cycle_count_t startPresence(avr_t* avr, avr_cycle_count_t when, void* param);
+
+    void update();
+    void masterFell();
+    void masterRose();
+    void reset();
+    void receiveBit(int bit);
+    void command(uint8_t cmd);
+    int txBit();
+    void slavePull(uint32_t usec);
+    void drive();
+
+    void convert(Device& d);
+    void fillScratchpad(Device& d);
+
+    avr_t* avr;
+    avr_irq_t* pin;
+    uint8_t mask;
+    uint8_t ddr;
+    uint8_t port;
+    bool masterLow;
+    bool slaveLow;
+    avr_cycle_count_t fellAt;
+
+    std::vector<Device> devices;
+    Phase phase;
+    uint8_t rxByte;
+    int rxBits;
+    int searchBit;              // 0..63
+    int searchStep;             // 0: send bit, 1: send complement, 2: read direction
+    std::vector<uint8_t> rx;    // bytes received in the current phase
+    std::vector<uint8_t> tx;    // bytes to send
+    int txPos;                  // bit index into tx
+
+    unsigned long resetCount;
+    unsigned long slotCount;
+};
+
+uint8_t oneWireCrc8(const uint8_t* data, int len);
+
+#endif
@@ -0,0 +1,388 @@
+// Microbenchmarks for the phases of the firmware control loop.
+//
+// Each benchmark calls one function of src/main.cpp in a tight loop on a
+// fixed rotation of sensor readings and reports wall-clock ns/op plus heap
+// allocations/op (String is std::string here, so every temporary that
+// outgrows the small-string buffer shows up). Results can be written as
+// JSON and compared against a stored baseline:
+//
+//   ./benchmark --json bench.json
+//   ./benchmark --baseline bench_baseline.json --tolerance 25 --floor 10
+//
+// A baseline carries its machine's time for a fixed calibration op, and
+// the comparison scales the baseline by the ratio first, so a baseline from
+// a faster or slower machine still compares. Functions of a few ns sit at
+// timer and frequency noise, so a slowdown only counts above --floor ns
+// and only if it is still there when measured again.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <vector>
+#include "Arduino.h"
+#include "mock_libraries.h"
+#include "ssd1306_model.h"
+
+TwoWire Wire;
+SPIClass SPI;
+SSD1306Model oled;
+
+#include "../src/main.cpp"
+#include "firmware_state.h"
+
+static unsigned long long allocCount;
+static unsigned long long allocBytes;
+
+void* operator new(size_t size) {
+    allocCount++;
+    allocBytes += size;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+// Readings cycled through by every benchmark, in TEMPS order: cold start,
+// heating up, at target, fan limit, defrost, recovery.
+#define READING_COUNT 16
+
+static const float readings[READING_COUNT][6] = {
+    {10.0f, 12.0f, -5.0f, 20.0f, -10.0f, 15.0f},
+    {15.0f, 18.0f, -3.0f, 36.0f, -8.0f, 15.0f},
+    {20.0f, 25.0f, 0.0f, 45.0f, -2.0f, 16.0f},
+    {25.0f, 30.0f, 2.0f, 55.0f, 3.0f, 16.0f},
+    {30.0f, 35.0f, 4.0f, 62.0f, 5.0f, 17.0f},
+    {33.0f, 38.0f, 5.0f, 66.0f, 6.0f, 17.0f},
+    {35.0f, 39.9375f, 5.5f, 68.0f, 7.0f, 18.0f},
+    {36.0f, 40.0f, 6.0f, 70.0f, 8.0f, 18.0f},
+    {37.0f, 41.0f, 6.0f, 72.0f, 9.0f, 18.0f},
+    {37.0f, 42.0f, 5.0f, 69.0f, 4.0f, 18.0f},
+    {36.0f, 39.0f, 3.0f, 65.0f, 2.0f, 18.0f},
+    {35.0f, 38.0f, 1.0f, 64.0f, 0.0f, 18.0f},
+    {34.0f, 37.0f, 4.0f, 60.0f, -1.0f, 17.0f},
+    {33.0f, 36.0f, 6.0f, 58.0f, -4.0f, 17.0f},
+    {32.0f, 35.0f, 7.0f, 55.0f, -6.0f, 16.0f},
+    {31.0f, 34.0f, 8.0f, 50.0f, 1.0f, 16.0f},
+};
+
+static TEMPS readingTemps[READING_COUNT];
+
+static void useReading(unsigned long i) {
+    setReadings(readings[i % READING_COUNT]);
+}
+
+static void benchGetAllTemps(unsigned long i) {
+    useReading(i);
+    getAllTemps();
+}
+
+static void benchCheckTemps(unsigned long i) {
+    checkTemps(readingTemps[i % READING_COUNT]);
+}
+
+static void benchSumpHeaterCheck(unsigned long i) {
+    t = readingTemps[i % READING_COUNT];
+    sumpHeaterCheck();
+}
+
+static void benchControlEvent(unsigned long i) {
+    controlEvent(i & 1 ? EVENT_WATER_LOW : EVENT_STARTED);     // no transition from heating
+}
+
+static void benchCheckCompressorError(unsigned long i) {
+    t = readingTemps[i % READING_COUNT];
+    checkCompressorError();
+}
+
+static void benchWaterPumpControl(unsigned long i) {
+    t = readingTemps[i % READING_COUNT];
+    waterPumpControl();
+}
+
+static void benchFanControl(unsigned long i) {
+    t = readingTemps[i % READING_COUNT];
+    fanControl();
+}
+
+static void benchDefrostStartControl(unsigned long i) {
+    t = readingTemps[i % READING_COUNT];
+    defrostStartControl();
+}
+
+static void benchDefrostStopControl(unsigned long i) {
+    t = readingTemps[i % READING_COUNT];
+    defrostStopControl();
+}
+
+static void benchCheckDefrostError(unsigned long i) {
+    t = readingTemps[i % READING_COUNT];
+    checkDefrostError();
+}
+
+static void benchControlStep(unsigned long i) {
+    useReading(i);
+    controlStep();
+}
+
+static void benchReDrawScreen(unsigned long i) {
+    t = readingTemps[i % READING_COUNT];
+    tempHasChanged = true;
+    reDrawScreen();
+    while (display.flushStep());
+}
+
+static void benchSaveState(unsigned long i) {
+    t = readingTemps[i % READING_COUNT];
+    saveState();
+}
+
+// CRC-16/MODBUS of 16 bytes: fixed integer work that no firmware change
+// touches, timed to compare this machine with the baseline's.
+static volatile uint16_t calibrationSink;
+
+static void benchCalibration(unsigned long i) {
+    uint16_t crc = 0xFFFF;
+    for (uint8_t n = 0; n < 16; n++) {
+        crc ^= (uint8_t)(i + n);
+        for (uint8_t bit = 0; bit < 8; bit++) crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+    calibrationSink = crc;
+}
+
+struct Benchmark {
+    const char* name;
+    void (*run)(unsigned long i);
+};
+
+static const Benchmark calibration = {"calibration", benchCalibration};
+
+static const Benchmark benchmarks[] = {
+    {"getAllTemps", benchGetAllTemps},
+    {"checkTemps", benchCheckTemps},
+    {"sumpHeaterCheck", benchSumpHeaterCheck},
+    {"controlEvent", benchControlEvent},
+    {"checkCompressorError", benchCheckCompressorError},
+    {"waterPumpControl", benchWaterPumpControl},
+    {"fanControl", benchFanControl},
+    {"defrostStartControl", benchDefrostStartControl},
+    {"defrostStopControl", benchDefrostStopControl},
+    {"checkDefrostError", benchCheckDefrostError},
+    {"controlStep", benchControlStep},
+    {"reDrawScreen", benchReDrawScreen},
+    {"saveState", benchSaveState},
+};
+
+#define BENCHMARK_COUNT (sizeof benchmarks / sizeof benchmarks[0])
+#define SAMPLES 5
+
+struct Result {
+    std::string name;
+    double nsPerOp;
+    double allocsPerOp;
+    double bytesPerOp;
+    unsigned long long iterations;
+};
+
+static double seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Every benchmark starts from a booted controller that is past the start
+// program, so the numbers describe the steady-state loop.
+static void prepare() {
+    resetController();
+    enterState(STATE_HEATING);
+}
+
+static double timeRun(const Benchmark& b, unsigned long long n) {
+    double start = seconds();
+    for (unsigned long long i = 0; i < n; i++) b.run(i);
+    return seconds() - start;
+}
+
+// Grows the iteration count until one sample takes minTime / SAMPLES, then
+// keeps the fastest of SAMPLES samples: interference only ever adds time.
+static Result measure(const Benchmark& b, double minTime) {
+    prepare();
+    unsigned long long n = 1;
+    double target = minTime / SAMPLES;
+    for (;;) {
+        double elapsed = timeRun(b, n);
+        if (elapsed >= target || n >= (1ULL << 40)) break;
+        double scale = elapsed > 0 ? target / elapsed * 1.2 : 100;
+        n = (unsigned long long)(n * std::min(std::max(scale, 2.0), 100.0));
+    }
+
+    prepare();
+    double samples[SAMPLES];
+    unsigned long long allocs = allocCount;
+    unsigned long long bytes = allocBytes;
+    for (int s = 0; s < SAMPLES; s++) samples[s] = timeRun(b, n) * 1e9 / n;
+
+    Result r;
+    r.name = b.name;
+    r.nsPerOp = *std::min_element(samples, samples + SAMPLES);
+    r.iterations = n * SAMPLES;
+    r.allocsPerOp = (double)(allocCount - allocs) / r.iterations;
+    r.bytesPerOp = (double)(allocBytes - bytes) / r.iterations;
+    return r;
+}
+
+static bool writeJson(const char* path, const std::vector<Result>& results) {
+    FILE* f = fopen(path, "w");
+    if (!f) return false;
+    fprintf(f, "{\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        fprintf(f, "    {\"name\": \"%s\", \"ns_per_op\": %.2f, \"allocs_per_op\": %.3f, "
+                   "\"bytes_per_op\": %.1f, \"iterations\": %llu}%s\n",
+                r.name.c_str(), r.nsPerOp, r.allocsPerOp, r.bytesPerOp, r.iterations,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    return true;
+}
+
+// Reads the one-benchmark-per-line files written by writeJson().
+static bool readJson(const char* path, std::vector<Result>& results) {
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+    char line[512];
+    while (fgets(line, sizeof line, f)) {
+        char name[128];
+        Result r;
+        if (sscanf(line, " {\"name\": \"%127[^\"]\", \"ns_per_op\": %lf, \"allocs_per_op\": %lf, "
+                         "\"bytes_per_op\": %lf, \"iterations\": %llu",
+                   name, &r.nsPerOp, &r.allocsPerOp, &r.bytesPerOp, &r.iterations) == 5) {
+            r.name = name;
+            results.push_back(r);
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+static const Result* find(const std::vector<Result>& results, const std::string& name) {
+    for (size_t i = 0; i < results.size(); i++) {
+        if (results[i].name == name) return &results[i];
+    }
+    return NULL;
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [--filter TEXT] [--min-time S] [--json FILE]\n"
+            "          [--baseline FILE] [--tolerance PCT] [--floor NS]\n"
+            "  --filter TEXT      only benchmarks whose name contains TEXT\n"
+            "  --min-time S       measuring time per benchmark (default 0.5)\n"
+            "  --json FILE        write the results as JSON\n"
+            "  --baseline FILE    compare against a JSON file from --json; exit 1 on regression\n"
+            "  --tolerance PCT    allowed ns/op slowdown against the baseline (default 25)\n"
+            "  --floor NS         slowdowns of fewer ns/op never count (default 10)\n",
+            argv0);
+}
+
+int main(int argc, char** argv) {
+    const char* filter = NULL;
+    const char* jsonPath = NULL;
+    const char* baselinePath = NULL;
+    double minTime = 0.5;
+    double tolerance = 25;
+    double floorNs = 10;
+
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (!strcmp(argv[i], "--filter") && more) filter = argv[++i];
+        else if (!strcmp(argv[i], "--min-time") && more) minTime = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--json") && more) jsonPath = argv[++i];
+        else if (!strcmp(argv[i], "--baseline") && more) baselinePath = argv[++i];
+        else if (!strcmp(argv[i], "--tolerance") && more) tolerance = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--floor") && more) floorNs = atof(argv[++i]);
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<Result> baseline;
+    if (baselinePath && !readJson(baselinePath, baseline)) {
+        fprintf(stderr, "cannot read %s\n", baselinePath);
+        return 1;
+    }
+
+    simVerbose = false;
+    Wire.attach(0x3C, &oled);
+    for (int i = 0; i < READING_COUNT; i++) {
+        TEMPS& r = readingTemps[i];
+        r.waterIntake = fromCelsius(readings[i][0]);
+        r.waterInject = fromCelsius(readings[i][1]);
+        r.coolantIntake = fromCelsius(readings[i][2]);
+        r.coolantInject = fromCelsius(readings[i][3]);
+        r.airOutside = fromCelsius(readings[i][4]);
+        r.dhwTank = fromCelsius(readings[i][5]);
+    }
+
+    std::vector<Result> results;
+    results.push_back(measure(calibration, minTime));
+    const Result* baseCalibration = find(baseline, calibration.name);
+    double scale = baseCalibration && baseCalibration->nsPerOp > 0
+                   ? results[0].nsPerOp / baseCalibration->nsPerOp : 1;
+    printf("calibration %.1f ns/op", results[0].nsPerOp);
+    if (baselinePath) printf(", baseline scaled by %.2f", scale);
+    printf("\n\n");
+
+    printf("%-22s %12s %10s %10s", "benchmark", "ns/op", "allocs/op", "B/op");
+    if (baselinePath) printf(" %12s %8s", "baseline", "change");
+    printf("\n");
+
+    int regressions = 0;
+    for (size_t k = 0; k < BENCHMARK_COUNT; k++) {
+        if (filter && !strstr(benchmarks[k].name, filter)) continue;
+        Result r = measure(benchmarks[k], minTime);
+        const Result* base = baselinePath ? find(baseline, r.name) : NULL;
+        double expected = base ? base->nsPerOp * scale : 0;
+        // Interference only adds time: a slowdown has to survive a second
+        // measurement, and the faster one is kept.
+        for (int retry = 0; base && retry < 2; retry++) {
+            if (r.nsPerOp - expected <= floorNs || r.nsPerOp <= expected * (1 + tolerance / 100)) break;
+            Result again = measure(benchmarks[k], minTime);
+            if (again.nsPerOp < r.nsPerOp) r = again;
+        }
+        results.push_back(r);
+
+        printf("%-22s %12.1f %10.3f %10.1f", r.name.c_str(), r.nsPerOp, r.allocsPerOp, r.bytesPerOp);
+        if (base) {
+            double change = expected > 0 ? (r.nsPerOp / expected - 1) * 100 : 0;
+            bool slower = change > tolerance && r.nsPerOp - expected > floorNs;
+            bool moreAllocs = r.allocsPerOp > base->allocsPerOp + 0.005;
+            printf(" %12.1f %+7.1f%%", expected, change);
+            if (slower) printf("  SLOWER");
+            if (moreAllocs) printf("  MORE ALLOCS (was %.3f)", base->allocsPerOp);
+            if (slower || moreAllocs) regressions++;
+        } else if (baselinePath) {
+            printf(" %12s", "new");
+        }
+        printf("\n");
+    }
+
+    if (jsonPath && !writeJson(jsonPath, results)) {
+        fprintf(stderr, "cannot write %s\n", jsonPath);
+        return 1;
+    }
+    if (regressions) {
+        printf("%d regression(s) against %s\n", regressions, baselinePath);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include "bus_model.h"
+#include <chrono>
+#include <thread>
+
+BusConfig busConfig = {
+    100000,     // i2cClockHz
+    2,          // i2cStartStopBits
+    960,        // oneWireResetUs
+    70,         // oneWireSlotUs
+    115200,     // serialBaud
+    64,         // serialTxBuffer
+    false,      // realtime
+};
+
+BusTotals busTotals;
+
+const char* const busCostNames[BUS_COST_COUNT] = {
+    "delay",
+    "i2c",
+    "onewire",
+    "conversion",
+    "serial",
+    "sleep",
+};
+
+static unsigned long long clockUs = 0;
+static auto wallStart = std::chrono::steady_clock::now();
+
+// Serial TX buffer: bytes still queued at txDrainUs.
+static unsigned long txQueued = 0;
+static unsigned long long txDrainUs = 0;
+
+unsigned long long simMicros() {
+    return clockUs;
+}
+
+void simReset() {
+    clockUs = 0;
+    busTotals = BusTotals();
+    txQueued = 0;
+    txDrainUs = 0;
+    wallStart = std::chrono::steady_clock::now();
+}
+
+void simSetMicros(unsigned long long us) {
+    clockUs = us;
+}
+
+void busCharge(BusCost cost, unsigned long long us, unsigned long long bytes) {
+    clockUs += us;
+    busTotals.us[cost] += us;
+    busTotals.bytes[cost] += bytes;
+    busAdcRun(clockUs);
+    if (busConfig.realtime) {
+        std::this_thread::sleep_until(wallStart + std::chrono::microseconds(clockUs));
+    }
+}
+
+void busSleep() {
+    busCharge(COST_SLEEP, 1024 - clockUs % 1024, 1);
+}
+
+void busI2CTransfer(unsigned long bytes, unsigned long transmissions) {
+    unsigned long long bits = (unsigned long long)bytes * 9 + transmissions * busConfig.i2cStartStopBits;
+    busCharge(COST_I2C, bits * 1000000ULL / busConfig.i2cClockHz, bytes);
+}
+
+void busOneWire(unsigned int resets, unsigned int bytes) {
+    unsigned long long us = (unsigned long long)resets * busConfig.oneWireResetUs
+                          + (unsigned long long)bytes * 8 * busConfig.oneWireSlotUs;
+    busCharge(COST_ONEWIRE, us, bytes);
+}
+
+unsigned long ds18b20ConversionUs(uint8_t resolution) {
+    switch (resolution) {
+        case 9:  return 93750;
+        case 10: return 187500;
+        case 11: return 375000;
+        default: return 750000;
+    }
+}
+
+// Lets the UART drain whatever it sent since the last look.
+static void drainSerial(unsigned long long byteUs) {
+    unsigned long long sent = (clockUs - txDrainUs) / byteUs;
+    if (sent >= txQueued) {
+        txQueued = 0;
+        txDrainUs = clockUs;
+    } else {
+        txQueued -= sent;
+        txDrainUs += sent * byteUs;
+    }
+}
+
+unsigned int busSerialTxFree() {
+    drainSerial(10 * 1000000ULL / busConfig.serialBaud);
+    return busConfig.serialTxBuffer - txQueued;
+}
+
+void busSerialWrite() {
+    unsigned long long byteUs = 10 * 1000000ULL / busConfig.serialBaud;
+    drainSerial(byteUs);
+
+    if (txQueued >= busConfig.serialTxBuffer) {
+        // Serial.write() spins until the next byte leaves the shift register.
+        unsigned long long wait = txDrainUs + byteUs - clockUs;
+        busCharge(COST_SERIAL, wait);
+        txQueued--;
+        txDrainUs = clockUs;
+    }
+    txQueued++;
+    busTotals.bytes[COST_SERIAL]++;
+}
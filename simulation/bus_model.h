@@ -0,0 +1,79 @@
+#ifndef BUS_MODEL_H
+#define BUS_MODEL_H
+
+#include <stdint.h>
+
+// Virtual-time cost model for the simulator HAL.
+//
+// millis()/micros() read a virtual clock that only moves when the firmware
+// waits: delay(), an I2C display flush, OneWire traffic, a DS18B20
+// conversion, a full Serial TX buffer or sleep. Each wait is charged to one of the
+// categories below so a loop step can be broken down by where its time went.
+// CPU time of the firmware itself is not modelled.
+
+enum BusCost {
+    COST_DELAY = 0,         // delay() / delayMicroseconds()
+    COST_I2C,               // SSD1306 display() transfers
+    COST_ONEWIRE,           // OneWire resets, ROM selects and scratchpad reads
+    COST_CONVERSION,        // waiting for DS18B20 temperature conversion
+    COST_SERIAL,            // blocked on a full Serial TX buffer
+    COST_SLEEP,             // CPU asleep until the next interrupt
+    BUS_COST_COUNT
+};
+
+struct BusConfig {
+    unsigned long i2cClockHz;           // Wire clock, 100 kHz by default
+    unsigned int i2cStartStopBits;      // start + stop condition per transmission
+    unsigned int oneWireResetUs;        // reset pulse plus presence window
+    unsigned int oneWireSlotUs;         // one read or write time slot
+    unsigned long serialBaud;           // set by Serial.begin()
+    unsigned int serialTxBuffer;        // HardwareSerial TX ring on AVR
+    bool realtime;                      // pace the virtual clock to wall time
+};
+
+struct BusTotals {
+    unsigned long long us[BUS_COST_COUNT];
+    unsigned long long bytes[BUS_COST_COUNT];  // for COST_SLEEP: wake-ups
+};
+
+extern BusConfig busConfig;
+extern BusTotals busTotals;
+extern const char* const busCostNames[BUS_COST_COUNT];
+
+// Virtual clock in microseconds since start.
+unsigned long long simMicros();
+
+// Rewinds the clock to zero and clears the totals and the Serial TX buffer,
+// for tools that run many independent simulations in one process.
+void simReset();
+
+// Moves the virtual clock to `us`, for tools that run several controllers
+// in lockstep on one clock.
+void simSetMicros(unsigned long long us);
+
+// Moves the clock forward and books the time to a category.
+void busCharge(BusCost cost, unsigned long long us, unsigned long long bytes = 0);
+
+// I2C: `bytes` on the wire including address bytes, in `transmissions` frames.
+void busI2CTransfer(unsigned long bytes, unsigned long transmissions);
+
+// OneWire: `resets` reset pulses and `bytes` written or read.
+void busOneWire(unsigned int resets, unsigned int bytes);
+
+// DS18B20 conversion time for a resolution of 9..12 bits.
+unsigned long ds18b20ConversionUs(uint8_t resolution);
+
+// Idle sleep until the next Timer0 overflow, every 1024 us of virtual time.
+void busSleep();
+
+// Runs the ADC conversions due by `us` and their interrupts. The ADC model
+// lives with the registers in Arduino.cpp; every clock move calls it.
+void busAdcRun(unsigned long long us);
+
+// Queues one byte on the simulated UART, waiting if the TX buffer is full.
+void busSerialWrite();
+
+// Bytes the TX buffer takes right now without waiting.
+unsigned int busSerialTxFree();
+
+#endif
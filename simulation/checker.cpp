@@ -0,0 +1,428 @@
+// Property-based invariant checker for the control rules in src/main.cpp.
+//
+// Generates randomized and adversarial temperature sequences, drives them
+// through checkTemps()/controlStep() on the virtual clock and checks the
+// invariants in invariants.h after every step. A failing sequence is shrunk
+// to a minimal reproducer and written as a replay file, which --replay runs
+// again.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "Arduino.h"
+#include "mock_libraries.h"
+#include "replay.h"
+
+TwoWire Wire;
+SPIClass SPI;
+
+#include "../src/main.cpp"
+#include "invariants.h"
+#include "firmware_state.h"
+
+// One control step of a case: time since the previous step and the readings.
+struct Step {
+    unsigned long dtMs;
+    float temps[6];
+};
+
+typedef std::vector<Step> Case;
+
+struct Outcome {
+    Invariant invariant;
+    size_t step;            // index of the failing step
+    int relay;              // for INV_RELAY_CHATTER
+};
+
+struct Options {
+    unsigned long long seed;
+    long runs;              // cases per job, 0 = until the time budget is spent
+    double seconds;
+    size_t steps;           // steps per case
+    int jobs;
+    unsigned long minToggleMs[RELAY_COUNT];
+    const char* out;
+    const char* replay;
+};
+
+// xorshift64*, good enough for input generation and much cheaper than <random>.
+struct Rng {
+    unsigned long long s;
+    explicit Rng(unsigned long long seed) : s(seed ? seed : 0x9E3779B97F4A7C15ULL) {}
+    unsigned long long next() {
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return s * 0x2545F4914F6CDD1DULL;
+    }
+    unsigned below(unsigned n) { return (unsigned)((next() >> 32) * n >> 32); }
+    float uniform(float lo, float hi) { return lo + (hi - lo) * (float)(next() >> 40) / (float)(1 << 24); }
+    bool chance(unsigned perMillion) { return below(1000000) < perMillion; }
+};
+
+// DS18B20 readings come in 1/16 degree steps.
+static float quantize(float v) {
+    return roundf(v * 16.0f) / 16.0f;
+}
+
+// Every threshold the control rules compare against, in 1/16 degree.
+static const int edges[] = {
+    minSensorTemp, maxSensorTemp, startCoolantTemp, compressorHeaterTemp,
+    sumpHeaterTemp, sumpHeaterTemp + DELTA_1, sumpHeaterTemp + DELTA_2, sumpSuctionTemp,
+    waterTargetTemp, waterTargetTemp - DELTA_2, waterTargetTemp + DELTA_2,
+    fanTargetTemp, fanTargetTemp - DELTA_2, heatedAtLeastOnceTemp, defrostTemp,
+    dhwTargetTemp, dhwTargetTemp - DELTA_3,
+};
+static const float nudges[] = {0.0f, 0.0625f, -0.0625f, 0.5f, -0.5f};
+
+static float edgeValue(Rng& rng) {
+    return edges[rng.below(sizeof edges / sizeof edges[0])] / 16.0f
+         + nudges[rng.below(sizeof nudges / sizeof nudges[0])];
+}
+
+// Plausible starting point per channel: water, refrigerant, air.
+static const float startLo[6] = {10, 10, -20, 20, -30, -30};
+static const float startHi[6] = {50, 50, 20, 90, 20, 20};
+
+enum Generator { GEN_WALK, GEN_EDGES, GEN_MIXED, GENERATOR_COUNT };
+
+static Case generate(Rng& rng, size_t steps) {
+    Generator gen = (Generator)rng.below(GENERATOR_COUNT);
+    Case c(steps);
+    float cur[6];
+    for (int k = 0; k < 6; k++) cur[k] = rng.uniform(startLo[k], startHi[k]);
+
+    for (size_t i = 0; i < steps; i++) {
+        Step& s = c[i];
+        // Mostly the real 700 ms cadence; sometimes jitter, sometimes a long
+        // gap so the hour-long error timers fire within one case.
+        unsigned r = rng.below(100);
+        s.dtMs = r < 93 ? 700 : r < 98 ? 1 + rng.below(700) : 60000 + rng.below(4200000);
+
+        for (int k = 0; k < 6; k++) {
+            switch (gen) {
+                case GEN_WALK:
+                    cur[k] += rng.uniform(-1.0f, 1.0f);
+                    break;
+                case GEN_EDGES:
+                    if (rng.chance(300000)) cur[k] = edgeValue(rng);
+                    break;
+                default:
+                    cur[k] += rng.uniform(-0.5f, 0.5f);
+                    if (rng.chance(20000)) cur[k] = edgeValue(rng);
+                    break;
+            }
+            if (cur[k] < -50.0f) cur[k] = -50.0f;
+            if (cur[k] > 120.0f) cur[k] = 120.0f;
+            s.temps[k] = quantize(cur[k]);
+            // A dropped sensor reads DEVICE_DISCONNECTED_C.
+            if (gen != GEN_WALK && rng.chance(50)) s.temps[k] = -127.0f;
+        }
+    }
+    return c;
+}
+
+// The part of loop() after the sensor read, minus drawing.
+static void controlCycle(const Step& s) {
+    busCharge(COST_DELAY, s.dtMs * 1000ULL);
+    setReadings(s.temps);
+
+    checkTemps(t);
+    controlStep();
+    // The history recorder is exercised every cycle even though loop() has
+    // it commented out, so its indexing is covered.
+    saveState();
+}
+
+static const unsigned long* chatterLimits;
+static unsigned long long simulatedMs;     // virtual time covered by counted cases
+
+static Outcome runCase(const Case& c, unsigned long long* stepsDone) {
+    resetController();
+    InvariantMonitor monitor;
+    for (int r = 0; r < RELAY_COUNT; r++) monitor.minToggleMs[r] = chatterLimits[r];
+
+    Outcome o = {INV_OK, 0, -1};
+    for (size_t i = 0; i < c.size(); i++) {
+        controlCycle(c[i]);
+        Invariant inv = monitor.check();
+        if (inv != INV_OK) {
+            o.invariant = inv;
+            o.step = i;
+            o.relay = monitor.failedRelay;
+            break;
+        }
+    }
+    if (stepsDone) {
+        *stepsDone += o.invariant ? o.step + 1 : c.size();
+        simulatedMs += millis();
+    }
+    return o;
+}
+
+static bool stillFails(Case& c, Invariant inv) {
+    Outcome o = runCase(c, NULL);
+    if (o.invariant != inv) return false;
+    c.resize(o.step + 1);
+    return true;
+}
+
+// Delta debugging over steps, then value simplification, until nothing
+// more can be removed. Dropped steps hand their time to the next step so
+// timer-driven failures survive.
+static Case shrink(Case c, Invariant inv) {
+    stillFails(c, inv);
+    bool progress = true;
+    while (progress) {
+        progress = false;
+
+        for (size_t chunk = c.size() / 2; chunk >= 1; chunk /= 2) {
+            for (size_t i = 0; i + chunk <= c.size() && c.size() > 1;) {
+                Case cand;
+                cand.reserve(c.size() - chunk);
+                cand.insert(cand.end(), c.begin(), c.begin() + i);
+                unsigned long carried = 0;
+                for (size_t k = i; k < i + chunk; k++) carried += c[k].dtMs;
+                cand.insert(cand.end(), c.begin() + i + chunk, c.end());
+                if (i < cand.size()) cand[i].dtMs += carried;
+                if (stillFails(cand, inv)) {
+                    c.swap(cand);
+                    progress = true;
+                } else {
+                    i += chunk;
+                }
+            }
+            if (chunk == 1) break;
+        }
+
+        for (size_t i = 0; i < c.size(); i++) {
+            for (int k = 0; k < 6; k++) {
+                float tries[3] = {
+                    i ? c[i - 1].temps[k] : 20.0f,  // flat line
+                    roundf(c[i].temps[k]),          // whole degrees
+                    20.0f,                          // neutral
+                };
+                for (int j = 0; j < 3; j++) {
+                    if (tries[j] == c[i].temps[k]) continue;
+                    Case cand = c;
+                    cand[i].temps[k] = tries[j];
+                    if (stillFails(cand, inv)) {
+                        c.swap(cand);
+                        progress = true;
+                        break;
+                    }
+                }
+            }
+            if (c[i].dtMs != 700 && i < c.size()) {
+                Case cand = c;
+                cand[i].dtMs = 700;
+                if (stillFails(cand, inv)) {
+                    c.swap(cand);
+                    progress = true;
+                }
+            }
+        }
+    }
+    return c;
+}
+
+static void printCase(const Case& c) {
+    unsigned long ms = 0;
+    printf("  %-10s %8s %8s %8s %8s %8s %8s\n", "millis", "T1", "T2", "T3", "T4", "T5", "T6");
+    for (size_t i = 0; i < c.size(); i++) {
+        ms += c[i].dtMs;
+        printf("  %-10lu", ms);
+        for (int k = 0; k < 6; k++) printf(" %8.4f", c[i].temps[k]);
+        printf("\n");
+    }
+}
+
+static bool writeCase(const char* path, const Case& c, const Outcome& o) {
+    FILE* f = fopen(path, "w");
+    if (!f) return false;
+    fprintf(f, "# checker reproducer: %s\n", invariantNames[o.invariant]);
+    if (o.invariant == INV_RELAY_CHATTER) {
+        fprintf(f, "# rerun with --min-toggle %s=%lu\n", relayNames[o.relay], chatterLimits[o.relay]);
+    }
+    writeReplayHeader(f);
+    ReplayRow row;
+    row.millis = 0;
+    for (size_t i = 0; i < c.size(); i++) {
+        row.millis += c[i].dtMs;
+        memcpy(row.temps, c[i].temps, sizeof row.temps);
+        writeReplayRow(f, row);
+    }
+    fclose(f);
+    return true;
+}
+
+static bool readCase(const char* path, Case& c) {
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+    ReplayRow row;
+    unsigned long last = 0;
+    while (readReplayRow(f, row)) {
+        Step s;
+        s.dtMs = row.millis - last;
+        last = row.millis;
+        memcpy(s.temps, row.temps, sizeof s.temps);
+        c.push_back(s);
+    }
+    fclose(f);
+    return true;
+}
+
+static void report(const Outcome& o) {
+    printf("violation: %s", invariantNames[o.invariant]);
+    if (o.invariant == INV_RELAY_CHATTER) printf(" (%s)", relayNames[o.relay]);
+    printf(" at step %zu\n", o.step);
+}
+
+static int runJob(const Options& opt, int job) {
+    Rng rng(opt.seed + job * 0x9E3779B97F4A7C15ULL);
+    auto begin = std::chrono::steady_clock::now();
+    unsigned long long steps = 0;
+    long cases = 0;
+    double elapsed = 0;
+
+    for (;;) {
+        if (opt.runs && cases >= opt.runs) break;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        if (!opt.runs && elapsed >= opt.seconds) break;
+
+        Case c = generate(rng, opt.steps);
+        Outcome o = runCase(c, &steps);
+        cases++;
+        if (o.invariant == INV_OK) continue;
+
+        printf("[job %d] ", job);
+        report(o);
+        size_t failedAt = o.step + 1;
+        Case small = shrink(c, o.invariant);
+        o = runCase(small, NULL);
+        printf("[job %d] shrunk from %zu to %zu steps:\n", job, failedAt, small.size());
+        printCase(small);
+
+        char path[512];
+        if (opt.jobs > 1) snprintf(path, sizeof path, "%s.%d", opt.out, job);
+        else snprintf(path, sizeof path, "%s", opt.out);
+        if (writeCase(path, small, o)) printf("[job %d] reproducer written to %s\n", job, path);
+        return 1;
+    }
+
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("[job %d] %ld cases, %llu steps, %.1f simulated hours, %.2f M steps/s, no violations\n",
+           job, cases, steps, simulatedMs / 3600000.0, elapsed > 0 ? steps / elapsed / 1e6 : 0.0);
+    return 0;
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [--seed N] [--runs N | --seconds S] [--steps N] [--jobs N]\n"
+            "          [--min-toggle RELAY=MS]... [--out FILE] [--replay FILE]\n"
+            "  --seed N             base seed (default 1)\n"
+            "  --runs N             cases per job (default: run for --seconds)\n"
+            "  --seconds S          time budget per job (default 10)\n"
+            "  --steps N            control steps per case (default 5000)\n"
+            "  --jobs N             worker processes (default 1)\n"
+            "  --min-toggle R=MS    minimum time between toggles of relay R, or all=MS\n"
+            "  --out FILE           where to write the shrunk reproducer (default checker-failure.replay)\n"
+            "  --replay FILE        check one recorded sequence instead of generating\n",
+            argv0);
+}
+
+static bool parseToggle(const char* arg, unsigned long limits[RELAY_COUNT]) {
+    const char* eq = strchr(arg, '=');
+    if (!eq) return false;
+    unsigned long ms = strtoul(eq + 1, NULL, 10);
+    size_t len = eq - arg;
+    if (len == 3 && !strncmp(arg, "all", 3)) {
+        for (int r = 0; r < RELAY_COUNT; r++) limits[r] = ms;
+        return true;
+    }
+    for (int r = 0; r < RELAY_COUNT; r++) {
+        if (strlen(relayNames[r]) == len && !strncmp(arg, relayNames[r], len)) {
+            limits[r] = ms;
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    opt.seed = 1;
+    opt.runs = 0;
+    opt.seconds = 10;
+    opt.steps = 5000;
+    opt.jobs = 1;
+    for (int r = 0; r < RELAY_COUNT; r++) opt.minToggleMs[r] = 0;
+    opt.out = "checker-failure.replay";
+    opt.replay = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (!strcmp(argv[i], "--seed") && more) opt.seed = strtoull(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--runs") && more) opt.runs = atol(argv[++i]);
+        else if (!strcmp(argv[i], "--seconds") && more) opt.seconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--steps") && more) opt.steps = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--jobs") && more) opt.jobs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--min-toggle") && more && parseToggle(argv[i + 1], opt.minToggleMs)) i++;
+        else if (!strcmp(argv[i], "--out") && more) opt.out = argv[++i];
+        else if (!strcmp(argv[i], "--replay") && more) opt.replay = argv[++i];
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (opt.jobs < 1 || !opt.steps) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    simVerbose = false;
+    chatterLimits = opt.minToggleMs;
+
+    if (opt.replay) {
+        Case c;
+        if (!readCase(opt.replay, c)) {
+            fprintf(stderr, "cannot read %s\n", opt.replay);
+            return 1;
+        }
+        Outcome o = runCase(c, NULL);
+        if (o.invariant == INV_OK) {
+            printf("%zu steps, no violations\n", c.size());
+            return 0;
+        }
+        report(o);
+        return 1;
+    }
+
+    if (opt.jobs == 1) return runJob(opt, 0);
+
+    // Globals make the firmware single-instance, so parallelism is one
+    // process per job.
+    fflush(stdout);
+    for (int j = 0; j < opt.jobs; j++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            int rc = runJob(opt, j);
+            fflush(stdout);
+            _exit(rc);
+        }
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+    }
+    int failed = 0;
+    int status;
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+// Checkpoint files: a run's state, restored to branch the run from that
+// moment instead of replaying its prefix.
+//
+//   "HPCKPT1\0", then records: name length (u8), name, size (u32 LE), bytes
+//
+// Records are written and read back in the same order. Each one is checked
+// by name and size, so a checkpoint from a build whose state differs is
+// refused instead of restored into the wrong fields. Values are raw host
+// memory: a checkpoint is for the machine and build that wrote it.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+
+#define CHECKPOINT_MAGIC "HPCKPT1"
+
+class CheckpointWriter {
+public:
+    CheckpointWriter() : file(NULL), ok(false) {}
+    ~CheckpointWriter() { close(); }
+
+    bool open(const char* path) {
+        file = fopen(path, "wb");
+        ok = file && fwrite(CHECKPOINT_MAGIC, 1, 8, file) == 8;
+        return ok;
+    }
+
+    // False if anything failed since open().
+    bool close() {
+        if (file && fclose(file) != 0) ok = false;
+        file = NULL;
+        return ok;
+    }
+
+    void put(const char* name, const void* data, size_t size) {
+        if (!ok) return;
+        uint8_t header[4] = {(uint8_t)size, (uint8_t)(size >> 8), (uint8_t)(size >> 16), (uint8_t)(size >> 24)};
+        uint8_t nameLen = (uint8_t)strlen(name);
+        ok = fwrite(&nameLen, 1, 1, file) == 1 && fwrite(name, 1, nameLen, file) == nameLen
+             && fwrite(header, 1, 4, file) == 4 && fwrite(data, 1, size, file) == size;
+    }
+
+    template <typename T>
+    void put(const char* name, const T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "raw checkpoint field");
+        put(name, &value, sizeof value);
+    }
+
+    void put(const char* name, const std::string& value) {
+        put(name, value.data(), value.size());
+    }
+
+private:
+    FILE* file;
+    bool ok;
+};
+
+class CheckpointReader {
+public:
+    CheckpointReader() : file(NULL) {}
+    ~CheckpointReader() {
+        if (file) fclose(file);
+    }
+
+    bool open(const char* path) {
+        char magic[8];
+        file = fopen(path, "rb");
+        if (!file) return fail(std::string("cannot open ") + path);
+        if (fread(magic, 1, 8, file) != 8 || memcmp(magic, CHECKPOINT_MAGIC, 8) != 0) {
+            return fail("not a checkpoint");
+        }
+        return true;
+    }
+
+    bool get(const char* name, void* data, size_t size) {
+        uint32_t stored;
+        if (!next(name, stored)) return false;
+        if (stored != size) return fail(std::string("size of ") + name + " differs");
+        return fread(data, 1, size, file) == size || fail("truncated checkpoint");
+    }
+
+    template <typename T>
+    bool get(const char* name, T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "raw checkpoint field");
+        return get(name, &value, sizeof value);
+    }
+
+    bool get(const char* name, std::string& value) {
+        uint32_t stored;
+        if (!next(name, stored)) return false;
+        value.resize(stored);
+        return stored == 0 || fread(&value[0], 1, stored, file) == stored || fail("truncated checkpoint");
+    }
+
+    const std::string& error() const { return lastError; }
+
+private:
+    FILE* file;
+    std::string lastError;
+
+    bool fail(const std::string& message) {
+        if (lastError.empty()) lastError = message;
+        return false;
+    }
+
+    // Reads the next record header and checks its name.
+    bool next(const char* name, uint32_t& size) {
+        if (!lastError.empty()) return false;
+        uint8_t nameLen;
+        char stored[256];
+        uint8_t header[4];
+        if (fread(&nameLen, 1, 1, file) != 1 || fread(stored, 1, nameLen, file) != nameLen
+            || fread(header, 1, 4, file) != 4) {
+            return fail(std::string("checkpoint ends before ") + name);
+        }
+        stored[nameLen] = 0;
+        if (strcmp(stored, name) != 0) return fail(std::string("expected ") + name + ", found " + stored);
+        size = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t)header[3] << 24);
+        return true;
+    }
+};
+
+#endif
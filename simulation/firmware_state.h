@@ -0,0 +1,192 @@
+#ifndef FIRMWARE_STATE_H
+#define FIRMWARE_STATE_H
+
+// Helpers for host tools that link ../src/main.cpp directly and drive its
+// functions without loop(). Include after ../src/main.cpp.
+
+#include <string.h>
+#include "checkpoint.h"
+
+// The tools set t from a plant that has no refrigerant circuit, so nothing
+// would feed P1 and P2.
+#if PRESSURE_ENABLED
+#error "host tools other than the simulator need PRESSURE_ENABLED=0"
+#endif
+
+// Back to the state of a freshly booted controller.
+inline void resetController() {
+    simReset();
+
+    t = TEMPS();
+    p = PRESSURES();
+    memset(states, 0, sizeof states);
+    stateIndex = 0;
+    controlState = resumeState = STATE_STARTING;
+    memset(stateEntries, 0, sizeof stateEntries);
+    stateSince = 0;
+    recentFaults = 0;
+    faultWindowStart = 0;
+    faultLatched = false;
+    setpoints = defaultSetpoints;
+    dhwTarget = dhwTargetTemp;
+    pumpDelta = pumpDeltaTemp;
+
+    isCompressorStarted = false;
+    isFanStarted = false;
+    isDefrostStarted = false;
+    isSumpHeaterStarted = false;
+    isCompressorHeaterStarted = true;
+    isPumpStarted = false;
+    isWaterValveStarted = false;
+    dhwDemand = false;
+    pumpDuty = 0;
+    fanDuty = 0;
+    fanIntegral = 0;
+    compressorStartedTime = compressorStoppedTime = 0;
+    fanStartedTime = fanStoppedTime = 0;
+    defrostStartedTime = defrostStoppedTime = 0;
+    sumpHeaterStartedTime = sumpHeaterStoppedTime = 0;
+    compressorHeaterStartedTime = compressorHeaterStoppedTime = 0;
+    pumpStartedTime = pumpStoppedTime = 0;
+    waterValveStartedTime = waterValveStoppedTime = 0;
+
+    targetDelay = 0;
+    stateHasChanged = true;
+    tempHasChanged = true;
+    tempsSum = 0;
+
+    compressorError = defrostError = false;
+    t1Error = t2Error = t3Error = t4Error = t5Error = t6Error = false;
+    p1Error = p2Error = highPressureError = false;
+    heatedAtLeastOnce = false;
+    drawSign = false;
+
+    compressorFlag = fanFlag = defrostFlag = sumpHeaterFlag = 0;
+    compressorHeaterFlag = waterPumpFlag = waterValveFlag = 0;
+
+    // A fresh board: setup() finds no counters in EEPROM.
+    memset(counterSince, 0, sizeof counterSince);
+    memset(runSince, 0, sizeof runSince);
+    countersSavedTime = 0;
+    counterLogNext = COUNTER_COUNT;
+    EEPROM.erase();
+
+    // setup() empties the rollup levels; clear the rings too, so a fresh
+    // controller's checkpoint does not carry another one's trends.
+    memset(rollupMinutes, 0, sizeof rollupMinutes);
+    memset(rollupHours, 0, sizeof rollupHours);
+    memset(rollupDays, 0, sizeof rollupDays);
+
+    setup();
+}
+
+// Every main.cpp global the control rules read or write between loop()
+// calls. states[] is left out: nothing in the control path reads it.
+// heatingCurve is shared by all controllers, like the plant parameters.
+#define CONTROLLER_GLOBALS(X) \
+    X(t) X(p) X(controlState) X(resumeState) X(stateEntries) X(stateSince) X(setpoints) X(waterTarget) \
+    X(recentFaults) X(faultWindowStart) X(faultLatched) \
+    X(isCompressorStarted) X(compressorStartedTime) X(compressorStoppedTime) \
+    X(isFanStarted) X(fanStartedTime) X(fanStoppedTime) \
+    X(isDefrostStarted) X(defrostStartedTime) X(defrostStoppedTime) \
+    X(isSumpHeaterStarted) X(sumpHeaterStartedTime) X(sumpHeaterStoppedTime) \
+    X(isCompressorHeaterStarted) X(compressorHeaterStartedTime) X(compressorHeaterStoppedTime) \
+    X(isPumpStarted) X(pumpStartedTime) X(pumpStoppedTime) \
+    X(isWaterValveStarted) X(waterValveStartedTime) X(waterValveStoppedTime) X(dhwDemand) X(dhwTarget) \
+    X(pumpDuty) X(pumpDelta) X(fanDuty) X(fanIntegral) \
+    X(targetDelay) X(stateHasChanged) X(tempHasChanged) X(tempsSum) \
+    X(compressorError) X(defrostError) \
+    X(t1Error) X(t2Error) X(t3Error) X(t4Error) X(t5Error) X(t6Error) \
+    X(p1Error) X(p2Error) X(highPressureError) \
+    X(heatedAtLeastOnce) X(drawSign) \
+    X(compressorFlag) X(fanFlag) X(defrostFlag) X(sumpHeaterFlag) \
+    X(compressorHeaterFlag) X(waterPumpFlag) X(waterValveFlag) \
+    X(counters) X(counterSince) X(runSince) X(countersSavedTime) X(counterLogNext) \
+    X(rollupMinutes) X(rollupHours) X(rollupDays) X(rollupLevels)
+
+// One controller's worth of those globals, so several controllers can take
+// turns running the single-instance firmware code.
+struct ControllerState {
+#define CONTROLLER_FIELD(name) decltype(::name) name;
+    CONTROLLER_GLOBALS(CONTROLLER_FIELD)
+#undef CONTROLLER_FIELD
+};
+
+// Assignment, extended to the arrays among those globals.
+template <typename T>
+inline void copyField(T& to, const T& from) {
+    to = from;
+}
+
+template <typename T, size_t N>
+inline void copyField(T (&to)[N], const T (&from)[N]) {
+    for (size_t i = 0; i < N; i++) to[i] = from[i];
+}
+
+inline void saveController(ControllerState& s) {
+#define CONTROLLER_SAVE(name) copyField(s.name, ::name);
+    CONTROLLER_GLOBALS(CONTROLLER_SAVE)
+#undef CONTROLLER_SAVE
+}
+
+inline void loadController(const ControllerState& s) {
+#define CONTROLLER_LOAD(name) copyField(::name, s.name);
+    CONTROLLER_GLOBALS(CONTROLLER_LOAD)
+#undef CONTROLLER_LOAD
+}
+
+// One controller's fields, each under its global's name.
+inline void checkpointController(CheckpointWriter& w, const ControllerState& s) {
+#define CONTROLLER_PUT(name) w.put(#name, s.name);
+    CONTROLLER_GLOBALS(CONTROLLER_PUT)
+#undef CONTROLLER_PUT
+}
+
+inline bool restoreController(CheckpointReader& r, ControllerState& s) {
+    bool ok = true;
+#define CONTROLLER_GET(name) ok = ok && r.get(#name, s.name);
+    CONTROLLER_GLOBALS(CONTROLLER_GET)
+#undef CONTROLLER_GET
+    return ok;
+}
+
+// The firmware state outside ControllerState: the states[] history, the
+// heating curve and the virtual clock.
+inline void checkpointFirmware(CheckpointWriter& w) {
+    w.put("states", states);
+    w.put("stateIndex", stateIndex);
+    w.put("heatingCurve", heatingCurve);
+    w.put("micros", simMicros());
+}
+
+inline bool restoreFirmware(CheckpointReader& r) {
+    unsigned long long now;
+    if (!r.get("states", states) || !r.get("stateIndex", stateIndex)
+        || !r.get("heatingCurve", heatingCurve) || !r.get("micros", now)) {
+        return false;
+    }
+    simSetMicros(now);
+    return true;
+}
+
+// A reading in degrees as getAllTemps() would store it in TEMPS.
+inline temp_t fromCelsius(float c) {
+    if (c <= DEVICE_DISCONNECTED_C) return DEVICE_DISCONNECTED_RAW >> 3;
+    return (temp_t)lroundf(c * 16.0f);
+}
+
+// Puts one set of readings in degrees, in TEMPS order, into t and the mocked
+// sensors.
+inline void setReadings(const float temps[6]) {
+    t.waterIntake = fromCelsius(temps[0]);
+    t.waterInject = fromCelsius(temps[1]);
+    t.coolantIntake = fromCelsius(temps[2]);
+    t.coolantInject = fromCelsius(temps[3]);
+    t.airOutside = fromCelsius(temps[4]);
+    t.dhwTank = fromCelsius(temps[5]);
+    // start() polls these two sensors itself.
+    sensors.setTempC(coolantInjectSensor, temps[3]);
+    sensors.setTempC(outsideAirSensor, temps[4]);
+}
+
+#endif
@@ -0,0 +1,468 @@
+// Fleet simulation: the control rules of src/main.cpp on every unit, the
+// plant physics of all units in one SIMD kernel.
+//
+// Controllers run one at a time on the single-instance firmware code,
+// swapped in and out of its globals (firmware_state.h) on a shared virtual
+// clock, every --control-ms. Between controller rounds the plant advances
+// in --plant-dt steps with the relays held.
+//
+//   ./fleet --units 20000 --hours 24
+//   ./fleet --bench 2 --units 20000        # plant kernels only
+//   ./fleet --verify                       # SIMD kernels against scalar
+//   ./fleet --units 200 --max-starts 30    # fail on short-cycling
+//
+//   ./fleet --units 50 --hours 6 --save pre.ckpt
+//   ./fleet --restore pre.ckpt --branches 100 --air -20,0 --hours 1
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "Arduino.h"
+#include "mock_libraries.h"
+#include "plant.h"
+
+TwoWire Wire;
+SPIClass SPI;
+
+#include "../src/main.cpp"
+#include "firmware_state.h"
+
+struct Options {
+    size_t units;
+    double hours;
+    float plantDt;
+    unsigned long controlMs;
+    PlantKernel kernel;
+    unsigned long long seed;
+    float airMin, airMax;
+    bool airGiven;
+    double bench;
+    bool verify;
+    const char* savePath;
+    const char* restorePath;
+    size_t branches;
+    double maxStarts;       // compressor starts per unit and hour; 0 = no limit
+};
+
+// xorshift64*
+struct Rng {
+    unsigned long long s;
+    explicit Rng(unsigned long long seed) : s(seed ? seed : 0x9E3779B97F4A7C15ULL) {}
+    unsigned long long next() {
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return s * 0x2545F4914F6CDD1DULL;
+    }
+    float uniform(float lo, float hi) { return lo + (hi - lo) * (float)(next() >> 40) / (float)(1 << 24); }
+};
+
+static double seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Outdoor air, indoor air and tank losses drawn per unit, one DHW draw for
+// all; padding lanes copy unit 0 so they stay finite.
+static void populate(PlantFleet& fleet, const Options& opt) {
+    Rng rng(opt.seed);
+    for (size_t i = 0; i < fleet.capacity; i++) {
+        size_t src = i < fleet.count ? i : 0;
+        if (src != i) {
+            fleet.airOutside[i] = fleet.airOutside[src];
+            fleet.airInside[i] = fleet.airInside[src];
+            fleet.tankLoss[i] = fleet.tankLoss[src];
+            fleet.dhwLoss[i] = fleet.dhwLoss[src];
+            continue;
+        }
+        fleet.airOutside[i] = rng.uniform(opt.airMin, opt.airMax);
+        fleet.airInside[i] = rng.uniform(18.0f, 22.0f);
+        fleet.tankLoss[i] = rng.uniform(0.5e-5f, 2e-5f);
+        fleet.dhwLoss[i] = 4e-5f;
+    }
+    plantSettle(fleet);
+}
+
+static void randomRelays(PlantFleet& fleet, Rng& rng) {
+    float* relays[5] = {fleet.compressorOn, fleet.fanOn, fleet.defrostOn, fleet.pumpOn, fleet.waterValveOn};
+    for (size_t i = 0; i < fleet.capacity; i++) {
+        unsigned long long r = rng.next();
+        for (int k = 0; k < 5; k++) relays[k][i] = r >> (40 + k) & 1;
+        fleet.fanOn[i] = (r >> 48 & 0xFF) / 255.0f;        // speeds, not just on/off
+        fleet.pumpOn[i] = (r >> 56 & 0xFF) / 255.0f;
+    }
+}
+
+// Plant kernels alone, each available one for `opt.bench` seconds.
+static int bench(const Options& opt) {
+    PlantParams params = defaultPlantParams();
+    PlantFleet fleet;
+    if (!plantAlloc(fleet, opt.units)) return 1;
+    populate(fleet, opt);
+
+    const int stepsPerCall = 7;
+    printf("%zu units, %d steps of %.3f s per call\n", opt.units, stepsPerCall, opt.plantDt);
+    for (int k = PLANT_KERNEL_SCALAR; k <= PLANT_KERNEL_AVX2; k++) {
+        if (plantSelectKernel((PlantKernel)k) != k) {
+            printf("%-8s not available\n", plantKernelNames[k]);
+            continue;
+        }
+        Rng rng(opt.seed);
+        plantSettle(fleet);
+        randomRelays(fleet, rng);
+        unsigned long long unitSteps = 0;
+        double start = seconds();
+        double elapsed = 0;
+        while (elapsed < opt.bench) {
+            plantStep(fleet, params, opt.plantDt, stepsPerCall, (PlantKernel)k);
+            unitSteps += (unsigned long long)fleet.capacity * stepsPerCall;
+            elapsed = seconds() - start;
+        }
+        printf("%-8s %10.0f unit-steps/ms  %6.3f ns/unit-step\n", plantKernelNames[k],
+               unitSteps / (elapsed * 1000), elapsed * 1e9 / unitSteps);
+    }
+    plantFree(fleet);
+    return 0;
+}
+
+// Runs every SIMD kernel against the scalar one from the same state.
+static int verify(const Options& opt) {
+    PlantParams params = defaultPlantParams();
+    PlantFleet reference, other;
+    if (!plantAlloc(reference, opt.units) || !plantAlloc(other, opt.units)) return 1;
+    const size_t bytes = PLANT_ARRAYS * reference.capacity * sizeof(float);
+    int failed = 0;
+
+    for (int k = PLANT_KERNEL_SSE; k <= PLANT_KERNEL_AVX2; k++) {
+        if (plantSelectKernel((PlantKernel)k) != k) continue;
+        populate(reference, opt);
+        Rng rng(opt.seed);
+        for (int round = 0; round < 200; round++) {
+            randomRelays(reference, rng);
+            memcpy(other.tank, reference.tank, bytes);
+            plantStep(reference, params, opt.plantDt, 7, PLANT_KERNEL_SCALAR);
+            plantStep(other, params, opt.plantDt, 7, (PlantKernel)k);
+            if (memcmp(other.tank, reference.tank, bytes)) {
+                printf("%s differs from scalar in round %d\n", plantKernelNames[k], round);
+                failed = 1;
+                break;
+            }
+        }
+        if (!failed) printf("%s matches scalar bit for bit\n", plantKernelNames[k]);
+    }
+    plantFree(reference);
+    plantFree(other);
+    return failed;
+}
+
+// Everything a fleet run needs to continue: its periods and elapsed time,
+// the shared firmware state, and per unit the plant and the controller.
+static bool saveFleet(const Options& opt, double hours, const PlantFleet& fleet,
+                      const std::vector<ControllerState>& controllers) {
+    CheckpointWriter w;
+    if (!w.open(opt.savePath)) {
+        perror(opt.savePath);
+        return false;
+    }
+    w.put("controlMs", opt.controlMs);
+    w.put("plantDt", opt.plantDt);
+    w.put("hours", hours);
+    w.put("units", fleet.count);
+    checkpointFirmware(w);
+    float* arrays[PLANT_ARRAYS];
+    plantArrays(fleet, arrays);
+    for (int a = 0; a < PLANT_ARRAYS; a++) w.put(plantArrayNames[a], arrays[a], fleet.count * sizeof(float));
+    for (size_t i = 0; i < fleet.count; i++) checkpointController(w, controllers[i]);
+    if (!w.close()) {
+        perror(opt.savePath);
+        return false;
+    }
+    return true;
+}
+
+// Restores a saved fleet with every unit repeated opt.branches times, the
+// copies of a unit next to each other. With --air, all copies but the
+// first get a new outdoor temperature from that range. Padding lanes copy
+// unit 0. The periods of the checkpoint replace those in opt.
+static bool restoreFleet(Options& opt, double& hours, PlantFleet& fleet,
+                         std::vector<ControllerState>& controllers) {
+    CheckpointReader r;
+    size_t saved = 0;
+    bool ok = r.open(opt.restorePath) && r.get("controlMs", opt.controlMs) && r.get("plantDt", opt.plantDt)
+              && r.get("hours", hours) && r.get("units", saved) && restoreFirmware(r);
+    if (ok && (!saved || !plantAlloc(fleet, saved * opt.branches))) {
+        fprintf(stderr, "%s: cannot allocate %zu units\n", opt.restorePath, saved * opt.branches);
+        return false;
+    }
+
+    std::vector<float> values(saved);
+    float* arrays[PLANT_ARRAYS];
+    if (ok) plantArrays(fleet, arrays);
+    for (int a = 0; ok && a < PLANT_ARRAYS; a++) {
+        ok = r.get(plantArrayNames[a], values.data(), saved * sizeof(float));
+        for (size_t i = 0; ok && i < fleet.capacity; i++) {
+            arrays[a][i] = values[i < fleet.count ? i / opt.branches : 0];
+        }
+    }
+    controllers.resize(fleet.count);
+    for (size_t i = 0; ok && i < saved; i++) {
+        ok = restoreController(r, controllers[i * opt.branches]);
+        for (size_t b = 1; b < opt.branches; b++) controllers[i * opt.branches + b] = controllers[i * opt.branches];
+    }
+    if (!ok) {
+        fprintf(stderr, "%s: %s\n", opt.restorePath, r.error().c_str());
+        if (fleet.tank) plantFree(fleet);
+        return false;
+    }
+
+    if (opt.airGiven) {
+        Rng rng(opt.seed);
+        for (size_t i = 0; i < fleet.count; i++) {
+            if (i % opt.branches) fleet.airOutside[i] = rng.uniform(opt.airMin, opt.airMax);
+        }
+    }
+    opt.units = fleet.count;
+    return true;
+}
+
+struct FleetStats {
+    unsigned long long compressorOn;    // unit-rounds with the compressor running
+    unsigned long long waterValveOn;    // unit-rounds with the valve on DHW
+    unsigned long long pumpOn;          // unit-rounds with the circulation pump running
+    unsigned long long pumpDuty;        // its PWM duty summed over those rounds
+    unsigned long long fanOn;           // unit-rounds with the evaporator fan running
+    unsigned long long fanDuty;         // its PWM duty summed over those rounds
+    unsigned long fanStarts;
+    unsigned long defrostStarts;
+    unsigned long compressorStarts;
+};
+
+// Control rounds from the start of the first run to `hours`. Counting from
+// there rather than per run keeps a run split at a checkpoint on the same
+// rounds as one run over the whole time.
+static unsigned long long roundsAt(double hours, unsigned long controlMs) {
+    return (unsigned long long)(hours * 3600000.0 / controlMs);
+}
+
+static int run(Options opt) {
+    PlantParams params = defaultPlantParams();
+    PlantKernel kernel = plantSelectKernel(opt.kernel);
+    PlantFleet fleet;
+    std::vector<ControllerState> controllers;
+    double startHours = 0;
+
+    resetController();
+    if (opt.restorePath) {
+        if (!restoreFleet(opt, startHours, fleet, controllers)) return 1;
+    } else {
+        if (!plantAlloc(fleet, opt.units)) {
+            fprintf(stderr, "cannot allocate %zu units\n", opt.units);
+            return 1;
+        }
+        populate(fleet, opt);
+        ControllerState booted;
+        saveController(booted);
+        controllers.assign(opt.units, booted);
+    }
+
+    int plantSteps = (int)lround(opt.controlMs / 1000.0 / opt.plantDt);
+    if (plantSteps < 1) plantSteps = 1;
+    unsigned long long rounds = roundsAt(startHours + opt.hours, opt.controlMs) - roundsAt(startHours, opt.controlMs);
+    unsigned long long now = simMicros();
+
+    FleetStats stats = FleetStats();
+    double controlTime = 0, plantTime = 0;
+    for (unsigned long long round = 0; round < rounds; round++) {
+        now += opt.controlMs * 1000ULL;
+
+        double t0 = seconds();
+        for (size_t i = 0; i < opt.units; i++) {
+            // start() and Serial advance the clock; every unit sees the same time.
+            simSetMicros(now);
+            loadController(controllers[i]);
+            float temps[6];
+            plantReadings(fleet, i, temps);
+            setReadings(temps);
+            checkTemps(t);
+            controlStep();
+            saveController(controllers[i]);
+
+            stats.compressorOn += isCompressorStarted;
+            stats.waterValveOn += isWaterValveStarted;
+            stats.pumpOn += isPumpStarted;
+            stats.pumpDuty += pumpDuty;
+            stats.fanOn += isFanStarted;
+            stats.fanDuty += fanDuty;
+            stats.fanStarts += isFanStarted && fleet.fanOn[i] == 0;
+            stats.compressorStarts += isCompressorStarted && fleet.compressorOn[i] == 0;
+            stats.defrostStarts += isDefrostStarted && fleet.defrostOn[i] == 0;
+            fleet.compressorOn[i] = isCompressorStarted;
+            fleet.fanOn[i] = fanDuty / (float)FAN_DUTY_MAX;
+            fleet.defrostOn[i] = isDefrostStarted;
+            fleet.pumpOn[i] = pumpDuty / (float)PUMP_DUTY_MAX;
+            fleet.waterValveOn[i] = isWaterValveStarted;
+        }
+        double t1 = seconds();
+        plantStep(fleet, params, opt.plantDt, plantSteps, kernel);
+        double t2 = seconds();
+        controlTime += t1 - t0;
+        plantTime += t2 - t1;
+    }
+    // Where the next round would start, however far the last unit moved it.
+    simSetMicros(now);
+    if (opt.savePath && !saveFleet(opt, startHours + opt.hours, fleet, controllers)) return 1;
+
+    double tankSum = 0, tankMin = 1e9, tankMax = -1e9, frostSum = 0, dhwSum = 0, dhwMin = 1e9;
+    size_t inError = 0, latched = 0;
+    unsigned long faults = 0;
+    RELAY_COUNTERS compressorTotal = RELAY_COUNTERS();
+    for (size_t i = 0; i < opt.units; i++) {
+        tankSum += fleet.tank[i];
+        if (fleet.tank[i] < tankMin) tankMin = fleet.tank[i];
+        if (fleet.tank[i] > tankMax) tankMax = fleet.tank[i];
+        frostSum += fleet.frost[i];
+        dhwSum += fleet.dhwTank[i];
+        if (fleet.dhwTank[i] < dhwMin) dhwMin = fleet.dhwTank[i];
+        const ControllerState& c = controllers[i];
+        if (c.compressorError || c.defrostError || c.t1Error || c.t2Error || c.t3Error || c.t4Error || c.t5Error) {
+            inError++;
+        }
+        latched += c.faultLatched;
+        faults += c.stateEntries[STATE_FAULT];
+
+        loadController(c);
+        if (isCompressorStarted) relayAccumulate(COUNTER_COMPRESSOR);
+        const RELAY_COUNTERS& k = counters.relays[COUNTER_COMPRESSOR];
+        compressorTotal.onSeconds += k.onSeconds;
+        compressorTotal.starts += k.starts;
+        compressorTotal.energyWh += k.energyWh;
+        if (k.longestSeconds > compressorTotal.longestSeconds) compressorTotal.longestSeconds = k.longestSeconds;
+    }
+
+    unsigned long long unitRounds = rounds * opt.units;
+    unsigned long long unitSteps = unitRounds * plantSteps;
+    printf("%zu units, %.1f simulated hours, %llu control rounds of %lu ms, %d plant steps of %.3f s each\n",
+           opt.units, opt.hours, rounds, opt.controlMs, plantSteps, opt.plantDt);
+    if (opt.restorePath) {
+        printf("restored at %.2f h from %s, %zu branches per unit\n", startHours, opt.restorePath, opt.branches);
+    }
+    printf("plant (%s): %llu unit-steps in %.3f s, %.0f unit-steps/ms\n", plantKernelNames[kernel],
+           unitSteps, plantTime, plantTime > 0 ? unitSteps / (plantTime * 1000) : 0.0);
+    printf("control: %llu unit-rounds in %.3f s, %.0f unit-rounds/ms\n",
+           unitRounds, controlTime, controlTime > 0 ? unitRounds / (controlTime * 1000) : 0.0);
+    if (!opt.units) return 0;
+    printf("tank: mean %.1f, min %.1f, max %.1f | compressor on %.1f%% | %.2f starts/unit/h | "
+           "%.2f defrosts/unit/h | mean frost %.3f | %zu units in error\n",
+           tankSum / opt.units, tankMin, tankMax,
+           unitRounds ? 100.0 * stats.compressorOn / unitRounds : 0.0,
+           opt.hours > 0 ? stats.compressorStarts / (opt.units * opt.hours) : 0.0,
+           opt.hours > 0 ? stats.defrostStarts / (opt.units * opt.hours) : 0.0,
+           frostSum / opt.units, inError);
+    printf("compressor counters: %.2f h on, %.1f starts, %.2f kWh per unit | longest run %lu s\n",
+           compressorTotal.onSeconds / 3600.0 / opt.units, (double)compressorTotal.starts / opt.units,
+           compressorTotal.energyWh / 1000.0 / opt.units, compressorTotal.longestSeconds);
+    printf("faults: %lu | %zu units latched until reboot\n", faults, latched);
+    printf("pump: on %.1f%% | mean duty %.1f%% while on\n",
+           unitRounds ? 100.0 * stats.pumpOn / unitRounds : 0.0,
+           stats.pumpOn ? 100.0 * stats.pumpDuty / (stats.pumpOn * PUMP_DUTY_MAX) : 0.0);
+    printf("fan: on %.1f%% | mean duty %.1f%% while on | %.2f starts/unit/h\n",
+           unitRounds ? 100.0 * stats.fanOn / unitRounds : 0.0,
+           stats.fanOn ? 100.0 * stats.fanDuty / (stats.fanOn * FAN_DUTY_MAX) : 0.0,
+           opt.hours > 0 ? stats.fanStarts / (opt.units * opt.hours) : 0.0);
+    if (DHW_ENABLED) {
+        printf("dhw: mean %.1f, min %.1f | valve on DHW %.1f%%\n", dhwSum / opt.units, dhwMin,
+               unitRounds ? 100.0 * stats.waterValveOn / unitRounds : 0.0);
+    }
+    plantFree(fleet);
+    double startsPerHour = opt.hours > 0 ? stats.compressorStarts / (opt.units * opt.hours) : 0.0;
+    if (opt.maxStarts > 0 && startsPerHour > opt.maxStarts) {
+        printf("FAIL: %.2f compressor starts/unit/h, limit %.2f\n", startsPerHour, opt.maxStarts);
+        return 1;
+    }
+    return 0;
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [--units N] [--hours H] [--plant-dt S] [--control-ms MS]\n"
+            "          [--kernel auto|scalar|sse|avx2] [--seed N] [--air LO,HI]\n"
+            "          [--bench S] [--verify] [--save FILE] [--restore FILE [--branches N]]\n"
+            "          [--max-starts N]\n"
+            "  --units N          heat pumps in the fleet (default 20000)\n"
+            "  --hours H          simulated time (default 1)\n"
+            "  --plant-dt S       plant step (default 0.1)\n"
+            "  --control-ms MS    controller period, the firmware's loop time (default 700)\n"
+            "  --kernel K         plant kernel (default auto: widest available)\n"
+            "  --air LO,HI        outdoor air range across units (default -15,10)\n"
+            "  --bench S          time each plant kernel for S seconds instead\n"
+            "  --verify           check the SIMD kernels against the scalar one\n"
+            "  --save FILE        checkpoint the fleet at the end of the run\n"
+            "  --restore FILE     continue from a checkpoint, with its units and periods\n"
+            "  --branches N       run N copies of every restored unit; with --air, all\n"
+            "                     but the first get a new outdoor temperature\n"
+            "  --max-starts N     exit 1 if compressor starts/unit/h exceed N\n",
+            argv0);
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    opt.units = 20000;
+    opt.hours = 1;
+    opt.plantDt = 0.1f;
+    opt.controlMs = 700;
+    opt.kernel = PLANT_KERNEL_AUTO;
+    opt.seed = 1;
+    opt.airMin = -15;
+    opt.airMax = 10;
+    opt.bench = 0;
+    opt.airGiven = false;
+    opt.verify = false;
+    opt.savePath = NULL;
+    opt.restorePath = NULL;
+    opt.branches = 1;
+    opt.maxStarts = 0;
+
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (!strcmp(argv[i], "--units") && more) opt.units = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--hours") && more) opt.hours = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--plant-dt") && more) opt.plantDt = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--control-ms") && more) opt.controlMs = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--seed") && more) opt.seed = strtoull(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--air") && more && sscanf(argv[i + 1], "%f,%f", &opt.airMin, &opt.airMax) == 2) {
+            opt.airGiven = true;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--bench") && more) opt.bench = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--verify")) opt.verify = true;
+        else if (!strcmp(argv[i], "--max-starts") && more) opt.maxStarts = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--save") && more) opt.savePath = argv[++i];
+        else if (!strcmp(argv[i], "--restore") && more) opt.restorePath = argv[++i];
+        else if (!strcmp(argv[i], "--branches") && more) opt.branches = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--kernel") && more) {
+            const char* name = argv[++i];
+            int k = PLANT_KERNEL_AUTO;
+            while (k <= PLANT_KERNEL_AVX2 && strcmp(plantKernelNames[k], name)) k++;
+            if (k > PLANT_KERNEL_AVX2) {
+                usage(argv[0]);
+                return 2;
+            }
+            opt.kernel = (PlantKernel)k;
+        }
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!opt.units || opt.plantDt <= 0 || !opt.controlMs || !opt.branches) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    simVerbose = false;
+    if (opt.verify) return verify(opt);
+    if (opt.bench > 0) return bench(opt);
+    return run(opt);
+}
@@ -0,0 +1,110 @@
+#ifndef INVARIANTS_H
+#define INVARIANTS_H
+
+// Safety invariants over the firmware globals, checked after every control
+// step by the host tools. Include after ../src/main.cpp.
+
+enum Invariant {
+    INV_OK = 0,
+    INV_FAN_DURING_DEFROST,         // evaporator fan on while defrosting
+    INV_COMPRESSOR_ABOVE_TARGET,    // compressor started with water at target (waterAtTarget())
+    INV_RESUMED_IN_DEADBAND,        // heating resumed less than WATER_HYSTERESIS below waterTarget
+    INV_STATE_INDEX,                // next saveState() would write past states[]
+    INV_RELAY_ON_WITH_ERROR,        // a relay left on while an error is latched
+    INV_RELAY_CHATTER,              // relay toggled faster than its minimum
+    INV_PUMP_PWM,                   // circulation pump pin not at pumpDuty
+    INV_FAN_PWM,                    // fan speed pin not at fanDuty
+    INVARIANT_COUNT
+};
+
+static const char* const invariantNames[INVARIANT_COUNT] = {
+    "ok",
+    "fan on while isDefrostStarted",
+    "compressor started with the water at target",
+    "heating resumed inside the water hysteresis",
+    "stateIndex past the end of states[]",
+    "relay on while an error is latched",
+    "relay toggled faster than the configured minimum",
+    "circulation pump PWM pin not at pumpDuty",
+    "fan PWM pin not at fanDuty",
+};
+
+#define RELAY_COUNT 7
+
+static const char* const relayNames[RELAY_COUNT] = {
+    "compressor", "fan", "defrostValve", "sumpHeater", "compressorHeater", "waterPump", "waterValve",
+};
+
+inline void readRelays(bool relays[RELAY_COUNT]) {
+    relays[0] = isCompressorStarted;
+    relays[1] = isFanStarted;
+    relays[2] = isDefrostStarted;
+    relays[3] = isSumpHeaterStarted;
+    relays[4] = isCompressorHeaterStarted;
+    relays[5] = isPumpStarted;
+    relays[6] = isWaterValveStarted;
+}
+
+struct InvariantMonitor {
+    unsigned long minToggleMs[RELAY_COUNT];     // 0 disables the chatter check
+    bool relays[RELAY_COUNT];
+    CONTROL_STATE state;                        // controlState after the last check
+    bool toggled[RELAY_COUNT];
+    unsigned long lastToggle[RELAY_COUNT];
+    int failedRelay;                            // set on INV_RELAY_CHATTER
+    unsigned long toggles;                      // relay operations seen
+
+    InvariantMonitor() : failedRelay(-1), toggles(0) {
+        for (int r = 0; r < RELAY_COUNT; r++) minToggleMs[r] = 0;
+        reset();
+    }
+
+    // Starts watching from the current firmware state.
+    void reset() {
+        readRelays(relays);
+        state = controlState;
+        for (int r = 0; r < RELAY_COUNT; r++) {
+            toggled[r] = false;
+            lastToggle[r] = 0;
+        }
+        failedRelay = -1;
+        toggles = 0;
+    }
+
+    Invariant check() {
+        bool now[RELAY_COUNT];
+        readRelays(now);
+
+        if (isFanStarted && isDefrostStarted) return INV_FAN_DURING_DEFROST;
+        if (now[0] && !relays[0] && waterAtTarget()) return INV_COMPRESSOR_ABOVE_TARGET;
+        if (now[0] && !relays[0] && state == STATE_SATISFIED && !isWaterValveStarted &&
+            t.waterInject >= waterTarget - WATER_HYSTERESIS) {
+            return INV_RESUMED_IN_DEADBAND;
+        }
+        state = controlState;
+        if (stateIndex >= maxStateIndex) return INV_STATE_INDEX;
+        if (digitalRead(waterCirculationPump) != pumpDuty) return INV_PUMP_PWM;
+        if (digitalRead(fanPwm) != fanDuty) return INV_FAN_PWM;
+        if (hasErrors()) {
+            for (int r = 0; r < RELAY_COUNT; r++) {
+                if (now[r]) return INV_RELAY_ON_WITH_ERROR;
+            }
+        }
+
+        unsigned long ms = millis();
+        for (int r = 0; r < RELAY_COUNT; r++) {
+            if (now[r] == relays[r]) continue;
+            if (toggled[r] && ms - lastToggle[r] < minToggleMs[r]) {
+                failedRelay = r;
+                return INV_RELAY_CHATTER;
+            }
+            toggled[r] = true;
+            lastToggle[r] = ms;
+            relays[r] = now[r];
+            toggles++;
+        }
+        return INV_OK;
+    }
+};
+
+#endif
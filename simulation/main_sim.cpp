@@ -1,379 +1,246 @@
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <fcntl.h>
+#include <termios.h>
 #include "Arduino.h"
 #include "mock_libraries.h"
+#include "trace.h"
+#include "replay.h"
+#include "ssd1306_model.h"
 
 // Global instances of mocked libraries
 TwoWire Wire;
 SPIClass SPI;
-Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
-OneWire oneWire(ONE_WIRE_BUS);
-DallasTemperature sensors(&oneWire);
 
-// Global variables from main.cpp
-TEMPS t = {0};
-STATE states[maxStateIndex];
-unsigned int stateIndex = 0;
-bool isCompressorStarted = false;
-bool isFanStarted = false;
-bool isDefrostStarted = false;
-bool isSumpHeaterStarted = false;
-bool isCompressorHeaterStarted = false;
-bool isPumpStarted = false;
-
-// Mock temperature sensor addresses
-DeviceAddress waterIntakeSensor = {0x28, 0x53, 0x8E, 0x95, 0xF0, 0x01, 0x3C, 0x34};
-DeviceAddress waterInjectSensor = {0x28, 0x8A, 0x3D, 0x95, 0xF0, 0xFF, 0x3C, 0x22};
-DeviceAddress coolantIntakeSensor = {0x28, 0xA6, 0x93, 0x95, 0xF0, 0x01, 0x3C, 0x3D};
-DeviceAddress coolantInjectSensor = {0x28, 0x66, 0xC6, 0x95, 0xF0, 0x01, 0x3C, 0xE5};
-DeviceAddress outsideAirSensor = {0x28, 0x32, 0xBD, 0x56, 0xB5, 0x01, 0x3C, 0xBF};
-DeviceAddress insideAirSensor = {0x28, 0x32, 0xBD, 0x56, 0xB5, 0x01, 0x3C, 0xBF};
-
-// Timing variables
-unsigned long compressorStartedTime = 0;
-unsigned long compressorStoppedTime = 0;
-unsigned long fanStartedTime = 0;
-unsigned long fanStoppedTime = 0;
-unsigned long defrostStartedTime = 0;
-unsigned long defrostStoppedTime = 0;
-unsigned long sumpHeaterStartedTime = 0;
-unsigned long sumpHeaterStoppedTime = 0;
-unsigned long compressorHeaterStartedTime = 0;
-unsigned long compressorHeaterStoppedTime = 0;
-unsigned long pumpStartedTime = 0;
-unsigned long pumpStoppedTime = 0;
-
-// Control flags
-bool startIsFinished = false;
-unsigned long targetDelay = 0;
-bool stateHasChanged = true;
-bool tempHasChanged = true;
-float tempsSum = 0;
-bool heatedAtLeastOnce = false;
-bool drawSign = false;
-
-// Error flags
-bool compressorError = false;
-bool defrostError = false;
-bool t1Error = false;
-bool t2Error = false;
-bool t3Error = false;
-bool t4Error = false;
-bool t5Error = false;
-bool t6Error = false;
-
-// Pin control flags
-int compressorFlag = 0;
-int fanFlag = 0;
-int defrostFlag = 0;
-int sumpHeaterFlag = 0;
-int compressorHeaterFlag = 0;
-int waterPumpFlag = 0;
-int waterValveFlag = 0;
-
-String mode = "work";
-
-// Function implementations
-void updateStateIndex() {
-    if (stateIndex < maxStateIndex) {
-        stateIndex++;
-    } else {
-        stateIndex = 0;
-    }
-}
-
-void stopAll(bool withDefrost = false) {
-    isCompressorStarted = false;
-    isFanStarted = false;
-    isPumpStarted = false;
-    isSumpHeaterStarted = false;
-    isCompressorHeaterStarted = false;
-    if (withDefrost) {
-        isDefrostStarted = false;
-    }
-}
-
-void startCompressor() {
-    if (isCompressorStarted) return;
-    compressorFlag = 1;
-    isCompressorStarted = true;
-    compressorStartedTime = millis();
-    stateHasChanged = true;
-    digitalWrite(PIN_COMPRESSOR, HIGH);
-    std::cout << "Compressor started" << std::endl;
-}
-
-void stopCompressor() {
-    compressorFlag = -1;
-    isCompressorStarted = false;
-    compressorStoppedTime = millis();
-    stateHasChanged = true;
-    digitalWrite(PIN_COMPRESSOR, LOW);
-    std::cout << "Compressor stopped" << std::endl;
-}
-
-void startFan() {
-    if (isFanStarted || isDefrostStarted) return;
-    fanFlag = 1;
-    isFanStarted = true;
-    fanStartedTime = millis();
-    stateHasChanged = true;
-    digitalWrite(PIN_FAN, HIGH);
-    std::cout << "Fan started" << std::endl;
-}
-
-void stopFan() {
-    fanFlag = -1;
-    isFanStarted = false;
-    fanStoppedTime = millis();
-    stateHasChanged = true;
-    digitalWrite(PIN_FAN, LOW);
-    std::cout << "Fan stopped" << std::endl;
-}
-
-void startDefrost() {
-    if (isDefrostStarted) return;
-    defrostFlag = 1;
-    isDefrostStarted = true;
-    defrostStartedTime = millis();
-    stateHasChanged = true;
-    digitalWrite(PIN_DEFROST_VALVE, HIGH);
-    std::cout << "Defrost started" << std::endl;
-}
-
-void stopDefrost() {
-    defrostFlag = -1;
-    isDefrostStarted = false;
-    defrostStoppedTime = millis();
-    stateHasChanged = true;
-    digitalWrite(PIN_DEFROST_VALVE, LOW);
-    std::cout << "Defrost stopped" << std::endl;
-}
-
-void startSumpHeater() {
-    if (isSumpHeaterStarted) return;
-    sumpHeaterFlag = 1;
-    isSumpHeaterStarted = true;
-    sumpHeaterStartedTime = millis();
-    stateHasChanged = true;
-    digitalWrite(PIN_SUMP_HEATER, HIGH);
-    std::cout << "Sump heater started" << std::endl;
-}
-
-void stopSumpHeater() {
-    sumpHeaterFlag = -1;
-    isSumpHeaterStarted = false;
-    sumpHeaterStoppedTime = millis();
-    stateHasChanged = true;
-    digitalWrite(PIN_SUMP_HEATER, LOW);
-    std::cout << "Sump heater stopped" << std::endl;
-}
-
-void startPump() {
-    if (isPumpStarted) return;
-    waterPumpFlag = 1;
-    isPumpStarted = true;
-    pumpStartedTime = millis();
-    stateHasChanged = true;
-    digitalWrite(PIN_WATER_PUMP, HIGH);
-    std::cout << "Water pump started" << std::endl;
-}
-
-void stopPump() {
-    waterPumpFlag = -1;
-    isPumpStarted = false;
-    pumpStoppedTime = millis();
-    stateHasChanged = true;
-    digitalWrite(PIN_WATER_PUMP, LOW);
-    std::cout << "Water pump stopped" << std::endl;
-}
-
-void sumpHeaterCheck() {
-    if (t.airOutside <= sumpHeaterTemp) {
-        startSumpHeater();
-    }
-    if (t.airOutside >= sumpHeaterTemp + DELTA_2) {
-        stopSumpHeater();
-    }
-}
-
-void compressorControl() {
-    if (t.waterInject <= waterTargetTemp) {
-        startCompressor();
-    }
-    if (heatedAtLeastOnce && t.waterInject >= waterTargetTemp + DELTA_2 && !isDefrostStarted) {
-        stopAll();
-        startIsFinished = false;
-    }
-}
-
-void checkCompressorError() {
-    if (!isFanStarted) return;
-    if (millis() - fanStartedTime >= errorTime) {
-        if (heatedAtLeastOnce) {
-            stopAll();
-            compressorError = true;
+// The OLED on the I2C bus, reconstructed from what the firmware sends.
+SSD1306Model oled;
+
+// The firmware itself: globals, setup(), loop() and every control function.
+#include "../src/main.cpp"
+
+// Captures the state after one loop() call for the trace.
+void traceStep(TraceWriter& trace) {
+    TraceRow row;
+    row.millis = millis();
+    row.temps[0] = t.waterIntake;
+    row.temps[1] = t.waterInject;
+    row.temps[2] = t.coolantIntake;
+    row.temps[3] = t.coolantInject;
+    row.temps[4] = t.airOutside;
+    row.temps[5] = t.dhwTank;
+    row.relays[0] = isCompressorStarted;
+    row.relays[1] = isFanStarted;
+    row.relays[2] = isDefrostStarted;
+    row.relays[3] = isSumpHeaterStarted;
+    row.relays[4] = isCompressorHeaterStarted;
+    row.relays[5] = isPumpStarted;
+    row.relays[6] = isWaterValveStarted;
+    row.heatedAtLeastOnce = heatedAtLeastOnce;
+    row.startIsFinished = controlState != STATE_STARTING;
+    row.drawSign = drawSign;
+    row.mode = controlState;
+    row.errors = (compressorError ? TRACE_ERR_COMPRESSOR : 0)
+               | (defrostError ? TRACE_ERR_DEFROST : 0)
+               | (t1Error ? TRACE_ERR_T1 : 0)
+               | (t2Error ? TRACE_ERR_T2 : 0)
+               | (t3Error ? TRACE_ERR_T3 : 0)
+               | (t4Error ? TRACE_ERR_T4 : 0)
+               | (t5Error ? TRACE_ERR_T5 : 0)
+               | (t6Error ? TRACE_ERR_T6 : 0)
+               | (p1Error ? TRACE_ERR_P1 : 0)
+               | (p2Error ? TRACE_ERR_P2 : 0)
+               | (highPressureError ? TRACE_ERR_HIGH_PRESSURE : 0);
+    trace.append(row);
+}
+
+// Feeds one replay row to the mocked sensors.
+void replayStep(const ReplayRow& row) {
+    sensors.setTempC(waterIntakeSensor, row.temps[0]);
+    sensors.setTempC(waterInjectSensor, row.temps[1]);
+    sensors.setTempC(coolantIntakeSensor, row.temps[2]);
+    sensors.setTempC(coolantInjectSensor, row.temps[3]);
+    sensors.setTempC(outsideAirSensor, row.temps[4]);
+    sensors.setTempC(dhwTankSensor, row.temps[5]);
+}
+
+// Puts `bar` on the transducer at `channel`: 0.5 V at 0, 4.5 V at `span`.
+void setPressure(uint8_t channel, float bar, pressure_t span) {
+    float volts = 0.5f + 4.0f * BAR(bar) / span;
+    simAnalogInput(channel, (uint16_t)lroundf(volts / 5.0f * 1024));
+}
+
+// SIGUSR1 asks for a snapshot of the panel at the end of the current step.
+static volatile sig_atomic_t snapshotRequested = 0;
+
+void onSnapshotSignal(int) {
+    snapshotRequested = 1;
+}
+
+// Prints where the virtual time of one step (or the whole run) went.
+void printTiming(const char* label, const BusTotals& before) {
+    unsigned long long total = 0;
+    for (int c = 0; c < BUS_COST_COUNT; c++) total += busTotals.us[c] - before.us[c];
+    printf("%s: %.1f ms", label, total / 1000.0);
+    for (int c = 0; c < BUS_COST_COUNT; c++) {
+        unsigned long long us = busTotals.us[c] - before.us[c];
+        if (!us) continue;
+        printf(" | %s %.1f ms (%.0f%%)", busCostNames[c], us / 1000.0, 100.0 * us / total);
+    }
+    // Serial time is only charged while the TX buffer is full; the UART
+    // itself is busy for every byte.
+    unsigned long long serialBytes = busTotals.bytes[COST_SERIAL] - before.bytes[COST_SERIAL];
+    printf(" | serial tx %llu B, %.1f ms on the wire", serialBytes,
+           serialBytes * 10000.0 / busConfig.serialBaud);
+    // Everything but sleep keeps the CPU awake: waiting on a bus spins.
+    // Every sleep still ends at the next Timer0 overflow, whose interrupt
+    // and the return to serviceDelay() run on CPU time not modelled here.
+    unsigned long long asleep = busTotals.us[COST_SLEEP] - before.us[COST_SLEEP];
+    unsigned long long wakes = busTotals.bytes[COST_SLEEP] - before.bytes[COST_SLEEP];
+    printf(" | awake %.1f%% + %llu Timer0 wake-ups\n", total ? 100.0 * (total - asleep) / total : 0.0, wakes);
+}
+
+// Opens a pty for the firmware's Serial port and prints the device to give a
+// Modbus master. Returns the master side, non-blocking, or -1.
+int openSerialPty() {
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) || unlockpt(fd)) return -1;
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    printf("Serial on %s\n", ptsname(fd));
+    fflush(stdout);
+    return fd;
+}
+
+void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [--steps N] [--trace FILE] [--replay FILE] [--snapshots DIR]\n"
+            "          [--i2c-hz HZ] [--realtime] [--pty] [--pressure HIGH,LOW]\n"
+            "  --steps N        number of loop() iterations (default 30)\n"
+            "  --trace FILE     record every loop step to a columnar binary trace\n"
+            "  --replay FILE    feed sensor values from a replay file, one row per step\n"
+            "  --snapshots DIR  write a PBM of the panel after every step that changed it\n"
+            "  --i2c-hz HZ      I2C clock of the display bus (default 100000)\n"
+            "  --realtime       pace the virtual clock to wall time\n"
+            "  --pty            connect Serial (the Modbus RTU slave) to a pseudo-terminal\n"
+            "  --pressure H,L   P1 and P2 in bar (default 18,6), read with PRESSURE_ENABLED=1\n"
+            "SIGUSR1 writes the current panel to snapshot-<step>.pbm.\n",
+            argv0);
+}
+
+int main(int argc, char** argv) {
+    long steps = 30;
+    const char* tracePath = NULL;
+    const char* replayPath = NULL;
+    const char* snapshotDir = NULL;
+    bool pty = false;
+    float highBar = 18, lowBar = 6;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--steps") && i + 1 < argc) {
+            steps = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (!strcmp(argv[i], "--replay") && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (!strcmp(argv[i], "--snapshots") && i + 1 < argc) {
+            snapshotDir = argv[++i];
+        } else if (!strcmp(argv[i], "--i2c-hz") && i + 1 < argc) {
+            busConfig.i2cClockHz = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--realtime")) {
+            busConfig.realtime = true;
+        } else if (!strcmp(argv[i], "--pty")) {
+            pty = true;
+        } else if (!strcmp(argv[i], "--pressure") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%f,%f", &highBar, &lowBar) != 2) {
+                usage(argv[0]);
+                return 2;
+            }
         } else {
-            heatedAtLeastOnce = true;
-            startDefrost();
-            fanStartedTime = millis();
-            drawSign = true;
+            usage(argv[0]);
+            return 2;
         }
     }
-}
 
-void checkDefrostError() {
-    if (!isDefrostStarted) return;
-    if (millis() - defrostStartedTime >= errorTime) {
-        stopAll();
-        compressorError = true;
+    TraceWriter trace;
+    if (tracePath && !trace.open(tracePath)) {
+        fprintf(stderr, "cannot create trace %s\n", tracePath);
+        return 1;
     }
-}
-
-void waterPumpControl() {
-    if (!isCompressorStarted) return;
-    if (t.coolantInject >= waterTargetTemp) {
-        startPump();
-    }
-    if (heatedAtLeastOnce && (t.coolantInject <= (waterTargetTemp - DELTA_2))) {
-        stopPump();
-        startIsFinished = false;
-    }
-}
-
-void fanControl() {
-    if (!isCompressorStarted) return;
-    if (t.coolantInject >= heatedAtLeastOnceTemp) {
-        heatedAtLeastOnce = true;
-    }
-    if (t.coolantInject >= fanTargetTemp) {
-        drawSign = false;
-        stopFan();
-    }
-    if (t.coolantInject <= (fanTargetTemp - DELTA_2)) {
-        startFan();
-    }
-}
-
-void defrostStartControl() {
-    if (!isCompressorStarted || !heatedAtLeastOnce) return;
-    if (isDefrostStarted) return;
-    std::cout << "Check defrost " << (int)isDefrostStarted << std::endl;
-    if (t.coolantInject <= defrostTemp) {
-        stopFan();
-        startDefrost();
-        mode = "defrost";
-    }
-}
-
-void defrostStopControl() {
-    if (!isDefrostStarted) return;
-    if (t.coolantIntake >= sumpSuctionTemp) {
-        stopDefrost();
-        startFan();
-        heatedAtLeastOnce = false;
-        mode = "work";
-    }
-}
-
-void getAllTemps() {
-    sensors.requestTemperatures();
-    t.waterIntake = sensors.getTempC(waterIntakeSensor);
-    t.waterInject = sensors.getTempC(waterInjectSensor);
-    t.coolantIntake = sensors.getTempC(coolantIntakeSensor);
-    t.coolantInject = sensors.getTempC(coolantInjectSensor);
-    t.airOutside = sensors.getTempC(outsideAirSensor);
-    t.airInside = sensors.getTempC(insideAirSensor);
-    
-    std::cout << "Temperatures:" << std::endl;
-    std::cout << "Water Intake: " << t.waterIntake << "°C" << std::endl;
-    std::cout << "Water Inject: " << t.waterInject << "°C" << std::endl;
-    std::cout << "Coolant Intake: " << t.coolantIntake << "°C" << std::endl;
-    std::cout << "Coolant Inject: " << t.coolantInject << "°C" << std::endl;
-    std::cout << "Air Outside: " << t.airOutside << "°C" << std::endl;
-    std::cout << "Air Inside: " << t.airInside << "°C" << std::endl;
-    
-    float newTempsSum = abs(t.waterIntake) + abs(t.waterInject) + abs(t.coolantIntake) + abs(t.coolantInject) + abs(t.airOutside);
-    if (tempsSum != newTempsSum) tempHasChanged = true;
-    tempsSum = newTempsSum;
-}
-
-void setup() {
-    Serial.begin(115200);
-    
-    // Initialize display
-    if (!display.begin(SSD1306_SWITCHCAPVCC, 0x3C)) {
-        Serial.println(F("SSD1306 allocation failed"));
+    FILE* replay = NULL;
+    if (replayPath && !(replay = fopen(replayPath, "r"))) {
+        fprintf(stderr, "cannot open replay %s\n", replayPath);
+        return 1;
     }
-    display.display();
-    delay(200);
-    
-    // Initialize temperature sensors
-    sensors.begin();
-    sensors.setResolution(waterIntakeSensor, 8);
-    sensors.setResolution(waterInjectSensor, 8);
-    sensors.setResolution(coolantIntakeSensor, 8);
-    sensors.setResolution(coolantInjectSensor, 8);
-    sensors.setResolution(outsideAirSensor, 8);
-    
-    // Initialize pins
-    pinMode(PIN_COMPRESSOR, OUTPUT);
-    pinMode(PIN_FAN, OUTPUT);
-    pinMode(PIN_DEFROST_VALVE, OUTPUT);
-    pinMode(PIN_SUMP_HEATER, OUTPUT);
-    pinMode(PIN_COMPRESSOR_HEATER, OUTPUT);
-    pinMode(PIN_WATER_PUMP, OUTPUT);
-    
-    // Stop all devices initially
-    stopAll(true);
-    
-    std::cout << "Setup complete" << std::endl;
-}
 
-void loop() {
-    delay(700);
-    
-    getAllTemps();
-    
-    if (compressorError || defrostError || t1Error || t2Error || t3Error || t4Error || t5Error) {
-        stopAll(true);
-        std::cout << "Errors detected - stopping all devices" << std::endl;
-        return;
-    }
-    
-    if (t.waterInject >= waterTargetTemp) {
-        stopAll();
-        std::cout << "Water target temperature reached - stopping all devices" << std::endl;
-        return;
-    }
-    
-    // Main control logic
-    sumpHeaterCheck();
-    compressorControl();
-    
-    if (isCompressorStarted) {
-        checkCompressorError();
-        waterPumpControl();
-        fanControl();
-        defrostStartControl();
-        defrostStopControl();
-        checkDefrostError();
+    Wire.attach(0x3C, &oled);
+    if (pty) {
+        int fd = openSerialPty();
+        if (fd < 0) {
+            perror("pty");
+            return 1;
+        }
+        Serial.attach(fd);
     }
-}
+    signal(SIGUSR1, onSnapshotSignal);
+    setPressure(highPressureChannel, highBar, highPressureSpan);
+    setPressure(lowPressureChannel, lowBar, lowPressureSpan);
 
-int main() {
     setup();
     
     std::cout << "\nStarting main loop simulation...\n" << std::endl;
     
-    // Simulate running for 30 seconds
-    for (int i = 0; i < 30; i++) {
+    BusTotals runStart = busTotals;
+    for (long i = 0; i < steps; i++) {
+        if (replay) {
+            ReplayRow row;
+            if (!readReplayRow(replay, row)) break;
+            replayStep(row);
+        }
+        DisplayStats displayBefore = oled.stats();
+        BusTotals stepStart = busTotals;
         loop();
-        std::cout << "\nSimulation time: " << i << " seconds" << std::endl;
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        if (trace.isOpen()) traceStep(trace);
+        unsigned long changed = oled.stats().pixelsChanged - displayBefore.pixelsChanged;
+        if (oled.stats().transmissions != displayBefore.transmissions) {
+            std::cout << "Display: " << changed << " pixels changed, "
+                      << oled.stats().bytes - displayBefore.bytes << " bytes transferred" << std::endl;
+        }
+        if (snapshotDir && changed) {
+            char path[512];
+            snprintf(path, sizeof path, "%s/step-%05ld.pbm", snapshotDir, i);
+            oled.writePBM(path);
+        }
+        if (snapshotRequested) {
+            snapshotRequested = 0;
+            char path[64];
+            snprintf(path, sizeof path, "snapshot-%ld.pbm", i);
+            oled.writePBM(path);
+        }
+        printTiming("Loop timing", stepStart);
+        std::cout << "\nSimulation step " << i << ", time: " << millis() / 1000.0 << " s" << std::endl;
+    }
+
+    if (replay) fclose(replay);
+    if (trace.isOpen()) {
+        trace.close();
+        std::cout << "Trace: " << trace.rowsWritten() << " steps, "
+                  << trace.bytesWritten() << " bytes" << std::endl;
     }
     
+    const DisplayStats& ds = oled.stats();
+    std::cout << "Display: " << ds.transmissions << " transmissions, " << ds.bytes << " bytes, "
+              << ds.pixelsChanged << " pixels changed" << std::endl;
+    printTiming("Total timing", runStart);
+    printf("Bus bytes: i2c %llu, onewire %llu, serial %llu\n",
+           busTotals.bytes[COST_I2C], busTotals.bytes[COST_ONEWIRE], busTotals.bytes[COST_SERIAL]);
+
     std::cout << "\nSimulation complete!" << std::endl;
     return 0;
 }
@@ -3,93 +3,63 @@
 
 #include "Arduino.h"
 #include <cstdint>
+#include <cstring>
 #include <string>
+#include "glcdfont.h"
 
-// Hardware definitions
-#define SCREEN_WIDTH 128
-#define SCREEN_HEIGHT 64
-#define OLED_RESET -1
-#define ONE_WIRE_BUS 14
-
-// Pin definitions
-#define PIN_COMPRESSOR 12
-#define PIN_FAN 2
-#define PIN_DEFROST_VALVE 16
-#define PIN_SUMP_HEATER 0
-#define PIN_COMPRESSOR_HEATER 21
-#define PIN_WATER_PUMP 13
-#define PIN_WATER_VALVE 21
-
-// Temperature thresholds
-#define DELTA_1 1.0
-#define DELTA_2 2.0
-#define DELTA_3 3.0
-#define minSensorTemp -40.0
-#define maxSensorTemp 110.0
-#define startCoolantTemp 35.0
-#define compressorHeaterTemp -5.0
-#define sumpHeaterTemp 5.0
-#define sumpSuctionTemp 5.0
-#define waterTargetTemp 40.0
-#define fanTargetTemp 70.0
-#define heatedAtLeastOnceTemp 66.0
-#define defrostTemp 65.0
-
-// Timing definitions
-#define errorTime 3600000 // 1 hour in milliseconds
-#define compressorDelayTime 30000 // 30 seconds
-#define heatingDelayTime 1200000 // 20 minutes
-
-// SSD1306 definitions
-#define SSD1306_SWITCHCAPVCC 0x2
-
-// State definitions
-#define maxStateIndex 9
-
-// Type definitions
-using String = std::string;
-
-// Struct definitions
-struct TEMPS {
-    float waterIntake;
-    float waterInject;
-    float coolantIntake;
-    float coolantInject;
-    float airOutside;
-    float airInside;
-};
+// Configuration, pins and the TEMPS/DEVICES/ERRORS/STATE structs come from
+// ../src/main.cpp, which the simulator compiles as is.
 
-struct DEVICES {
-    bool compressor;
-    bool fan;
-    bool defrostValve;
-    bool sumpHeater;
-    bool compressorHeater;
-    bool waterPump;
+// Peripheral on the simulated I2C bus.
+class I2CDevice {
+public:
+    virtual ~I2CDevice() {}
+    // One transmission, without the address byte.
+    virtual void receive(const uint8_t* data, size_t n) = 0;
 };
 
-struct ERRORS {
-    bool compressorError;
-    bool defrostError;
-    bool t1Error;
-    bool t2Error;
-    bool t3Error;
-    bool t4Error;
-    bool t5Error;
-    bool t6Error;
-};
+#define BUFFER_LENGTH 32
 
-struct STATE {
-    TEMPS temps;
-    DEVICES devices;
-    ERRORS errors;
-    int millis;
-};
-
-// Mock Wire library
+// Mock Wire library with the AVR 32-byte transmit buffer. Transmissions are
+// delivered to the attached device and charged to the virtual clock.
 class TwoWire {
 public:
-    void begin() { printf("I2C initialized\n"); }
+    TwoWire() : _device(NULL), _address(0), _txAddress(0), _length(0) {}
+    void begin() { if (simVerbose) printf("I2C initialized\n"); }
+    void setClock(uint32_t hz) { busConfig.i2cClockHz = hz; }
+    void beginTransmission(uint8_t address) {
+        _txAddress = address;
+        _length = 0;
+    }
+    size_t write(uint8_t b) {
+        if (_length >= BUFFER_LENGTH) return 0;
+        _buffer[_length++] = b;
+        return 1;
+    }
+    size_t write(const uint8_t* data, size_t n) {
+        size_t written = 0;
+        while (n-- && write(*data++)) written++;
+        return written;
+    }
+    uint8_t endTransmission(bool stop = true) {
+        busI2CTransfer(_length + 1, 1);
+        if (!_device || _txAddress != _address) return 2;     // address NACK
+        _device->receive(_buffer, _length);
+        return 0;
+    }
+
+    // Simulator hook: put a device on the bus.
+    void attach(uint8_t address, I2CDevice* device) {
+        _address = address;
+        _device = device;
+    }
+
+private:
+    I2CDevice* _device;
+    uint8_t _address;
+    uint8_t _txAddress;
+    uint8_t _buffer[BUFFER_LENGTH];
+    size_t _length;
 };
 
 extern TwoWire Wire;
@@ -97,51 +67,130 @@ extern TwoWire Wire;
 // Mock SPI library
 class SPIClass {
 public:
-    void begin() { printf("SPI initialized\n"); }
+    void begin() { if (simVerbose) printf("SPI initialized\n"); }
 };
 
 extern SPIClass SPI;
 
-// Mock Adafruit_GFX
-class Adafruit_GFX {
+// Mock Adafruit_GFX: the classic 5x7 text path of the real library
+class Adafruit_GFX : public Print {
 public:
-    Adafruit_GFX(int16_t w, int16_t h) : WIDTH(w), HEIGHT(h) {}
-    void drawPixel(int16_t x, int16_t y, uint16_t color) {}
-    size_t write(uint8_t c) { putchar(c); return 1; }
+    Adafruit_GFX(int16_t w, int16_t h)
+        : WIDTH(w), HEIGHT(h), _width(w), _height(h), cursor_x(0), cursor_y(0),
+          textcolor(0xFFFF), textbgcolor(0xFFFF), textsize_x(1), textsize_y(1),
+          wrap(true), _cp437(false) {}
+
+    virtual void drawPixel(int16_t x, int16_t y, uint16_t color) = 0;
+
+    virtual void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+        for (int16_t i = x; i < x + w; i++) {
+            for (int16_t j = y; j < y + h; j++) drawPixel(i, j, color);
+        }
+    }
+
+    void drawChar(int16_t x, int16_t y, unsigned char c, uint16_t color, uint16_t bg,
+                  uint8_t size_x, uint8_t size_y) {
+        if (x >= _width || y >= _height || x + 6 * size_x - 1 < 0 || y + 8 * size_y - 1 < 0) return;
+        if (!_cp437 && c >= 176) c++;
+        for (int8_t i = 0; i < 5; i++) {
+            uint8_t line = (c >= GLCDFONT_FIRST && c <= GLCDFONT_LAST)
+                         ? glcdfont[(c - GLCDFONT_FIRST) * 5 + i] : 0;
+            for (int8_t j = 0; j < 8; j++, line >>= 1) {
+                if (line & 1) {
+                    if (size_x == 1 && size_y == 1) drawPixel(x + i, y + j, color);
+                    else fillRect(x + i * size_x, y + j * size_y, size_x, size_y, color);
+                } else if (bg != color) {
+                    if (size_x == 1 && size_y == 1) drawPixel(x + i, y + j, bg);
+                    else fillRect(x + i * size_x, y + j * size_y, size_x, size_y, bg);
+                }
+            }
+        }
+        if (bg != color) fillRect(x + 5 * size_x, y, size_x, 8 * size_y, bg);
+    }
+
+    size_t write(uint8_t c) {
+        if (c == '\n') {
+            cursor_x = 0;
+            cursor_y += textsize_y * 8;
+        } else if (c != '\r') {
+            if (wrap && cursor_x + textsize_x * 6 > _width) {
+                cursor_x = 0;
+                cursor_y += textsize_y * 8;
+            }
+            drawChar(cursor_x, cursor_y, c, textcolor, textbgcolor, textsize_x, textsize_y);
+            cursor_x += textsize_x * 6;
+        }
+        return 1;
+    }
+    using Print::write;
+
+    void setTextSize(uint8_t s) { setTextSize(s, s); }
+    void setTextSize(uint8_t sx, uint8_t sy) {
+        textsize_x = sx > 0 ? sx : 1;
+        textsize_y = sy > 0 ? sy : 1;
+    }
+    void setTextColor(uint16_t c) { textcolor = textbgcolor = c; }
+    void setTextColor(uint16_t c, uint16_t bg) { textcolor = c; textbgcolor = bg; }
+    void setCursor(int16_t x, int16_t y) { cursor_x = x; cursor_y = y; }
+    void setTextWrap(bool w) { wrap = w; }
+    void cp437(bool x = true) { _cp437 = x; }
+    int16_t getCursorX() const { return cursor_x; }
+    int16_t getCursorY() const { return cursor_y; }
+    int16_t width() const { return _width; }
+    int16_t height() const { return _height; }
+
 protected:
-    int16_t WIDTH;
-    int16_t HEIGHT;
+    const int16_t WIDTH;
+    const int16_t HEIGHT;
+    int16_t _width;
+    int16_t _height;
+    int16_t cursor_x;
+    int16_t cursor_y;
+    uint16_t textcolor;
+    uint16_t textbgcolor;
+    uint8_t textsize_x;
+    uint8_t textsize_y;
+    bool wrap;
+    bool _cp437;
 };
 
-// Mock Adafruit_SSD1306
-class Adafruit_SSD1306 : public Adafruit_GFX {
+// Mock EEPROM: the Mega's 4 KB, erased to 0xFF. As in the real library
+// the object is static in the header, and put() only rewrites the bytes
+// that differ.
+class EEPROMClass {
 public:
-    Adafruit_SSD1306(int16_t w, int16_t h, TwoWire* wire, int8_t rst) 
-        : Adafruit_GFX(w, h), _wire(wire), _rst(rst) {}
-    
-    bool begin(uint8_t switchvcc, uint8_t i2caddr) {
-        printf("OLED Display initialized\n");
-        return true;
-    }
-    
-    void display() { printf("Display updated\n"); }
-    void clearDisplay() { printf("Display cleared\n"); }
-    void setTextSize(uint8_t s) {}
-    void setTextColor(uint16_t c) {}
-    void setCursor(int16_t x, int16_t y) {}
-    void cp437(bool x) {}
-    void print(const char* s) { printf("%s", s); }
-    void print(float f) { printf("%f", f); }
-    void print(int i) { printf("%d", i); }
-    void println(const char* s) { printf("%s\n", s); }
-    void println(float f) { printf("%f\n", f); }
-    void println(int i) { printf("%d\n", i); }
-    
+    EEPROMClass() : writes(0) { erase(); }
+    uint8_t read(int idx) { return _data[idx]; }
+    void write(int idx, uint8_t val) {
+        _data[idx] = val;
+        writes++;
+    }
+    void update(int idx, uint8_t val) {
+        if (_data[idx] != val) write(idx, val);
+    }
+    uint16_t length() { return sizeof _data; }
+    template <typename T>
+    T& get(int idx, T& t) {
+        memcpy(&t, _data + idx, sizeof t);
+        return t;
+    }
+    template <typename T>
+    const T& put(int idx, const T& t) {
+        const uint8_t* p = (const uint8_t*)&t;
+        for (size_t i = 0; i < sizeof t; i++) update(idx + i, p[i]);
+        return t;
+    }
+
+    // Simulator hooks: a fresh chip, and the bytes written so far.
+    void erase() { memset(_data, 0xFF, sizeof _data); }
+    unsigned long writes;
+
 private:
-    TwoWire* _wire;
-    int8_t _rst;
+    uint8_t _data[4096];
 };
 
+static EEPROMClass EEPROM;
+
 // Mock DeviceAddress
 typedef uint8_t DeviceAddress[8];
 
@@ -153,16 +202,88 @@ private:
     uint8_t _pin;
 };
 
-// Mock DallasTemperature
+#define DEVICE_DISCONNECTED_C    -127
+#define DEVICE_DISCONNECTED_RAW  -7040
+
+// Mock DallasTemperature. Bus traffic mirrors the real library and is
+// charged to the virtual clock through bus_model.h.
 class DallasTemperature {
 public:
-    DallasTemperature(OneWire* wire) : _wire(wire) {}
-    void begin() { printf("Temperature sensors initialized\n"); }
-    void setResolution(uint8_t* addr, uint8_t res) {}
-    void requestTemperatures() {}
-    float getTempC(uint8_t* addr) { return 25.0; } // Mock temperature
+    DallasTemperature(OneWire* wire) : _wire(wire), _count(0), _wait(true) {}
+    void begin() { if (simVerbose) printf("Temperature sensors initialized\n"); }
+
+    // Write scratchpad (reset, MATCH ROM + address, command + 3 bytes).
+    void setResolution(uint8_t* addr, uint8_t res) {
+        int i = device(addr);
+        if (i >= 0) _resolution[i] = res < 9 ? 9 : res > 12 ? 12 : res;
+        busOneWire(1, 13);
+    }
+
+    // Reset, SKIP ROM, CONVERT T, then wait for the slowest sensor unless
+    // setWaitForConversion(false).
+    void requestTemperatures() {
+        busOneWire(1, 2);
+        if (_wait) busCharge(COST_CONVERSION, ds18b20ConversionUs(getResolution()));
+    }
+
+    void setWaitForConversion(bool wait) { _wait = wait; }
+
+    // Highest resolution on the bus.
+    uint8_t getResolution() {
+        uint8_t res = 9;
+        for (int i = 0; i < _count; i++) {
+            if (_resolution[i] > res) res = _resolution[i];
+        }
+        return res;
+    }
+
+    uint16_t millisToWaitForConversion(uint8_t res) {
+        return (ds18b20ConversionUs(res) + 999) / 1000;
+    }
+
+    // Reset, MATCH ROM + address, READ SCRATCHPAD, 9 bytes, reset.
+    float getTempC(uint8_t* addr) {
+        busOneWire(2, 19);
+        int i = device(addr);
+        return i >= 0 ? _temps[i] : 25.0; // Mock temperature
+    }
+
+    // Same read in the library's raw unit of 1/128 degree. The sensor itself
+    // resolves 1/16 degree, so the value is rounded to that first.
+    int32_t getTemp(const uint8_t* addr) {
+        busOneWire(2, 19);
+        int i = device(addr);
+        float c = i >= 0 ? _temps[i] : 25.0;
+        if (c <= DEVICE_DISCONNECTED_C) return DEVICE_DISCONNECTED_RAW;
+        return (int32_t)lroundf(c * 16.0f) * 8;
+    }
+
+    // Simulator hook: the value the sensor at addr reports from now on.
+    void setTempC(const uint8_t* addr, float temp) {
+        int i = device(addr);
+        if (i >= 0) _temps[i] = temp;
+    }
+
 private:
+    // Sensors appear on the simulated bus the first time they are addressed,
+    // with the DS18B20 power-on resolution of 12 bits.
+    int device(const uint8_t* addr) {
+        for (int i = 0; i < _count; i++) {
+            if (memcmp(_addrs[i], addr, 8) == 0) return i;
+        }
+        if (_count == 8) return -1;
+        memcpy(_addrs[_count], addr, 8);
+        _temps[_count] = 25.0;
+        _resolution[_count] = 12;
+        return _count++;
+    }
+
     OneWire* _wire;
+    uint8_t _addrs[8][8];
+    float _temps[8];
+    uint8_t _resolution[8];
+    int _count;
+    bool _wait;
 };
 
 #endif
@@ -0,0 +1,631 @@
+// Setpoint optimizer: searches SETPOINTS values against a scenario set on
+// the fleet plant and keeps the Pareto set of heat delivered, compressor
+// starts and defrost time among the candidates with no invariant violation.
+//
+// A scenario is one unit of the plant (plant.h) at a fixed outdoor
+// temperature, spread evenly over --air. Every candidate runs the same
+// scenarios from a fresh boot with its setpoints, the controllers taking
+// turns on the firmware code as in fleet.cpp, with InvariantMonitor
+// checking each control step. The firmware is single-instance, so
+// candidates are spread over --jobs worker processes.
+//
+//   ./optimizer --strategy grid                                  # default 3-parameter grid
+//   ./optimizer --strategy random --candidates 200 --jobs 8
+//   ./optimizer --strategy halving --candidates 243 --eta 3 --param defrostStop=0:10:1
+//   ./optimizer --eval pareto/pareto-1.params
+//
+// The Pareto set is written as parameter files: one "name value" line per
+// setpoint in degrees, with its Modbus holding register, for loading onto
+// a unit.
+
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "mock_libraries.h"
+#include "plant.h"
+
+TwoWire Wire;
+SPIClass SPI;
+
+#include "../src/main.cpp"
+#include "invariants.h"
+#include "firmware_state.h"
+
+// SETPOINTS fields in holding register order.
+static const char* const setpointNames[] = {
+    "waterLimit", "fanTarget", "heatedMark", "defrostStart",
+    "defrostStop", "sumpHeaterBelow", "compressorHeaterBelow", "startCoolant",
+};
+
+#define SETPOINT_COUNT (sizeof(SETPOINTS) / sizeof(temp_t))
+static_assert(sizeof setpointNames / sizeof setpointNames[0] == SETPOINT_COUNT, "one name per setpoint");
+
+static temp_t& setpointField(SETPOINTS& s, int field) {
+    return ((temp_t*)&s)[field];
+}
+
+static int findSetpoint(const char* name, size_t len) {
+    for (size_t f = 0; f < SETPOINT_COUNT; f++) {
+        if (strlen(setpointNames[f]) == len && !strncmp(setpointNames[f], name, len)) return f;
+    }
+    return -1;
+}
+
+// One searched setpoint, in degrees.
+struct Param {
+    int field;
+    float lo, hi, step;
+};
+
+enum Strategy { STRATEGY_GRID, STRATEGY_RANDOM, STRATEGY_HALVING };
+
+static const char* const strategyNames[] = {"grid", "random", "halving"};
+
+struct Options {
+    Strategy strategy;
+    std::vector<Param> params;
+    size_t candidates;
+    int eta;
+    double minHours;
+    double hours;
+    int scenarios;
+    float airMin, airMax;
+    unsigned long controlMs;
+    float plantDt;
+    unsigned long long seed;
+    int jobs;
+    const char* out;
+    std::vector<const char*> evalPaths;
+};
+
+// xorshift64*
+struct Rng {
+    unsigned long long s;
+    explicit Rng(unsigned long long seed) : s(seed ? seed : 0x9E3779B97F4A7C15ULL) {}
+    unsigned long long next() {
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return s * 0x2545F4914F6CDD1DULL;
+    }
+    float uniform(float lo, float hi) { return lo + (hi - lo) * (float)(next() >> 40) / (float)(1 << 24); }
+};
+
+// Per scenario-hour, averaged over the scenario set.
+struct Score {
+    double heat;                // tank degrees delivered
+    double starts;              // compressor starts
+    double defrostPct;          // share of the time defrosting
+    unsigned long violations;   // invariant violations, all scenarios
+    int inError;                // scenarios ending with an error latched
+};
+
+struct Candidate {
+    SETPOINTS setpoints;
+    Score score;
+};
+
+// --- evaluation ------------------------------------------------------------
+
+static Score evaluate(const SETPOINTS& candidate, const Options& opt, double hours) {
+    PlantParams params = defaultPlantParams();
+    PlantKernel kernel = plantSelectKernel(PLANT_KERNEL_AUTO);
+    PlantFleet fleet;
+    Score score = Score();
+    if (!plantAlloc(fleet, opt.scenarios)) return score;
+    for (size_t i = 0; i < fleet.capacity; i++) {
+        int k = i < fleet.count ? (int)i : 0;
+        fleet.airOutside[i] = opt.scenarios > 1
+            ? opt.airMin + (opt.airMax - opt.airMin) * k / (opt.scenarios - 1) : opt.airMin;
+        fleet.airInside[i] = 20.0f;
+        fleet.tankLoss[i] = 1e-5f;
+    }
+    plantSettle(fleet);
+
+    resetController();
+    setpoints = candidate;
+    ControllerState booted;
+    saveController(booted);
+    std::vector<ControllerState> controllers(fleet.count, booted);
+    std::vector<InvariantMonitor> monitors(fleet.count);
+    for (size_t i = 0; i < fleet.count; i++) monitors[i].reset();
+
+    int plantSteps = std::max(1L, lround(opt.controlMs / 1000.0 / opt.plantDt));
+    float roundSeconds = plantSteps * opt.plantDt;
+    unsigned long long rounds = (unsigned long long)(hours * 3600000.0 / opt.controlMs);
+    unsigned long long now = simMicros();
+    unsigned long long starts = 0, defrostRounds = 0;
+    double heat = 0;
+    std::vector<float> tankBefore(fleet.count);
+
+    for (unsigned long long round = 0; round < rounds; round++) {
+        now += opt.controlMs * 1000ULL;
+        for (size_t i = 0; i < fleet.count; i++) {
+            simSetMicros(now);
+            loadController(controllers[i]);
+            float temps[6];
+            plantReadings(fleet, i, temps);
+            setReadings(temps);
+            checkTemps(t);
+            controlStep();
+            if (monitors[i].check() != INV_OK) {
+                score.violations++;
+                monitors[i].reset();
+            }
+            saveController(controllers[i]);
+
+            starts += isCompressorStarted && fleet.compressorOn[i] == 0;
+            defrostRounds += isDefrostStarted;
+            fleet.compressorOn[i] = isCompressorStarted;
+            fleet.fanOn[i] = fanDuty / (float)FAN_DUTY_MAX;
+            fleet.defrostOn[i] = isDefrostStarted;
+            fleet.pumpOn[i] = pumpDuty / (float)PUMP_DUTY_MAX;
+            fleet.waterValveOn[i] = isWaterValveStarted;
+            tankBefore[i] = fleet.tank[i];
+        }
+        plantStep(fleet, params, opt.plantDt, plantSteps, kernel);
+        // Heat into the tank: its rise plus what it lost meanwhile.
+        for (size_t i = 0; i < fleet.count; i++) {
+            heat += fleet.tank[i] - tankBefore[i]
+                  + fleet.tankLoss[i] * (tankBefore[i] - fleet.airInside[i]) * roundSeconds;
+        }
+    }
+
+    for (size_t i = 0; i < fleet.count; i++) {
+        const ControllerState& c = controllers[i];
+        score.inError += c.compressorError || c.defrostError || c.t1Error || c.t2Error || c.t3Error
+                         || c.t4Error || c.t5Error;
+    }
+    double scenarioHours = hours * fleet.count;
+    if (rounds) {
+        score.heat = heat / scenarioHours;
+        score.starts = starts / scenarioHours;
+        score.defrostPct = 100.0 * defrostRounds / (rounds * fleet.count);
+    }
+    plantFree(fleet);
+    return score;
+}
+
+// Scores the candidates in --jobs processes, job j taking every
+// jobs-th candidate and sending back (index, Score) records on a pipe.
+static bool evaluateAll(std::vector<Candidate>& candidates, const Options& opt, double hours) {
+    if (opt.jobs <= 1) {
+        for (size_t i = 0; i < candidates.size(); i++) {
+            candidates[i].score = evaluate(candidates[i].setpoints, opt, hours);
+        }
+        return true;
+    }
+
+    fflush(stdout);
+    std::vector<int> pipes;
+    for (int j = 0; j < opt.jobs; j++) {
+        int fd[2];
+        if (pipe(fd) != 0) {
+            perror("pipe");
+            return false;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fd[0]);
+            for (size_t i = j; i < candidates.size(); i += opt.jobs) {
+                struct { size_t index; Score score; } record = {i, evaluate(candidates[i].setpoints, opt, hours)};
+                if (write(fd[1], &record, sizeof record) != sizeof record) _exit(1);
+            }
+            _exit(0);
+        }
+        if (pid < 0) {
+            perror("fork");
+            return false;
+        }
+        close(fd[1]);
+        pipes.push_back(fd[0]);
+    }
+
+    size_t received = 0;
+    for (size_t j = 0; j < pipes.size(); j++) {
+        struct { size_t index; Score score; } record;
+        ssize_t n;
+        while ((n = read(pipes[j], &record, sizeof record)) == sizeof record) {
+            if (record.index < candidates.size()) candidates[record.index].score = record.score;
+            received++;
+        }
+        close(pipes[j]);
+    }
+    int status;
+    while (wait(&status) > 0) {}
+    if (received != candidates.size()) {
+        fprintf(stderr, "only %zu of %zu candidates came back from the workers\n", received, candidates.size());
+        return false;
+    }
+    return true;
+}
+
+// --- Pareto set ------------------------------------------------------------
+
+// More heat, fewer starts, less defrost time.
+static bool dominates(const Score& a, const Score& b) {
+    bool noWorse = a.heat >= b.heat && a.starts <= b.starts && a.defrostPct <= b.defrostPct;
+    bool better = a.heat > b.heat || a.starts < b.starts || a.defrostPct < b.defrostPct;
+    return noWorse && better;
+}
+
+static bool feasible(const Score& s) {
+    return s.violations == 0;
+}
+
+// Non-dominated rank of every candidate: 0 for the Pareto set, 1 for the
+// set once those are removed, and so on. Candidates with violations rank
+// behind all feasible ones.
+static std::vector<int> paretoRanks(const std::vector<Candidate>& c) {
+    std::vector<int> rank(c.size(), -1);
+    size_t assigned = 0;
+    for (int r = 0; assigned < c.size(); r++) {
+        bool anyFeasible = false;
+        for (size_t i = 0; i < c.size(); i++) anyFeasible |= rank[i] < 0 && feasible(c[i].score);
+        std::vector<size_t> front;
+        for (size_t i = 0; i < c.size(); i++) {
+            if (rank[i] >= 0 || (anyFeasible && !feasible(c[i].score))) continue;
+            bool dominated = false;
+            for (size_t k = 0; k < c.size() && !dominated; k++) {
+                if (k == i || rank[k] >= 0 || (anyFeasible && !feasible(c[k].score))) continue;
+                dominated = dominates(c[k].score, c[i].score);
+            }
+            if (!dominated) front.push_back(i);
+        }
+        for (size_t k = 0; k < front.size(); k++) rank[front[k]] = r;
+        assigned += front.size();
+    }
+    return rank;
+}
+
+// Candidates ordered by rank, then by heat.
+static void sortByRank(std::vector<Candidate>& c) {
+    std::vector<int> rank = paretoRanks(c);
+    std::vector<size_t> order(c.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (rank[a] != rank[b]) return rank[a] < rank[b];
+        return c[a].score.heat > c[b].score.heat;
+    });
+    std::vector<Candidate> sorted;
+    for (size_t i = 0; i < order.size(); i++) sorted.push_back(c[order[i]]);
+    c.swap(sorted);
+}
+
+// --- candidates --------------------------------------------------------------
+
+static temp_t toTemp(float c) {
+    return (temp_t)lroundf(c * 16.0f);
+}
+
+static float snap(const Param& p, float value) {
+    if (p.step <= 0) return value;
+    float k = floorf((value - p.lo) / p.step + 0.5f);
+    return std::min(p.hi, p.lo + k * p.step);
+}
+
+static void gridCandidates(const Options& opt, std::vector<Candidate>& out) {
+    std::vector<int> counts, index(opt.params.size(), 0);
+    for (size_t k = 0; k < opt.params.size(); k++) {
+        const Param& p = opt.params[k];
+        counts.push_back(p.step > 0 ? (int)floorf((p.hi - p.lo) / p.step + 1e-3f) + 1 : 1);
+    }
+    for (;;) {
+        Candidate c = Candidate();
+        c.setpoints = defaultSetpoints;
+        for (size_t k = 0; k < opt.params.size(); k++) {
+            const Param& p = opt.params[k];
+            setpointField(c.setpoints, p.field) = toTemp(p.lo + index[k] * p.step);
+        }
+        out.push_back(c);
+        size_t k = 0;
+        while (k < index.size() && ++index[k] == counts[k]) index[k++] = 0;
+        if (k == index.size()) break;
+    }
+}
+
+static void randomCandidates(const Options& opt, std::vector<Candidate>& out) {
+    Rng rng(opt.seed);
+    for (size_t i = 0; i < opt.candidates; i++) {
+        Candidate c = Candidate();
+        c.setpoints = defaultSetpoints;
+        for (size_t k = 0; k < opt.params.size(); k++) {
+            const Param& p = opt.params[k];
+            setpointField(c.setpoints, p.field) = toTemp(snap(p, rng.uniform(p.lo, p.hi)));
+        }
+        out.push_back(c);
+    }
+}
+
+// Summed distance from the factory setpoints, in 1/16 degrees.
+static long fromFactory(const SETPOINTS& s) {
+    long d = 0;
+    for (size_t k = 0; k < SETPOINT_COUNT; k++) {
+        d += labs((long)((const temp_t*)&s)[k] - ((const temp_t*)&defaultSetpoints)[k]);
+    }
+    return d;
+}
+
+// --- parameter files ---------------------------------------------------------
+
+static bool writeParams(const char* path, const Candidate& c, int rank) {
+    FILE* f = fopen(path, "w");
+    if (!f) return false;
+    fprintf(f, "# Pareto candidate %d: heat %.3f K/h, %.2f starts/h, defrost %.2f%%, %d scenarios in error\n",
+            rank, c.score.heat, c.score.starts, c.score.defrostPct, c.score.inError);
+    fprintf(f, "# name value_degC   (Modbus holding register, value x16)\n");
+    for (size_t k = 0; k < SETPOINT_COUNT; k++) {
+        temp_t v = setpointField(const_cast<SETPOINTS&>(c.setpoints), k);
+        fprintf(f, "%-22s %7.2f   # reg %zu = %d\n", setpointNames[k], v / 16.0, k, v);
+    }
+    return fclose(f) == 0;
+}
+
+// Removes the pareto-*.params an earlier run left in `dir`, so a smaller
+// front does not leave stale candidates next to the new ones.
+static bool clearParams(const char* dir) {
+    DIR* d = opendir(dir);
+    if (!d) {
+        perror(dir);
+        return false;
+    }
+    bool ok = true;
+    while (struct dirent* e = readdir(d)) {
+        size_t len = strlen(e->d_name);
+        if (strncmp(e->d_name, "pareto-", 7) || len < 14 || strcmp(e->d_name + len - 7, ".params")) continue;
+        std::string path = std::string(dir) + "/" + e->d_name;
+        if (unlink(path.c_str()) != 0) {
+            perror(path.c_str());
+            ok = false;
+        }
+    }
+    closedir(d);
+    return ok;
+}
+
+// Setpoints missing from the file keep their factory values.
+static bool readParams(const char* path, SETPOINTS& s) {
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+    s = defaultSetpoints;
+    char line[256];
+    bool ok = true;
+    while (ok && fgets(line, sizeof line, f)) {
+        char* hash = strchr(line, '#');
+        if (hash) *hash = 0;
+        char name[64];
+        float value;
+        int fields = sscanf(line, "%63s %f", name, &value);
+        if (fields <= 0) continue;
+        int field = findSetpoint(name, strlen(name));
+        ok = fields == 2 && field >= 0;
+        if (ok) setpointField(s, field) = toTemp(value);
+    }
+    fclose(f);
+    return ok;
+}
+
+// --- main --------------------------------------------------------------------
+
+static void printCandidate(const Candidate& c, const Options& opt) {
+    for (size_t k = 0; k < opt.params.size(); k++) {
+        printf(" %7.2f", setpointField(const_cast<SETPOINTS&>(c.setpoints), opt.params[k].field) / 16.0);
+    }
+    printf(" | %8.3f %8.2f %8.2f %5lu %5d\n", c.score.heat, c.score.starts, c.score.defrostPct,
+           c.score.violations, c.score.inError);
+}
+
+static void printHeader(const Options& opt) {
+    for (size_t k = 0; k < opt.params.size(); k++) {
+        const char* name = setpointNames[opt.params[k].field];
+        printf(" %7.7s", name);
+    }
+    printf(" | %8s %8s %8s %5s %5s\n", "heat K/h", "starts/h", "defrost%", "viol", "error");
+}
+
+static bool parseParam(const char* arg, Param& p) {
+    const char* eq = strchr(arg, '=');
+    if (!eq) return false;
+    p.field = findSetpoint(arg, eq - arg);
+    p.step = 0;
+    int n = sscanf(eq + 1, "%f:%f:%f", &p.lo, &p.hi, &p.step);
+    return p.field >= 0 && n >= 2 && p.lo <= p.hi && p.step >= 0;
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [--strategy grid|random|halving] [--param NAME=LO:HI[:STEP]]...\n"
+            "          [--candidates N] [--eta N] [--min-hours H] [--hours H] [--scenarios N]\n"
+            "          [--air LO,HI] [--control-ms MS] [--plant-dt S] [--seed N] [--jobs N]\n"
+            "          [--out DIR] [--eval FILE]...\n"
+            "  --strategy S       grid over the steps, random draws, or successive halving\n"
+            "                     of random draws (default grid)\n"
+            "  --param P          searched setpoint in degrees (default fanTarget=62:78:2,\n"
+            "                     heatedMark=58:74:2, defrostStart=57:73:2); others stay at\n"
+            "                     their factory values\n"
+            "  --candidates N     random and halving draws (default 64)\n"
+            "  --eta N            halving keeps 1/N per rung (default 3)\n"
+            "  --min-hours H      halving budget of the first rung (default 1)\n"
+            "  --hours H          simulated hours per scenario (default 12)\n"
+            "  --scenarios N      units, outdoor air spread over --air (default 6)\n"
+            "  --air LO,HI        outdoor air range (default -20,10)\n"
+            "  --jobs N           worker processes (default: online CPUs)\n"
+            "  --out DIR          where the Pareto parameter files go (default pareto)\n"
+            "  --eval FILE        score parameter files instead of searching\n",
+            argv0);
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    opt.strategy = STRATEGY_GRID;
+    opt.candidates = 64;
+    opt.eta = 3;
+    opt.minHours = 1;
+    opt.hours = 12;
+    opt.scenarios = 6;
+    opt.airMin = -20;
+    opt.airMax = 10;
+    opt.controlMs = 700;
+    opt.plantDt = 0.1f;
+    opt.seed = 1;
+    opt.jobs = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+    opt.out = "pareto";
+
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        Param p;
+        if (!strcmp(argv[i], "--strategy") && more) {
+            const char* name = argv[++i];
+            int s = 0;
+            while (s <= STRATEGY_HALVING && strcmp(strategyNames[s], name)) s++;
+            if (s > STRATEGY_HALVING) {
+                usage(argv[0]);
+                return 2;
+            }
+            opt.strategy = (Strategy)s;
+        }
+        else if (!strcmp(argv[i], "--param") && more && parseParam(argv[i + 1], p)) {
+            opt.params.push_back(p);
+            i++;
+        }
+        else if (!strcmp(argv[i], "--candidates") && more) opt.candidates = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--eta") && more) opt.eta = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--min-hours") && more) opt.minHours = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--hours") && more) opt.hours = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--scenarios") && more) opt.scenarios = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--air") && more && sscanf(argv[i + 1], "%f,%f", &opt.airMin, &opt.airMax) == 2) i++;
+        else if (!strcmp(argv[i], "--control-ms") && more) opt.controlMs = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--plant-dt") && more) opt.plantDt = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && more) opt.seed = strtoull(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--jobs") && more) opt.jobs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--out") && more) opt.out = argv[++i];
+        else if (!strcmp(argv[i], "--eval") && more) opt.evalPaths.push_back(argv[++i]);
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (opt.jobs < 1 || opt.scenarios < 1 || opt.hours <= 0 || opt.eta < 2 || opt.minHours <= 0
+        || !opt.controlMs || opt.plantDt <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (opt.params.empty()) {
+        const char* defaults[] = {"fanTarget=62:78:2", "heatedMark=58:74:2", "defrostStart=57:73:2"};
+        for (size_t k = 0; k < 3; k++) {
+            Param p;
+            parseParam(defaults[k], p);
+            opt.params.push_back(p);
+        }
+    }
+
+    simVerbose = false;
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<Candidate> candidates;
+
+    if (!opt.evalPaths.empty()) {
+        opt.params.clear();
+        for (size_t k = 0; k < SETPOINT_COUNT; k++) opt.params.push_back(Param{(int)k, 0, 0, 0});
+        for (size_t i = 0; i < opt.evalPaths.size(); i++) {
+            Candidate c = Candidate();
+            if (!readParams(opt.evalPaths[i], c.setpoints)) {
+                fprintf(stderr, "%s: cannot read parameter file\n", opt.evalPaths[i]);
+                return 1;
+            }
+            candidates.push_back(c);
+        }
+        if (!evaluateAll(candidates, opt, opt.hours)) return 1;
+        printHeader(opt);
+        for (size_t i = 0; i < candidates.size(); i++) printCandidate(candidates[i], opt);
+        return 0;
+    }
+
+    // The factory setpoints compete too, as the reference.
+    Candidate factory = Candidate();
+    factory.setpoints = defaultSetpoints;
+    candidates.push_back(factory);
+    if (opt.strategy == STRATEGY_GRID) gridCandidates(opt, candidates);
+    else randomCandidates(opt, candidates);
+
+    printf("%s search, %zu candidates, %d scenarios at %.1f..%.1f C, %d jobs\n",
+           strategyNames[opt.strategy], candidates.size(), opt.scenarios, opt.airMin, opt.airMax, opt.jobs);
+
+    if (opt.strategy == STRATEGY_HALVING) {
+        // Rungs from opt.minHours up to opt.hours, eta times longer each;
+        // every rung keeps the best 1/eta by Pareto rank, then heat.
+        std::vector<double> budgets;
+        for (double h = opt.hours; h >= opt.minHours || budgets.empty(); h /= opt.eta) budgets.push_back(h);
+        std::reverse(budgets.begin(), budgets.end());
+        for (size_t r = 0; r < budgets.size(); r++) {
+            if (!evaluateAll(candidates, opt, budgets[r])) return 1;
+            printf("rung %zu: %zu candidates at %.2f h\n", r, candidates.size(), budgets[r]);
+            if (r + 1 == budgets.size()) break;
+            sortByRank(candidates);
+            candidates.resize(std::max<size_t>(1, (candidates.size() + opt.eta - 1) / opt.eta));
+        }
+    } else if (!evaluateAll(candidates, opt, opt.hours)) {
+        return 1;
+    }
+
+    std::vector<int> rank = paretoRanks(candidates);
+    std::vector<Candidate> front;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        if (rank[i] == 0 && feasible(candidates[i].score)) front.push_back(candidates[i]);
+    }
+    // Of candidates that score the same, keep the one closest to factory.
+    std::sort(front.begin(), front.end(), [](const Candidate& a, const Candidate& b) {
+        if (a.score.heat != b.score.heat) return a.score.heat > b.score.heat;
+        if (a.score.starts != b.score.starts) return a.score.starts < b.score.starts;
+        if (a.score.defrostPct != b.score.defrostPct) return a.score.defrostPct < b.score.defrostPct;
+        return fromFactory(a.setpoints) < fromFactory(b.setpoints);
+    });
+    front.erase(std::unique(front.begin(), front.end(), [](const Candidate& a, const Candidate& b) {
+        return a.score.heat == b.score.heat && a.score.starts == b.score.starts
+               && a.score.defrostPct == b.score.defrostPct;
+    }), front.end());
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("%.1f s\n\n", elapsed);
+    printHeader(opt);
+    // Halving may have dropped the factory setpoints on the way.
+    for (size_t i = 0; i < candidates.size(); i++) {
+        if (memcmp(&candidates[i].setpoints, &defaultSetpoints, sizeof(SETPOINTS)) == 0) {
+            printf("factory:\n");
+            printCandidate(candidates[i], opt);
+            break;
+        }
+    }
+    printf("Pareto set (%zu):\n", front.size());
+    if (front.empty()) {
+        printf("no candidate ran without an invariant violation\n");
+        return 1;
+    }
+
+    if (mkdir(opt.out, 0777) != 0 && errno != EEXIST) {
+        perror(opt.out);
+        return 1;
+    }
+    if (!clearParams(opt.out)) return 1;
+    for (size_t i = 0; i < front.size(); i++) {
+        printCandidate(front[i], opt);
+        std::string path = std::string(opt.out) + "/pareto-" + std::to_string(i + 1) + ".params";
+        if (!writeParams(path.c_str(), front[i], i + 1)) {
+            perror(path.c_str());
+            return 1;
+        }
+    }
+    printf("parameter files in %s/\n", opt.out);
+    return 0;
+}
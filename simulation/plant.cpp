@@ -0,0 +1,139 @@
+#include "plant.h"
+#include <stdlib.h>
+#include <string.h>
+#include "plant_kernel.h"
+
+bool plantStepSse(const PlantFleet& fleet, const PlantCoeffs& c, int steps);
+bool plantStepAvx2(const PlantFleet& fleet, const PlantCoeffs& c, int steps);
+
+const char* const plantKernelNames[] = {"auto", "scalar", "sse", "avx2"};
+const char* const plantArrayNames[PLANT_ARRAYS] = {
+    "tank", "supply", "suction", "discharge", "frost", "dhwTank",
+    "airOutside", "airInside", "tankLoss", "dhwLoss",
+    "compressorOn", "fanOn", "defrostOn", "pumpOn", "waterValveOn",
+};
+
+PlantParams defaultPlantParams() {
+    PlantParams p;
+    p.suctionLift = 8.0f;
+    p.starvedLift = 10.0f;
+    p.defrostLift = 25.0f;
+    p.dischargeLift = 45.0f;
+    p.defrostLoss = 20.0f;
+    p.slowFanDrop = 20.0f;
+    p.suctionTau = 60.0f;
+    p.dischargeTau = 60.0f;
+    p.supplyTau = 20.0f;
+    p.condRate = 0.0004f;
+    p.supplyRise = 400.0f;
+    p.frostRate = 0.00002f;
+    p.meltRate = 0.0002f;
+    p.frostPenalty = 0.5f;
+    return p;
+}
+
+namespace {
+
+struct ScalarOps {
+    typedef float type;
+    enum { width = 1 };
+    static type set1(float v) { return v; }
+    static type load(const float* p) { return *p; }
+    static void store(float* p, type v) { *p = v; }
+    static type add(type a, type b) { return a + b; }
+    static type sub(type a, type b) { return a - b; }
+    static type mul(type a, type b) { return a * b; }
+    static type div(type a, type b) { return a / b; }
+    static type max(type a, type b) { return a > b ? a : b; }     // same NaN rule as maxps
+};
+
+}
+
+bool plantAlloc(PlantFleet& fleet, size_t count) {
+    memset(&fleet, 0, sizeof fleet);
+    size_t capacity = (count + PLANT_LANES - 1) / PLANT_LANES * PLANT_LANES;
+    void* block = NULL;
+    if (!capacity || posix_memalign(&block, 32, PLANT_ARRAYS * capacity * sizeof(float))) return false;
+
+    float* p = (float*)block;
+    float** arrays[PLANT_ARRAYS] = {
+        &fleet.tank, &fleet.supply, &fleet.suction, &fleet.discharge, &fleet.frost, &fleet.dhwTank,
+        &fleet.airOutside, &fleet.airInside, &fleet.tankLoss, &fleet.dhwLoss,
+        &fleet.compressorOn, &fleet.fanOn, &fleet.defrostOn, &fleet.pumpOn, &fleet.waterValveOn,
+    };
+    for (int a = 0; a < PLANT_ARRAYS; a++) *arrays[a] = p + a * capacity;
+    memset(block, 0, PLANT_ARRAYS * capacity * sizeof(float));
+    fleet.count = count;
+    fleet.capacity = capacity;
+    return true;
+}
+
+void plantArrays(const PlantFleet& fleet, float* arrays[PLANT_ARRAYS]) {
+    float* all[PLANT_ARRAYS] = {
+        fleet.tank, fleet.supply, fleet.suction, fleet.discharge, fleet.frost, fleet.dhwTank,
+        fleet.airOutside, fleet.airInside, fleet.tankLoss, fleet.dhwLoss,
+        fleet.compressorOn, fleet.fanOn, fleet.defrostOn, fleet.pumpOn, fleet.waterValveOn,
+    };
+    memcpy(arrays, all, sizeof all);
+}
+
+void plantFree(PlantFleet& fleet) {
+    free(fleet.tank);       // start of the block
+    memset(&fleet, 0, sizeof fleet);
+}
+
+void plantSettle(PlantFleet& fleet) {
+    for (size_t i = 0; i < fleet.capacity; i++) {
+        fleet.tank[i] = fleet.supply[i] = fleet.discharge[i] = fleet.dhwTank[i] = fleet.airInside[i];
+        fleet.suction[i] = fleet.airOutside[i];
+        fleet.frost[i] = 0;
+        fleet.compressorOn[i] = fleet.fanOn[i] = fleet.defrostOn[i] = fleet.pumpOn[i] = fleet.waterValveOn[i] = 0;
+    }
+}
+
+PlantKernel plantSelectKernel(PlantKernel wanted) {
+#if defined(__x86_64__) || defined(__i386__)
+    bool sse = __builtin_cpu_supports("sse2");
+    bool avx2 = __builtin_cpu_supports("avx2");
+#else
+    bool sse = false;
+    bool avx2 = false;
+#endif
+    // Probe the kernels that were actually compiled in.
+    PlantFleet empty;
+    memset(&empty, 0, sizeof empty);
+    PlantCoeffs c = plantCoeffs(defaultPlantParams(), 1.0f);
+    sse = sse && plantStepSse(empty, c, 0);
+    avx2 = avx2 && plantStepAvx2(empty, c, 0);
+
+    switch (wanted) {
+        case PLANT_KERNEL_SCALAR: return PLANT_KERNEL_SCALAR;
+        case PLANT_KERNEL_SSE: return sse ? PLANT_KERNEL_SSE : PLANT_KERNEL_SCALAR;
+        case PLANT_KERNEL_AVX2: return avx2 ? PLANT_KERNEL_AVX2 : sse ? PLANT_KERNEL_SSE : PLANT_KERNEL_SCALAR;
+        default: return avx2 ? PLANT_KERNEL_AVX2 : sse ? PLANT_KERNEL_SSE : PLANT_KERNEL_SCALAR;
+    }
+}
+
+void plantStep(PlantFleet& fleet, const PlantParams& params, float dt, int steps, PlantKernel kernel) {
+    PlantCoeffs c = plantCoeffs(params, dt);
+    switch (kernel) {
+        case PLANT_KERNEL_AVX2:
+            if (plantStepAvx2(fleet, c, steps)) return;
+            break;
+        case PLANT_KERNEL_SSE:
+            if (plantStepSse(fleet, c, steps)) return;
+            break;
+        default:
+            break;
+    }
+    plantKernel<ScalarOps>(fleet, c, steps);
+}
+
+void plantReadings(const PlantFleet& fleet, size_t i, float temps[6]) {
+    temps[0] = fleet.tank[i];           // waterIntake: return from the tank
+    temps[1] = fleet.supply[i];         // waterInject
+    temps[2] = fleet.suction[i];        // coolantIntake
+    temps[3] = fleet.discharge[i];      // coolantInject
+    temps[4] = fleet.airOutside[i];
+    temps[5] = fleet.dhwTank[i];
+}
@@ -0,0 +1,97 @@
+#ifndef PLANT_H
+#define PLANT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Lumped thermal model of many heat-pump units, stored structure-of-arrays
+// so one kernel call steps every unit with SIMD.
+//
+// Per unit: water tank, supply (T2), suction (T3) and discharge (T4)
+// refrigerant temperatures, frost on the evaporator, and a DHW tank (T6)
+// that takes the condenser heat while the diverter valve is on. The relays the
+// controller drives are inputs; outdoor/indoor air and tank losses are
+// per-unit parameters. Every array is padded to a multiple of
+// PLANT_LANES and 32-byte aligned; padding units are simulated but never
+// reported.
+
+#define PLANT_LANES 8
+#define PLANT_ARRAYS 15
+#define PLANT_MIN_FLOW 0.0625f     // pumpOn below this heats as if it were this
+
+struct PlantParams {
+    float suctionLift;      // evaporating below outdoor air with the compressor on
+    float starvedLift;      // extra drop with the fan off or the coil frosted
+    float defrostLift;      // suction rise while hot gas goes through the coil
+    float dischargeLift;    // discharge above the tank with the compressor on
+    float slowFanDrop;      // discharge drop with the fan off, less as it speeds up
+    float defrostLoss;      // discharge drop while defrosting
+    float suctionTau;       // s
+    float dischargeTau;     // s
+    float supplyTau;        // s
+    float condRate;         // 1/s, tank heating per degree of discharge over tank
+    float supplyRise;       // supply over tank per (deg/s) of heating, at full flow
+    float frostRate;        // frost per second per degree below zero on the coil
+    float meltRate;         // frost melted per second per degree above zero while defrosting
+    float frostPenalty;     // evaporator capacity lost per unit of frost
+};
+
+// Built-in constants for a small air-to-water unit.
+PlantParams defaultPlantParams();
+
+struct PlantFleet {
+    size_t count;           // units in use
+    size_t capacity;        // count rounded up to PLANT_LANES
+
+    // State.
+    float* tank;
+    float* supply;
+    float* suction;
+    float* discharge;
+    float* frost;
+    float* dhwTank;
+
+    // Per-unit parameters.
+    float* airOutside;
+    float* airInside;
+    float* tankLoss;        // 1/s towards airInside
+    float* dhwLoss;         // 1/s towards airInside, standing loss and draw-off
+
+    // Relays, 0 or 1; fanOn and pumpOn are fan speed and pump flow, 0 to 1.
+    float* compressorOn;
+    float* fanOn;
+    float* defrostOn;
+    float* pumpOn;
+    float* waterValveOn;    // heat to the DHW tank instead of the heating tank
+};
+
+enum PlantKernel {
+    PLANT_KERNEL_AUTO = 0,
+    PLANT_KERNEL_SCALAR,
+    PLANT_KERNEL_SSE,
+    PLANT_KERNEL_AVX2,
+};
+
+extern const char* const plantKernelNames[];
+extern const char* const plantArrayNames[PLANT_ARRAYS];
+
+bool plantAlloc(PlantFleet& fleet, size_t count);
+void plantFree(PlantFleet& fleet);
+
+// Every per-unit array of `fleet`, in plantArrayNames order.
+void plantArrays(const PlantFleet& fleet, float* arrays[PLANT_ARRAYS]);
+
+// Every unit at rest in its surroundings: tanks and refrigerant at indoor
+// air, coil at outdoor air, no frost, relays off.
+void plantSettle(PlantFleet& fleet);
+
+// The widest kernel this CPU runs, or `wanted` if it is available.
+PlantKernel plantSelectKernel(PlantKernel wanted);
+
+// Advances every unit by `steps` steps of `dt` seconds with the relays held.
+void plantStep(PlantFleet& fleet, const PlantParams& params, float dt, int steps, PlantKernel kernel);
+
+// The six sensor readings of unit i in TEMPS order, in degrees.
+void plantReadings(const PlantFleet& fleet, size_t i, float temps[6]);
+
+#endif
@@ -0,0 +1,37 @@
+// Built with -mavx2 (see Makefile); only called once plantSelectKernel()
+// has seen AVX2 on the running CPU.
+
+#include "plant_kernel.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+namespace {
+
+struct Avx2Ops {
+    typedef __m256 type;
+    enum { width = 8 };
+    static type set1(float v) { return _mm256_set1_ps(v); }
+    static type load(const float* p) { return _mm256_load_ps(p); }
+    static void store(float* p, type v) { _mm256_store_ps(p, v); }
+    static type add(type a, type b) { return _mm256_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+    static type div(type a, type b) { return _mm256_div_ps(a, b); }
+    static type max(type a, type b) { return _mm256_max_ps(a, b); }
+};
+
+}
+
+bool plantStepAvx2(const PlantFleet& fleet, const PlantCoeffs& c, int steps) {
+    plantKernel<Avx2Ops>(fleet, c, steps);
+    return true;
+}
+
+#else
+
+bool plantStepAvx2(const PlantFleet&, const PlantCoeffs&, int) {
+    return false;
+}
+
+#endif
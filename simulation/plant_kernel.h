@@ -0,0 +1,136 @@
+#ifndef PLANT_KERNEL_H
+#define PLANT_KERNEL_H
+
+// The plant equations, written once against a small vector interface V and
+// instantiated per instruction set in plant.cpp, plant_sse.cpp and
+// plant_avx2.cpp. V provides type, width, set1, load, store, add, sub, mul,
+// div and max. Everything is internal linkage so the copies compiled with
+// different -m flags never meet at link time.
+//
+// Each vector of units keeps its state in registers for all `steps`, and
+// the relay terms are folded once per call since the controller only acts
+// between calls. No fused multiply-add anywhere: the kernels stay bit-exact
+// with the scalar one.
+
+#include "plant.h"
+
+struct PlantCoeffs {
+    float aSuction, aDischarge, aSupply;    // dt / tau
+    float condA;                            // condRate * dt
+    float supplyRise;                       // supplyRise / dt
+    float frostA, meltA;                    // rates * dt
+    float frostPenalty;
+    float suctionLift, starvedLift, defrostLift;
+    float dischargeLift, defrostLoss, slowFanDrop;
+    float dt;
+};
+
+static inline PlantCoeffs plantCoeffs(const PlantParams& p, float dt) {
+    PlantCoeffs c;
+    c.aSuction = dt / p.suctionTau;
+    c.aDischarge = dt / p.dischargeTau;
+    c.aSupply = dt / p.supplyTau;
+    c.condA = p.condRate * dt;
+    c.supplyRise = p.supplyRise / dt;
+    c.frostA = p.frostRate * dt;
+    c.meltA = p.meltRate * dt;
+    c.frostPenalty = p.frostPenalty;
+    c.suctionLift = p.suctionLift;
+    c.starvedLift = p.starvedLift;
+    c.defrostLift = p.defrostLift;
+    c.dischargeLift = p.dischargeLift;
+    c.defrostLoss = p.defrostLoss;
+    c.slowFanDrop = p.slowFanDrop;
+    c.dt = dt;
+    return c;
+}
+
+template <class V>
+static inline void plantKernel(const PlantFleet& f, const PlantCoeffs& c, int steps) {
+    typedef typename V::type T;
+    const T zero = V::set1(0.0f);
+    const T one = V::set1(1.0f);
+    const T aSuction = V::set1(c.aSuction);
+    const T aDischarge = V::set1(c.aDischarge);
+    const T aSupply = V::set1(c.aSupply);
+    const T supplyRise = V::set1(c.supplyRise);
+    const T frostPenalty = V::set1(c.frostPenalty);
+    const T dt = V::set1(c.dt);
+
+    for (size_t i = 0; i < f.capacity; i += V::width) {
+        T tank = V::load(f.tank + i);
+        T supply = V::load(f.supply + i);
+        T suction = V::load(f.suction + i);
+        T discharge = V::load(f.discharge + i);
+        T frost = V::load(f.frost + i);
+        T dhw = V::load(f.dhwTank + i);
+        const T airOutside = V::load(f.airOutside + i);
+        const T airInside = V::load(f.airInside + i);
+        const T lossA = V::mul(V::load(f.tankLoss + i), dt);
+        const T dhwLossA = V::mul(V::load(f.dhwLoss + i), dt);
+        const T comp = V::load(f.compressorOn + i);
+        const T fan = V::load(f.fanOn + i);
+        const T defrost = V::load(f.defrostOn + i);
+        const T pump = V::load(f.pumpOn + i);
+        // Less flow takes less heat off the condenser, 2f/(1 + f), and
+        // raises the supply further over the return for what it does take.
+        // Both are exactly 1 at full flow.
+        const T transfer = V::div(V::add(pump, pump), V::add(one, pump));
+        const T rise = V::div(supplyRise, V::max(pump, V::set1(PLANT_MIN_FLOW)));
+        const T valve = V::load(f.waterValveOn + i);
+        const T toTank = V::sub(one, valve);
+
+        // Relay terms, constant for this call.
+        const T heating = V::mul(V::mul(comp, transfer), V::mul(V::sub(one, defrost), V::set1(c.condA)));
+        const T frosting = V::mul(V::mul(comp, fan), V::set1(c.frostA));
+        const T melting = V::mul(defrost, V::set1(c.meltA));
+        const T suctionBase = V::add(V::sub(airOutside, V::mul(comp, V::set1(c.suctionLift))),
+                                     V::mul(defrost, V::set1(c.defrostLift)));
+        const T starved = V::mul(comp, V::set1(c.starvedLift));
+        // Less air over the coil lowers the discharge with it.
+        const T slowFan = V::mul(V::mul(comp, V::sub(one, defrost)), V::sub(one, fan));
+        const T dischargeLift = V::sub(V::mul(comp, V::sub(V::set1(c.dischargeLift),
+                                                           V::mul(defrost, V::set1(c.defrostLoss)))),
+                                       V::mul(slowFan, V::set1(c.slowFanDrop)));
+
+        for (int s = 0; s < steps; s++) {
+            // Evaporator: the coil follows outdoor air minus the lift; a
+            // stopped fan or frost starves it further.
+            T capacity = V::mul(fan, V::max(zero, V::sub(one, V::mul(frost, frostPenalty))));
+            T suctionTarget = V::sub(suctionBase, V::mul(starved, V::sub(one, capacity)));
+            suction = V::add(suction, V::mul(V::sub(suctionTarget, suction), aSuction));
+
+            // The condenser heats whichever tank the valve sends the water
+            // to; with the valve off this is exactly the heating tank.
+            T load = V::add(tank, V::mul(valve, V::sub(dhw, tank)));
+
+            // Discharge follows that tank plus the lift while running, indoor
+            // air while stopped.
+            T dischargeTarget = V::add(V::add(airInside, V::mul(comp, V::sub(load, airInside))), dischargeLift);
+            discharge = V::add(discharge, V::mul(V::sub(dischargeTarget, discharge), aDischarge));
+
+            // Tanks: condenser heat while the pump runs, losses to the room.
+            T q = V::mul(heating, V::max(zero, V::sub(discharge, load)));
+            tank = V::sub(V::add(tank, V::mul(q, toTank)), V::mul(lossA, V::sub(tank, airInside)));
+            dhw = V::sub(V::add(dhw, V::mul(q, valve)), V::mul(dhwLossA, V::sub(dhw, airInside)));
+            load = V::add(tank, V::mul(valve, V::sub(dhw, tank)));
+            T supplyTarget = V::add(load, V::mul(q, rise));
+            supply = V::add(supply, V::mul(V::sub(supplyTarget, supply), aSupply));
+
+            // Frost grows on a coil below zero and melts above zero while
+            // defrosting.
+            T grow = V::mul(frosting, V::max(zero, V::sub(zero, suction)));
+            T melt = V::mul(melting, V::max(zero, suction));
+            frost = V::max(zero, V::sub(V::add(frost, grow), melt));
+        }
+
+        V::store(f.tank + i, tank);
+        V::store(f.supply + i, supply);
+        V::store(f.suction + i, suction);
+        V::store(f.discharge + i, discharge);
+        V::store(f.frost + i, frost);
+        V::store(f.dhwTank + i, dhw);
+    }
+}
+
+#endif
@@ -0,0 +1,36 @@
+// SSE2 is part of the x86-64 baseline, so this needs no extra flags.
+
+#include "plant_kernel.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+namespace {
+
+struct SseOps {
+    typedef __m128 type;
+    enum { width = 4 };
+    static type set1(float v) { return _mm_set1_ps(v); }
+    static type load(const float* p) { return _mm_load_ps(p); }
+    static void store(float* p, type v) { _mm_store_ps(p, v); }
+    static type add(type a, type b) { return _mm_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm_mul_ps(a, b); }
+    static type div(type a, type b) { return _mm_div_ps(a, b); }
+    static type max(type a, type b) { return _mm_max_ps(a, b); }
+};
+
+}
+
+bool plantStepSse(const PlantFleet& fleet, const PlantCoeffs& c, int steps) {
+    plantKernel<SseOps>(fleet, c, steps);
+    return true;
+}
+
+#else
+
+bool plantStepSse(const PlantFleet&, const PlantCoeffs&, int) {
+    return false;
+}
+
+#endif
@@ -0,0 +1,89 @@
+// Host test of the suction-pressure defrost trigger in src/main.cpp.
+//
+// Built with PRESSURE_ENABLED=1, which the tools on firmware_state.h
+// refuse, so it sets p itself instead of going through the ADC. Holds P2
+// below defrostPressure, runs one defrost to its end, and checks that the
+// next one waits pressureSettleTime after it rather than starting at once.
+// Exits 1 on the first failure.
+//
+//   ./pressure_defrost
+
+#include <stdio.h>
+#include "Arduino.h"
+#include "mock_libraries.h"
+
+TwoWire Wire;
+SPIClass SPI;
+
+#include "../src/main.cpp"
+
+#if !PRESSURE_ENABLED
+#error "pressure_defrost needs PRESSURE_ENABLED=1"
+#endif
+
+#define STEP_MS         700UL
+#define LIMIT_MS        1800000UL           // a phase that takes longer has failed
+
+static unsigned long now;
+
+// One control cycle at the readings in degrees: T1, T2, T3, T4, T5.
+static void cycle(float waterIntake, float waterInject, float coolantIntake, float coolantInject, float air) {
+    now += STEP_MS;
+    simSetMicros(now * 1000ULL);
+    sensors.setTempC(coolantInjectSensor, coolantInject);
+    sensors.setTempC(outsideAirSensor, air);
+    t.waterIntake = TEMP(waterIntake);
+    t.waterInject = TEMP(waterInject);
+    t.coolantIntake = TEMP(coolantIntake);
+    t.coolantInject = TEMP(coolantInject);
+    t.airOutside = TEMP(air);
+    t.dhwTank = TEMP(45);
+    p.high = BAR(18);
+    p.low = BAR(1.5);                       // iced evaporator, all along
+    checkTemps(t);
+    controlStep();
+}
+
+static int fail(const char* what) {
+    printf("FAIL: %s (state %d at %lu ms)\n", what, controlState, now);
+    return 1;
+}
+
+int main() {
+    simVerbose = false;
+    setup();
+    now = millis();
+
+    // Heating with the evaporator at 0 °C: the low P2 starts a defrost once
+    // the compressor has run pressureSettleTime.
+    unsigned long limit = now + LIMIT_MS;
+    while (controlState != STATE_DEFROSTING) {
+        if (now > limit) return fail("no defrost on low P2");
+        cycle(30, 33, 0, 50, 0);
+    }
+    if (millis() - compressorStartedTime < pressureSettleTime) return fail("defrost before P2 settled");
+
+    // The evaporator thaws. P2 stays low while it recovers.
+    limit = now + LIMIT_MS;
+    while (controlState == STATE_DEFROSTING) {
+        if (now > limit) return fail("defrost did not end");
+        cycle(30, 33, 10, 50, 0);
+    }
+    unsigned long defrostEnd = defrostStoppedTime;
+    if (!isCompressorStarted) return fail("compressor stopped after the defrost");
+
+    // No new defrost until P2 had pressureSettleTime after the last one...
+    while (millis() - defrostEnd < pressureSettleTime - STEP_MS) {
+        cycle(30, 33, 10, 50, 0);
+        if (controlState == STATE_DEFROSTING) return fail("defrost again before P2 settled");
+    }
+    // ...and then one, since P2 is still low.
+    limit = now + 10 * STEP_MS;
+    while (controlState != STATE_DEFROSTING) {
+        if (now > limit) return fail("no defrost once P2 settled");
+        cycle(30, 33, 10, 50, 0);
+    }
+
+    printf("pressure_defrost: next defrost %lu s after the last one\n", (millis() - defrostEnd) / 1000);
+    return 0;
+}
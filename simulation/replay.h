@@ -0,0 +1,40 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Plain text sensor replay, one loop step per line:
+//   millis waterIntake waterInject coolantIntake coolantInject airOutside dhwTank
+// Lines starting with '#' are comments. The simulator feeds each row to the
+// mocked DS18B20 sensors before the matching loop() call.
+
+struct ReplayRow {
+    unsigned long millis;
+    float temps[6];
+};
+
+inline void writeReplayHeader(FILE* out) {
+    fprintf(out, "# millis waterIntake waterInject coolantIntake coolantInject airOutside dhwTank\n");
+}
+
+inline void writeReplayRow(FILE* out, const ReplayRow& row) {
+    fprintf(out, "%lu %.4f %.4f %.4f %.4f %.4f %.4f\n", row.millis,
+            row.temps[0], row.temps[1], row.temps[2], row.temps[3], row.temps[4], row.temps[5]);
+}
+
+// Returns false at end of file. Malformed lines are skipped.
+inline bool readReplayRow(FILE* in, ReplayRow& row) {
+    char line[256];
+    while (fgets(line, sizeof line, in)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (sscanf(line, "%lu %f %f %f %f %f %f", &row.millis,
+                   &row.temps[0], &row.temps[1], &row.temps[2],
+                   &row.temps[3], &row.temps[4], &row.temps[5]) == 7) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,130 @@
+// Host test of the trend rollups in src/main.cpp.
+//
+// Feeds rollupSample() a day and a minute of readings on the virtual
+// clock, one every 10 s, so the minute, hour and day levels all close, and
+// reads the rings back through readRollupRegister() as a Modbus master
+// would. Exits 1 on the first mismatch.
+//
+//   ./rollups
+
+#include <stdio.h>
+#include "Arduino.h"
+#include "mock_libraries.h"
+
+TwoWire Wire;
+SPIClass SPI;
+
+#include "../src/main.cpp"
+#include "firmware_state.h"
+
+#define SAMPLE_MS       10000UL
+#define MINUTE_MS       60000UL
+#define HOUR_MS         3600000UL
+#define DAY_MS          86400000UL
+
+#define FIELD_MIN       0
+#define FIELD_MAX       1
+#define FIELD_MEAN      2
+
+static int failures;
+
+// Register of a channel's min, max or mean.
+static uint16_t channelRegister(uint8_t level, uint8_t channel, uint8_t kind, uint8_t age) {
+    return level << 10 | (3 * channel + kind) << 5 | age;
+}
+
+static uint16_t dutyRegister(uint8_t level, uint8_t relay, uint8_t age) {
+    return level << 10 | (3 * ROLLUP_CHANNELS + relay) << 5 | age;
+}
+
+static void expect(const char* what, uint16_t reg, uint16_t want) {
+    uint16_t got = 0;
+    if (!readRollupRegister(reg, got)) {
+        printf("FAIL: %s: register 0x%04X refused\n", what, MODBUS_ROLLUP_BASE + reg);
+        failures++;
+    } else if (got != want) {
+        printf("FAIL: %s: register 0x%04X is %u, expected %u\n", what, MODBUS_ROLLUP_BASE + reg, got, want);
+        failures++;
+    }
+}
+
+static void expectRefused(const char* what, uint16_t reg) {
+    uint16_t got;
+    if (readRollupRegister(reg, got)) {
+        printf("FAIL: %s: register 0x%04X read as %u\n", what, MODBUS_ROLLUP_BASE + reg, got);
+        failures++;
+    }
+}
+
+static void expectChannel(const char* what, uint8_t level, uint8_t channel, uint8_t age, temp_t min, temp_t max,
+                          temp_t mean) {
+    expect(what, channelRegister(level, channel, FIELD_MIN, age), (uint16_t)min);
+    expect(what, channelRegister(level, channel, FIELD_MAX, age), (uint16_t)max);
+    expect(what, channelRegister(level, channel, FIELD_MEAN, age), (uint16_t)mean);
+}
+
+// The readings at `ms`: T1 is the minute of the hour, T2 the hour of the
+// day, the rest a steady -5 °C. The compressor runs in the first half of
+// every hour.
+static void sample(unsigned long ms) {
+    simSetMicros(ms * 1000ULL);
+    temp_t* temps = (temp_t*)&t;
+    for (uint8_t c = 0; c < ROLLUP_CHANNELS; c++) temps[c] = TEMP(-5);
+    t.waterIntake = TEMP(ms / MINUTE_MS % 60);
+    t.waterInject = TEMP(ms / HOUR_MS % 24);
+    isCompressorStarted = ms % HOUR_MS < HOUR_MS / 2;
+    rollupSample();
+}
+
+int main() {
+    simVerbose = false;
+    resetController();
+    for (uint8_t r = 0; r < COUNTER_COUNT; r++) *relayStates[r] = false;
+    simSetMicros(0);
+    rollupInit();
+
+    // The first sample of minute 1 closes minute 0; nothing above it yet.
+    for (unsigned long ms = 0; ms <= MINUTE_MS; ms += SAMPLE_MS) sample(ms);
+    expectChannel("minute 0", 0, 0, 0, 0, 0, 0);
+    expect("minute 0 compressor", dutyRegister(0, COUNTER_COMPRESSOR, 0), 255);
+    expect("minute 0 fan", dutyRegister(0, COUNTER_FAN, 0), 0);
+    expect("minute -1 empty", channelRegister(0, 0, FIELD_MEAN, 1), MODBUS_ROLLUP_NONE);
+    expect("hour 0 still open", channelRegister(1, 0, FIELD_MEAN, 0), MODBUS_ROLLUP_NONE);
+
+    // On through the first minute of day 1.
+    for (unsigned long ms = MINUTE_MS + SAMPLE_MS; ms <= DAY_MS + MINUTE_MS; ms += SAMPLE_MS) sample(ms);
+
+    // Minutes: the ring holds the last 10, newest first.
+    expectChannel("minute 1440 T1", 0, 0, 0, 0, 0, 0);
+    expectChannel("minute 1440 T2", 0, 1, 0, 0, 0, 0);
+    expectChannel("minute 1439 T1", 0, 0, 1, TEMP(59), TEMP(59), TEMP(59));
+    expectChannel("minute 1439 T2", 0, 1, 1, TEMP(23), TEMP(23), TEMP(23));
+    expectChannel("minute 1431 T1", 0, 0, 9, TEMP(51), TEMP(51), TEMP(51));
+    expectChannel("minute 1440 T3", 0, 2, 0, TEMP(-5), TEMP(-5), TEMP(-5));
+    expect("minute 1440 compressor", dutyRegister(0, COUNTER_COMPRESSOR, 0), 255);
+    expect("minute 1439 compressor", dutyRegister(0, COUNTER_COMPRESSOR, 1), 0);
+    expectRefused("minute ring size", channelRegister(0, 0, FIELD_MEAN, ROLLUP_MINUTES));
+
+    // Hours: merged from the minutes, the ring is exactly full.
+    expectChannel("hour 23 T1", 1, 0, 0, 0, TEMP(59), TEMP(29.5));
+    expectChannel("hour 23 T2", 1, 1, 0, TEMP(23), TEMP(23), TEMP(23));
+    expectChannel("hour 0 T2", 1, 1, ROLLUP_HOURS - 1, 0, 0, 0);
+    expect("hour 23 compressor", dutyRegister(1, COUNTER_COMPRESSOR, 0), 127);
+    expectRefused("hour ring size", channelRegister(1, 0, FIELD_MEAN, ROLLUP_HOURS));
+
+    // Days: merged from the hours, one closed so far.
+    expectChannel("day 0 T1", 2, 0, 0, 0, TEMP(59), TEMP(29.5));
+    expectChannel("day 0 T2", 2, 1, 0, 0, TEMP(23), TEMP(11.5));
+    expectChannel("day 0 T6", 2, 5, 0, TEMP(-5), TEMP(-5), TEMP(-5));
+    expect("day 0 compressor", dutyRegister(2, COUNTER_COMPRESSOR, 0), 127);
+    expect("day -1 empty", channelRegister(2, 0, FIELD_MEAN, 1), MODBUS_ROLLUP_NONE);
+    expectRefused("day ring size", channelRegister(2, 0, FIELD_MEAN, ROLLUP_DAYS));
+
+    // Outside the map.
+    expectRefused("level 3", 3 << 10);
+    expectRefused("field past the relays", MODBUS_ROLLUP_FIELDS << 5);
+
+    if (failures) return 1;
+    printf("rollups: minutes, hours and days match\n");
+    return 0;
+}
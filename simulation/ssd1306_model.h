@@ -0,0 +1,147 @@
+#ifndef SSD1306_MODEL_H
+#define SSD1306_MODEL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "mock_libraries.h"
+
+// What reached the panel, for judging the render path.
+struct DisplayStats {
+    unsigned long transmissions;    // I2C frames addressed to the display
+    unsigned long bytes;            // bytes on the bus, address bytes included
+    unsigned long dataBytes;        // bytes written to display RAM
+    unsigned long pixelsChanged;    // panel pixels that actually flipped
+};
+
+// SSD1306 controller on the simulated I2C bus. Decodes the command stream
+// (addressing modes, page/column windows) and keeps the 128x64 display RAM,
+// so whatever driver the firmware uses is judged by what actually lands on
+// the panel.
+class SSD1306Model : public I2CDevice {
+public:
+    SSD1306Model() : stats_(), mode(0x02), colStart(0), colEnd(WIDTH - 1),
+                     pageStart(0), pageEnd(PAGES - 1), col(0), page(0),
+                     pending(0), argCount(0), on(false) {
+        memset(ram, 0, sizeof ram);
+    }
+
+    void receive(const uint8_t* data, size_t n) {
+        stats_.transmissions++;
+        stats_.bytes += n + 1;
+        if (!n) return;
+        // Control byte: D/C# selects data, Co=0 means the rest is one stream.
+        bool isData = data[0] & 0x40;
+        for (size_t i = 1; i < n; i++) {
+            if (isData) writeData(data[i]);
+            else command(data[i]);
+        }
+    }
+
+    const DisplayStats& stats() const { return stats_; }
+    bool isOn() const { return on; }
+    bool pixel(int x, int y) const { return ram[y / 8][x] >> (y & 7) & 1; }
+
+    // Writes the panel as a binary PBM, lit pixels black.
+    bool writePBM(const char* path) const {
+        FILE* f = fopen(path, "wb");
+        if (!f) return false;
+        fprintf(f, "P4\n%d %d\n", WIDTH, PAGES * 8);
+        for (int y = 0; y < PAGES * 8; y++) {
+            for (int x = 0; x < WIDTH; x += 8) {
+                uint8_t row = 0;
+                for (int k = 0; k < 8; k++) {
+                    if (pixel(x + k, y)) row |= 0x80 >> k;
+                }
+                fputc(row, f);
+            }
+        }
+        fclose(f);
+        return true;
+    }
+
+private:
+    static const int WIDTH = 128;
+    static const int PAGES = 8;
+
+    void writeData(uint8_t b) {
+        stats_.dataBytes++;
+        stats_.pixelsChanged += __builtin_popcount(ram[page][col] ^ b);
+        ram[page][col] = b;
+        if (mode == 0x02) {                         // page addressing
+            if (col < WIDTH - 1) col++;
+            return;
+        }
+        if (mode == 0x00) {                         // horizontal
+            if (col < colEnd) { col++; return; }
+            col = colStart;
+            page = page < pageEnd ? page + 1 : pageStart;
+        } else {                                    // vertical
+            if (page < pageEnd) { page++; return; }
+            page = pageStart;
+            col = col < colEnd ? col + 1 : colStart;
+        }
+    }
+
+    void command(uint8_t c) {
+        if (pending) {
+            args[argCount++] = c;
+            if (argCount < pending) return;
+            applyArgs();
+            pending = 0;
+            return;
+        }
+        cmd = c;
+        argCount = 0;
+        switch (c) {
+            case 0x20: case 0x81: case 0x8D: case 0xA8: case 0xD3:
+            case 0xD5: case 0xD9: case 0xDA: case 0xDB:
+                pending = 1;
+                return;
+            case 0x21: case 0x22: case 0xA3:
+                pending = 2;
+                return;
+            case 0x29: case 0x2A:
+                pending = 5;
+                return;
+            case 0x26: case 0x27:
+                pending = 6;
+                return;
+            case 0xAE: on = false; return;
+            case 0xAF: on = true;  return;
+        }
+        if (c >= 0xB0 && c <= 0xB7) page = c & 0x07;
+        else if (c <= 0x0F) col = (col & 0xF0) | c;
+        else if (c >= 0x10 && c <= 0x1F) col = (col & 0x0F) | ((c & 0x0F) << 4);
+        if (col >= WIDTH) col = WIDTH - 1;
+    }
+
+    void applyArgs() {
+        switch (cmd) {
+            case 0x20:
+                mode = args[0] & 0x03;
+                break;
+            case 0x21:
+                colStart = col = args[0] & 0x7F;
+                colEnd = args[1] & 0x7F;
+                break;
+            case 0x22:
+                pageStart = page = args[0] & 0x07;
+                pageEnd = args[1] & 0x07;
+                break;
+        }
+    }
+
+    DisplayStats stats_;
+    uint8_t ram[PAGES][WIDTH];
+    uint8_t mode;
+    uint8_t colStart, colEnd, pageStart, pageEnd;
+    uint8_t col, page;
+    uint8_t cmd;
+    uint8_t args[6];
+    uint8_t pending;
+    uint8_t argCount;
+    bool on;
+};
+
+#endif
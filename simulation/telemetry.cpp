@@ -0,0 +1,482 @@
+// Fleet telemetry analytics: per-unit compressor duty cycle, starts per
+// hour, defrost count and length, time in each mode and error incidence
+// over any amount of logged data.
+//
+//   ./telemetry unit17.trace unit17.2.trace unit18.log ...
+//   ./telemetry --csv --threads 8 logs/*.trace
+//
+// Accepts binary traces (HPTRACE2) and the text the firmware prints with
+// LOG_LEVEL_DEBUG. The unit is the file name up to its first '.', and files
+// of one unit are joined in command line order. Files are mapped, cut into
+// pieces (groups of trace chunks, or stretches of text starting at a
+// "Compressor" line) and the pieces are reduced on a thread pool. Both
+// formats are first brought into the same columns, which are then reduced
+// by branch-free loops the compiler vectorizes; per-piece results carry
+// their first and last sample so they join exactly.
+//
+// Text logs have no timestamps: each record is taken to be --period ms
+// after the one before it. In trace files an interval longer than --max-gap
+// (a reboot, a logger outage) counts as no time at all.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "trace.h"
+
+#define MODE_COUNT          5           // TRACE_MODE_* values tracked; higher ones count as the last
+#define PIECE_CHUNKS        16          // trace chunks per piece
+#define PIECE_TEXT_BYTES    (4 << 20)   // text bytes per piece, roughly
+
+static const char* const modeNames[MODE_COUNT] = {"heating", "defrost", "starting", "satisfied", "fault"};
+
+struct Options {
+    unsigned long periodMs;
+    unsigned long maxGapMs;
+    unsigned threads;
+    bool csv;
+};
+
+// One state sample in the columns every format is reduced from.
+struct Sample {
+    uint32_t millis;
+    uint32_t compressor;
+    uint32_t mode;
+    uint32_t errors;
+};
+
+// Sums over a run of samples; two adjacent runs merge into one.
+struct Stats {
+    bool any;
+    Sample first, last;
+    uint64_t samples;
+    uint64_t ms;
+    uint64_t compressorMs;
+    uint64_t compressorStarts;
+    uint64_t modeMs[MODE_COUNT];
+    uint64_t defrosts;
+    uint64_t errorMs;
+    uint64_t errorSamples;
+    uint64_t errorOnsets;
+    uint64_t gaps;
+};
+
+static void clearStats(Stats& s) {
+    memset(&s, 0, sizeof s);
+}
+
+static uint32_t modeIndex(uint32_t mode) {
+    return mode < MODE_COUNT ? mode : MODE_COUNT - 1;
+}
+
+// Counts the interval from `a` to `b`, `dt` ms long, into `s`: the state
+// holds for the interval and edges are counted where `b` differs.
+static void addInterval(Stats& s, const Sample& a, const Sample& b, uint32_t dt) {
+    s.ms += dt;
+    s.compressorMs += a.compressor ? dt : 0;
+    s.modeMs[modeIndex(a.mode)] += dt;
+    s.errorMs += a.errors ? dt : 0;
+    s.compressorStarts += !a.compressor && b.compressor;
+    s.defrosts += a.mode != TRACE_MODE_DEFROST && b.mode == TRACE_MODE_DEFROST;
+    s.errorOnsets += !a.errors && b.errors;
+}
+
+// Appends `b` after `a`, `dt` ms after a's last sample.
+static void mergeStats(Stats& a, const Stats& b, uint32_t dt, bool valid) {
+    if (!b.any) return;
+    if (!a.any) {
+        a = b;
+        return;
+    }
+    if (valid) addInterval(a, a.last, b.first, dt);
+    else a.gaps++;
+    a.last = b.last;
+    a.samples += b.samples;
+    a.ms += b.ms;
+    a.compressorMs += b.compressorMs;
+    a.compressorStarts += b.compressorStarts;
+    for (int m = 0; m < MODE_COUNT; m++) a.modeMs[m] += b.modeMs[m];
+    a.defrosts += b.defrosts;
+    a.errorMs += b.errorMs;
+    a.errorSamples += b.errorSamples;
+    a.errorOnsets += b.errorOnsets;
+    a.gaps += b.gaps;
+}
+
+// Reduces n samples held column-wise. `millis` may be NULL for a fixed
+// period. Written without branches so each loop vectorizes.
+static void reduceColumns(Stats& s, const uint32_t* millis, const uint32_t* compressor,
+                          const uint32_t* mode, const uint32_t* errors, size_t n,
+                          const Options& opt) {
+    if (!n) return;
+    Stats r;
+    clearStats(r);
+    r.any = true;
+    r.first.millis = millis ? millis[0] : 0;
+    r.first.compressor = compressor[0];
+    r.first.mode = mode[0];
+    r.first.errors = errors[0];
+    r.last.millis = millis ? millis[n - 1] : (uint32_t)((n - 1) * opt.periodMs);
+    r.last.compressor = compressor[n - 1];
+    r.last.mode = mode[n - 1];
+    r.last.errors = errors[n - 1];
+    r.samples = n;
+
+    uint64_t ms = 0, compressorMs = 0, errorMs = 0, gaps = 0;
+    uint64_t starts = 0, defrosts = 0, onsets = 0, errorSamples = 0;
+    uint64_t modeMs[MODE_COUNT] = {0};
+    const uint32_t maxGap = opt.maxGapMs;
+    const uint32_t period = opt.periodMs;
+    for (size_t i = 0; i + 1 < n; i++) {
+        uint32_t dt = millis ? millis[i + 1] - millis[i] : period;
+        uint32_t valid = dt <= maxGap;
+        dt &= 0u - valid;
+        gaps += 1 - valid;
+        ms += dt;
+        compressorMs += dt & (0u - (compressor[i] != 0));
+        errorMs += dt & (0u - (errors[i] != 0));
+        starts += (compressor[i] == 0) & (compressor[i + 1] != 0);
+        defrosts += (mode[i] != TRACE_MODE_DEFROST) & (mode[i + 1] == TRACE_MODE_DEFROST);
+        onsets += (errors[i] == 0) & (errors[i + 1] != 0);
+    }
+    for (int m = 0; m < MODE_COUNT; m++) {
+        uint64_t sum = 0;
+        for (size_t i = 0; i + 1 < n; i++) {
+            uint32_t dt = millis ? millis[i + 1] - millis[i] : period;
+            uint32_t hit = (dt <= maxGap) & (m == MODE_COUNT - 1 ? mode[i] >= (uint32_t)m : mode[i] == (uint32_t)m);
+            sum += dt & (0u - hit);
+        }
+        modeMs[m] = sum;
+    }
+    for (size_t i = 0; i < n; i++) errorSamples += errors[i] != 0;
+
+    r.ms = ms;
+    r.compressorMs = compressorMs;
+    r.compressorStarts = starts;
+    for (int m = 0; m < MODE_COUNT; m++) r.modeMs[m] = modeMs[m];
+    r.defrosts = defrosts;
+    r.errorMs = errorMs;
+    r.errorSamples = errorSamples;
+    r.errorOnsets = onsets;
+    r.gaps = gaps;
+
+    uint32_t dt = r.first.millis - s.last.millis;
+    mergeStats(s, r, millis ? dt : period, millis ? dt <= maxGap : true);
+}
+
+// --- input files -----------------------------------------------------------
+
+struct MappedFile {
+    std::string path;
+    std::string unit;
+    const uint8_t* data;
+    size_t size;
+    bool binary;
+};
+
+struct Piece {
+    const MappedFile* file;
+    const uint8_t* begin;
+    const uint8_t* end;
+    std::vector<TraceChunkRef> chunks;      // binary files only
+    Stats stats;
+    std::string error;
+};
+
+static std::string unitName(const std::string& path) {
+    size_t slash = path.rfind('/');
+    std::string base = slash == std::string::npos ? path : path.substr(slash + 1);
+    return base.substr(0, base.find('.'));
+}
+
+static bool mapFile(const char* path, MappedFile& f) {
+    f.path = path;
+    f.unit = unitName(path);
+    f.data = NULL;
+    f.size = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    f.size = st.st_size;
+    if (f.size) {
+        void* p = mmap(NULL, f.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise(p, f.size, MADV_SEQUENTIAL);
+        f.data = (const uint8_t*)p;
+    }
+    close(fd);
+    f.binary = f.size >= 8 && memcmp(f.data, TRACE_MAGIC, 8) == 0;
+    return true;
+}
+
+// Cuts a text log at record starts, about PIECE_TEXT_BYTES apart.
+static void splitText(const MappedFile& f, std::vector<Piece>& pieces) {
+    static const char marker[] = "\nCompressor ";
+    const uint8_t* begin = f.data;
+    const uint8_t* end = f.data + f.size;
+    while (begin < end) {
+        const uint8_t* cut = end;
+        if ((size_t)(end - begin) > PIECE_TEXT_BYTES) {
+            const uint8_t* from = begin + PIECE_TEXT_BYTES;
+            const void* hit = memmem(from, end - from, marker, sizeof marker - 1);
+            if (hit) cut = (const uint8_t*)hit + 1;
+        }
+        Piece p;
+        p.file = &f;
+        p.begin = begin;
+        p.end = cut;
+        clearStats(p.stats);
+        pieces.push_back(p);
+        begin = cut;
+    }
+}
+
+static bool splitTrace(const MappedFile& f, std::vector<Piece>& pieces, std::string& error) {
+    std::vector<TraceChunkRef> chunks;
+    if (!traceIndex(f.data, f.size, chunks, error)) return false;
+    for (size_t i = 0; i < chunks.size(); i += PIECE_CHUNKS) {
+        Piece p;
+        p.file = &f;
+        p.begin = p.end = NULL;
+        p.chunks.assign(chunks.begin() + i, chunks.begin() + std::min(chunks.size(), i + PIECE_CHUNKS));
+        clearStats(p.stats);
+        pieces.push_back(p);
+    }
+    return true;
+}
+
+// --- reducers --------------------------------------------------------------
+
+static void reduceTrace(Piece& p, TraceChunk& chunk, const Options& opt) {
+    for (size_t c = 0; c < p.chunks.size(); c++) {
+        if (!traceDecodeChunk(p.chunks[c], chunk)) {
+            p.error = "corrupt chunk";
+            return;
+        }
+        reduceColumns(p.stats, chunk.u32[COL_MILLIS], chunk.u32[COL_COMPRESSOR], chunk.u32[COL_MODE],
+                      chunk.u32[COL_ERRORS], chunk.rows, opt);
+    }
+}
+
+// Text records, as printed by getAllTemps() once per loop:
+//   Compressor 0 Fan 0 Defrost 0 SumpHeater 0 CompressorHeater 0 Pump 0
+// (older firmware puts each pair on its own line), and "DrawErrors" after
+// the record when that loop found errors. Everything else is skipped.
+struct TextColumns {
+    uint32_t compressor[TRACE_CHUNK_ROWS];
+    uint32_t mode[TRACE_CHUNK_ROWS];
+    uint32_t errors[TRACE_CHUNK_ROWS];
+};
+
+static bool wordIs(const uint8_t* p, const uint8_t* end, const char* word, size_t len) {
+    return (size_t)(end - p) > len && memcmp(p, word, len) == 0 && p[len] == ' ';
+}
+
+static void reduceText(Piece& p, TextColumns& cols, const Options& opt) {
+    size_t n = 0;
+    uint32_t compressor = 0, defrost = 0;
+    const uint8_t* line = p.begin;
+    while (line < p.end) {
+        const uint8_t* eol = (const uint8_t*)memchr(line, '\n', p.end - line);
+        if (!eol) eol = p.end;
+        if (*line == 'D' && eol - line >= 10 && memcmp(line, "DrawErrors", 10) == 0) {
+            if (n) cols.errors[n - 1] = 1;
+        } else if (*line == 'C' || *line == 'D' || *line == 'P') {
+            // Name/value pairs; a record ends with its Pump value.
+            const uint8_t* w = line;
+            while (w < eol) {
+                const uint8_t* sp = (const uint8_t*)memchr(w, ' ', eol - w);
+                if (!sp || sp + 1 >= eol) break;
+                uint32_t value = sp[1] == '1';
+                if (wordIs(w, eol, "Compressor", 10)) compressor = value;
+                else if (wordIs(w, eol, "Defrost", 7)) defrost = value;
+                else if (wordIs(w, eol, "Pump", 4)) {
+                    if (n == TRACE_CHUNK_ROWS) {
+                        // Keep the last record back: a DrawErrors may still follow it.
+                        reduceColumns(p.stats, NULL, cols.compressor, cols.mode, cols.errors, n - 1, opt);
+                        cols.compressor[0] = cols.compressor[n - 1];
+                        cols.mode[0] = cols.mode[n - 1];
+                        cols.errors[0] = cols.errors[n - 1];
+                        n = 1;
+                    }
+                    cols.compressor[n] = compressor;
+                    cols.mode[n] = defrost ? TRACE_MODE_DEFROST : TRACE_MODE_WORK;
+                    cols.errors[n] = 0;
+                    n++;
+                }
+                const uint8_t* next = (const uint8_t*)memchr(sp + 1, ' ', eol - sp - 1);
+                w = next ? next + 1 : eol;
+            }
+        }
+        line = eol + 1;
+    }
+    reduceColumns(p.stats, NULL, cols.compressor, cols.mode, cols.errors, n, opt);
+}
+
+static void runPieces(std::vector<Piece>& pieces, const Options& opt) {
+    std::atomic<size_t> nextPiece(0);
+    auto worker = [&]() {
+        std::vector<TraceChunk> chunk(1);
+        std::vector<TextColumns> cols(1);
+        for (size_t i; (i = nextPiece++) < pieces.size();) {
+            if (pieces[i].file->binary) reduceTrace(pieces[i], chunk[0], opt);
+            else reduceText(pieces[i], cols[0], opt);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < opt.threads; t++) pool.push_back(std::thread(worker));
+    worker();
+    for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+}
+
+// --- report ----------------------------------------------------------------
+
+struct Unit {
+    std::string name;
+    Stats stats;
+};
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void report(const std::vector<Unit>& units, bool csv) {
+    if (csv) {
+        printf("unit,hours,samples,duty_pct,starts,starts_per_hour,defrosts,defrost_avg_min");
+        for (int m = 0; m < MODE_COUNT; m++) printf(",%s_pct", modeNames[m]);
+        printf(",error_pct,error_onsets,gaps\n");
+    } else {
+        printf("%-16s %9s %6s %8s %6s %9s %8s", "unit", "hours", "duty%", "starts/h", "defr", "defr min",
+               "error%");
+        for (int m = 0; m < 2; m++) printf(" %8s", modeNames[m]);
+        printf(" %6s %5s\n", "errors", "gaps");
+    }
+    for (size_t u = 0; u < units.size(); u++) {
+        const Stats& s = units[u].stats;
+        double hours = s.ms / 3600000.0;
+        double startsPerHour = hours > 0 ? s.compressorStarts / hours : 0.0;
+        double defrostMin = s.defrosts ? s.modeMs[TRACE_MODE_DEFROST] / 60000.0 / s.defrosts : 0.0;
+        if (csv) {
+            printf("%s,%.3f,%llu,%.2f,%llu,%.3f,%llu,%.2f", units[u].name.c_str(), hours,
+                   (unsigned long long)s.samples, percent(s.compressorMs, s.ms),
+                   (unsigned long long)s.compressorStarts, startsPerHour, (unsigned long long)s.defrosts,
+                   defrostMin);
+            for (int m = 0; m < MODE_COUNT; m++) printf(",%.2f", percent(s.modeMs[m], s.ms));
+            printf(",%.3f,%llu,%llu\n", percent(s.errorMs, s.ms), (unsigned long long)s.errorOnsets,
+                   (unsigned long long)s.gaps);
+        } else {
+            printf("%-16s %9.1f %6.1f %8.2f %6llu %9.1f %8.3f", units[u].name.c_str(), hours,
+                   percent(s.compressorMs, s.ms), startsPerHour, (unsigned long long)s.defrosts, defrostMin,
+                   percent(s.errorMs, s.ms));
+            for (int m = 0; m < 2; m++) printf(" %7.1f%%", percent(s.modeMs[m], s.ms));
+            printf(" %6llu %5llu\n", (unsigned long long)s.errorOnsets, (unsigned long long)s.gaps);
+        }
+    }
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [--threads N] [--period MS] [--max-gap MS] [--csv] <log>...\n"
+            "  <log>           binary trace or text log; the unit is the name up to its first '.'\n"
+            "  --threads N     worker threads (default: all cores)\n"
+            "  --period MS     time between text log records (default 1530)\n"
+            "  --max-gap MS    longer trace intervals count as gaps (default 60000)\n"
+            "  --csv           machine-readable output\n",
+            argv0);
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    opt.periodMs = 1530;
+    opt.maxGapMs = 60000;
+    opt.threads = std::max(1u, std::thread::hardware_concurrency());
+    opt.csv = false;
+
+    std::vector<const char*> paths;
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (!strcmp(argv[i], "--threads") && more) opt.threads = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--period") && more) opt.periodMs = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--max-gap") && more) opt.maxGapMs = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--csv")) opt.csv = true;
+        else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 2;
+        } else paths.push_back(argv[i]);
+    }
+    if (paths.empty()) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<MappedFile> files(paths.size());
+    std::vector<Piece> pieces;
+    size_t totalBytes = 0;
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (!mapFile(paths[i], files[i])) {
+            perror(paths[i]);
+            return 1;
+        }
+        totalBytes += files[i].size;
+    }
+    // Pieces keep a pointer into files, so split only once it is complete.
+    for (size_t i = 0; i < files.size(); i++) {
+        std::string error;
+        if (files[i].binary && !splitTrace(files[i], pieces, error)) {
+            fprintf(stderr, "%s: %s\n", files[i].path.c_str(), error.c_str());
+            return 1;
+        }
+        if (!files[i].binary) splitText(files[i], pieces);
+    }
+
+    runPieces(pieces, opt);
+
+    // Join pieces per unit, in file and piece order.
+    std::vector<Unit> units;
+    for (size_t i = 0; i < pieces.size(); i++) {
+        const Piece& p = pieces[i];
+        if (!p.error.empty()) {
+            fprintf(stderr, "%s: %s\n", p.file->path.c_str(), p.error.c_str());
+            return 1;
+        }
+        size_t u = 0;
+        while (u < units.size() && units[u].name != p.file->unit) u++;
+        if (u == units.size()) {
+            units.push_back(Unit());
+            units[u].name = p.file->unit;
+            clearStats(units[u].stats);
+        }
+        Stats& s = units[u].stats;
+        uint32_t dt = p.stats.first.millis - s.last.millis;
+        if (p.file->binary) mergeStats(s, p.stats, dt, dt <= opt.maxGapMs);
+        else mergeStats(s, p.stats, opt.periodMs, true);
+    }
+
+    report(units, opt.csv);
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "%zu files, %.1f MB in %.3f s (%.0f MB/s, %u threads)\n", files.size(),
+            totalBytes / 1e6, elapsed, elapsed > 0 ? totalBytes / 1e6 / elapsed : 0.0, opt.threads);
+
+    for (size_t i = 0; i < files.size(); i++) {
+        if (files[i].size) munmap((void*)files[i].data, files[i].size);
+    }
+    return 0;
+}
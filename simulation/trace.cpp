@@ -0,0 +1,389 @@
+#include "trace.h"
+#include <chrono>
+#include <string.h>
+
+const TraceColumnInfo traceColumns[TRACE_COLUMN_COUNT] = {
+    {"millis",            TRACE_U32},
+    {"waterIntake",       TRACE_I16},
+    {"waterInject",       TRACE_I16},
+    {"coolantIntake",     TRACE_I16},
+    {"coolantInject",     TRACE_I16},
+    {"airOutside",        TRACE_I16},
+    {"airInside",         TRACE_I16},
+    {"compressor",        TRACE_U8},
+    {"fan",               TRACE_U8},
+    {"defrostValve",      TRACE_U8},
+    {"sumpHeater",        TRACE_U8},
+    {"compressorHeater",  TRACE_U8},
+    {"waterPump",         TRACE_U8},
+    {"waterValve",        TRACE_U8},
+    {"heatedAtLeastOnce", TRACE_U8},
+    {"startIsFinished",   TRACE_U8},
+    {"drawSign",          TRACE_U8},
+    {"mode",              TRACE_U8},
+    {"errors",            TRACE_U32},
+};
+
+static void putVarint(std::vector<uint8_t>& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+static bool getVarint(const uint8_t*& p, const uint8_t* end, uint32_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (p == end) return false;
+        uint8_t b = *p++;
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+static void putU32(FILE* f, uint32_t v) {
+    uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+    fwrite(b, 1, 4, f);
+}
+
+static bool getU32(FILE* f, uint32_t& v) {
+    uint8_t b[4];
+    if (fread(b, 1, 4, f) != 4) return false;
+    v = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+    return true;
+}
+
+static uint32_t residual(uint8_t type, uint32_t prev, uint32_t cur) {
+    if (type == TRACE_F32) return prev ^ cur;
+    int32_t delta = (int32_t)(cur - prev);
+    return ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+}
+
+static uint32_t unresidual(uint8_t type, uint32_t prev, uint32_t r) {
+    if (type == TRACE_F32) return prev ^ r;
+    int32_t delta = (int32_t)((r >> 1) ^ (~(r & 1) + 1));
+    return prev + (uint32_t)delta;
+}
+
+static void encodeColumn(std::vector<uint8_t>& out, uint8_t type, const uint32_t* values, uint32_t rows) {
+    uint32_t prev = 0;
+    uint32_t zeros = 0;
+    for (uint32_t i = 0; i < rows; i++) {
+        uint32_t r = residual(type, prev, values[i]);
+        prev = values[i];
+        if (r == 0) {
+            zeros++;
+            continue;
+        }
+        if (zeros) {
+            putVarint(out, 0);
+            putVarint(out, zeros);
+            zeros = 0;
+        }
+        putVarint(out, r);
+    }
+    if (zeros) {
+        putVarint(out, 0);
+        putVarint(out, zeros);
+    }
+}
+
+static bool decodeColumn(const uint8_t* p, const uint8_t* end, uint8_t type, uint32_t* values, uint32_t rows) {
+    uint32_t prev = 0;
+    uint32_t i = 0;
+    while (i < rows) {
+        uint32_t r;
+        if (!getVarint(p, end, r)) return false;
+        if (r == 0) {
+            uint32_t run;
+            if (!getVarint(p, end, run) || run > rows - i) return false;
+            while (run--) values[i++] = prev;
+            continue;
+        }
+        prev = unresidual(type, prev, r);
+        values[i++] = prev;
+    }
+    return p == end;
+}
+
+bool ChunkQueue::push(TraceChunk* chunk) {
+    unsigned h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == TRACE_QUEUE_SIZE) return false;
+    slots[h % TRACE_QUEUE_SIZE] = chunk;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+TraceChunk* ChunkQueue::pop() {
+    unsigned t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return NULL;
+    TraceChunk* chunk = slots[t % TRACE_QUEUE_SIZE];
+    tail.store(t + 1, std::memory_order_release);
+    return chunk;
+}
+
+TraceWriter::TraceWriter()
+    : file(NULL), current(NULL), stopping(false), rowCount(0), byteCount(0) {}
+
+TraceWriter::~TraceWriter() {
+    close();
+}
+
+bool TraceWriter::open(const char* path) {
+    close();
+    file = fopen(path, "wb");
+    if (!file) return false;
+
+    fwrite(TRACE_MAGIC, 1, 8, file);
+    uint8_t count[2] = {TRACE_COLUMN_COUNT, 0};
+    fwrite(count, 1, 2, file);
+    for (int c = 0; c < TRACE_COLUMN_COUNT; c++) {
+        uint8_t desc[2] = {traceColumns[c].type, (uint8_t)strlen(traceColumns[c].name)};
+        fwrite(desc, 1, 2, file);
+        fwrite(traceColumns[c].name, 1, desc[1], file);
+    }
+    byteCount = ftell(file);
+    rowCount = 0;
+
+    current = takeFreeChunk();
+    stopping = false;
+    writer = std::thread(&TraceWriter::writerMain, this);
+    return true;
+}
+
+TraceChunk* TraceWriter::takeFreeChunk() {
+    TraceChunk* chunk = recycled.pop();
+    if (!chunk) {
+        // The writer has fallen behind; grow the pool instead of stalling
+        // the simulation.
+        chunk = new TraceChunk;
+        allChunks.push_back(chunk);
+    }
+    chunk->rows = 0;
+    return chunk;
+}
+
+void TraceWriter::append(const TraceRow& row) {
+    if (!current) return;
+    uint32_t i = current->rows;
+    current->u32[COL_MILLIS][i] = row.millis;
+    for (int k = 0; k < 6; k++) current->u32[COL_WATER_INTAKE + k][i] = (uint32_t)(int32_t)row.temps[k];
+    for (int k = 0; k < TRACE_RELAYS; k++) current->u32[COL_COMPRESSOR + k][i] = row.relays[k];
+    current->u32[COL_HEATED_AT_LEAST_ONCE][i] = row.heatedAtLeastOnce;
+    current->u32[COL_START_IS_FINISHED][i] = row.startIsFinished;
+    current->u32[COL_DRAW_SIGN][i] = row.drawSign;
+    current->u32[COL_MODE][i] = row.mode;
+    current->u32[COL_ERRORS][i] = row.errors;
+    current->rows = i + 1;
+    rowCount++;
+
+    if (current->rows == TRACE_CHUNK_ROWS) handOff();
+}
+
+void TraceWriter::handOff() {
+    while (!full.push(current)) {
+        // Queue full means the writer is TRACE_QUEUE_SIZE chunks behind;
+        // this is the only place the simulation ever waits.
+        std::this_thread::yield();
+    }
+    current = takeFreeChunk();
+}
+
+void TraceWriter::writerMain() {
+    for (;;) {
+        TraceChunk* chunk = full.pop();
+        if (chunk) {
+            writeChunk(chunk);
+            // The recycle queue can only overflow after the pool has grown;
+            // a chunk that does not fit stays idle in allChunks until close().
+            recycled.push(chunk);
+            continue;
+        }
+        if (stopping.load(std::memory_order_acquire)) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void TraceWriter::writeChunk(const TraceChunk* chunk) {
+    putU32(file, chunk->rows);
+    byteCount += 4;
+    for (int c = 0; c < TRACE_COLUMN_COUNT; c++) {
+        encoded.clear();
+        encodeColumn(encoded, traceColumns[c].type, chunk->u32[c], chunk->rows);
+        putU32(file, encoded.size());
+        fwrite(encoded.data(), 1, encoded.size(), file);
+        byteCount += 4 + encoded.size();
+    }
+}
+
+void TraceWriter::close() {
+    if (!file) return;
+    if (current && current->rows) handOff();
+    stopping.store(true, std::memory_order_release);
+    writer.join();
+
+    fclose(file);
+    file = NULL;
+    current = NULL;
+    while (recycled.pop()) {}
+    for (size_t i = 0; i < allChunks.size(); i++) delete allChunks[i];
+    allChunks.clear();
+}
+
+static uint32_t loadU32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool traceIndex(const uint8_t* data, size_t size, std::vector<TraceChunkRef>& chunks, std::string& error) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    if (size < 10 || memcmp(p, TRACE_MAGIC, 8) != 0) {
+        error = "not a trace file";
+        return false;
+    }
+    if (p[8] != TRACE_COLUMN_COUNT || p[9] != 0) {
+        error = "unsupported column layout";
+        return false;
+    }
+    p += 10;
+    for (int c = 0; c < TRACE_COLUMN_COUNT; c++) {
+        size_t nameLen = strlen(traceColumns[c].name);
+        if (end - p < 2 || p[0] != traceColumns[c].type || p[1] != nameLen
+            || (size_t)(end - p - 2) < nameLen || memcmp(p + 2, traceColumns[c].name, nameLen) != 0) {
+            error = "unsupported column layout";
+            return false;
+        }
+        p += 2 + nameLen;
+    }
+
+    while (p != end) {
+        if (end - p < 4) {
+            error = "truncated chunk";
+            return false;
+        }
+        TraceChunkRef ref;
+        ref.rows = loadU32(p);
+        if (ref.rows == 0 || ref.rows > TRACE_CHUNK_ROWS) {
+            error = "bad chunk header";
+            return false;
+        }
+        p += 4;
+        ref.columns = p;
+        for (int c = 0; c < TRACE_COLUMN_COUNT; c++) {
+            if (end - p < 4 || (size_t)(end - p - 4) < loadU32(p)) {
+                error = "truncated chunk";
+                return false;
+            }
+            p += 4 + loadU32(p);
+        }
+        ref.end = p;
+        chunks.push_back(ref);
+    }
+    return true;
+}
+
+bool traceDecodeChunk(const TraceChunkRef& ref, TraceChunk& out) {
+    const uint8_t* p = ref.columns;
+    for (int c = 0; c < TRACE_COLUMN_COUNT; c++) {
+        uint32_t len = loadU32(p);
+        p += 4;
+        if (!decodeColumn(p, p + len, traceColumns[c].type, out.u32[c], ref.rows)) return false;
+        p += len;
+    }
+    out.rows = ref.rows;
+    return true;
+}
+
+TraceReader::TraceReader() : file(NULL), rows(0), position(0) {}
+
+TraceReader::~TraceReader() {
+    close();
+}
+
+bool TraceReader::open(const char* path) {
+    close();
+    file = fopen(path, "rb");
+    if (!file) {
+        lastError = std::string("cannot open ") + path;
+        return false;
+    }
+
+    char magic[8];
+    uint8_t count[2];
+    if (fread(magic, 1, 8, file) != 8 || memcmp(magic, TRACE_MAGIC, 8) != 0
+        || fread(count, 1, 2, file) != 2) {
+        lastError = "not a trace file";
+        close();
+        return false;
+    }
+    if (count[0] != TRACE_COLUMN_COUNT || count[1] != 0) {
+        lastError = "unsupported column layout";
+        close();
+        return false;
+    }
+    for (int c = 0; c < TRACE_COLUMN_COUNT; c++) {
+        uint8_t desc[2];
+        char name[256];
+        if (fread(desc, 1, 2, file) != 2 || fread(name, 1, desc[1], file) != desc[1]
+            || desc[0] != traceColumns[c].type
+            || strlen(traceColumns[c].name) != desc[1]
+            || memcmp(name, traceColumns[c].name, desc[1]) != 0) {
+            lastError = "unsupported column layout";
+            close();
+            return false;
+        }
+    }
+    rows = position = 0;
+    return true;
+}
+
+bool TraceReader::readChunk() {
+    uint32_t rowCount;
+    if (!getU32(file, rowCount)) return false;      // clean end of file
+    if (rowCount == 0 || rowCount > TRACE_CHUNK_ROWS) {
+        lastError = "bad chunk header";
+        return false;
+    }
+
+    std::vector<uint8_t> bytes;
+    for (int c = 0; c < TRACE_COLUMN_COUNT; c++) {
+        uint32_t len;
+        if (!getU32(file, len)) {
+            lastError = "truncated chunk";
+            return false;
+        }
+        bytes.resize(len);
+        columns[c].resize(rowCount);
+        if (fread(bytes.data(), 1, len, file) != len
+            || !decodeColumn(bytes.data(), bytes.data() + len, traceColumns[c].type, columns[c].data(), rowCount)) {
+            lastError = std::string("corrupt column ") + traceColumns[c].name;
+            return false;
+        }
+    }
+    rows = rowCount;
+    position = 0;
+    return true;
+}
+
+bool TraceReader::next(TraceRow& row) {
+    if (!file) return false;
+    if (position == rows && !readChunk()) return false;
+
+    uint32_t i = position++;
+    row.millis = columns[COL_MILLIS][i];
+    for (int k = 0; k < 6; k++) row.temps[k] = (int16_t)columns[COL_WATER_INTAKE + k][i];
+    for (int k = 0; k < TRACE_RELAYS; k++) row.relays[k] = columns[COL_COMPRESSOR + k][i];
+    row.heatedAtLeastOnce = columns[COL_HEATED_AT_LEAST_ONCE][i];
+    row.startIsFinished = columns[COL_START_IS_FINISHED][i];
+    row.drawSign = columns[COL_DRAW_SIGN][i];
+    row.mode = columns[COL_MODE][i];
+    row.errors = columns[COL_ERRORS][i];
+    return true;
+}
+
+void TraceReader::close() {
+    if (file) fclose(file);
+    file = NULL;
+}
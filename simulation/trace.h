@@ -0,0 +1,190 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Columnar binary trace of simulator loop steps.
+//
+// File layout (little endian):
+//   "HPTRACE2"                       magic
+//   u16 columnCount
+//   columnCount x { u8 type, u8 nameLen, name[nameLen] }
+//   chunks until EOF:
+//     u32 rowCount
+//     columnCount x { u32 byteLen, bytes[byteLen] }
+//
+// Every column of a chunk is compressed on its own: each value is turned into
+// a residual against the previous row (zigzag delta for integers, XOR of the
+// bit pattern for floats), residuals are written as LEB128 varints and runs of
+// zero residuals collapse into a single "0, runLength" pair. Flags and relay
+// states barely change between steps, so they shrink to a few bytes per chunk.
+
+#define TRACE_MAGIC       "HPTRACE2"
+#define TRACE_CHUNK_ROWS  4096
+#define TRACE_QUEUE_SIZE  8
+
+enum TraceColumnType {
+    TRACE_U8  = 0,
+    TRACE_U32 = 1,
+    TRACE_F32 = 2,
+    TRACE_I16 = 3,
+};
+
+enum TraceColumn {
+    COL_MILLIS = 0,
+    COL_WATER_INTAKE,
+    COL_WATER_INJECT,
+    COL_COOLANT_INTAKE,
+    COL_COOLANT_INJECT,
+    COL_AIR_OUTSIDE,
+    COL_AIR_INSIDE,         // T6, TEMPS.dhwTank; named "airInside" in the file as before
+    COL_COMPRESSOR,
+    COL_FAN,
+    COL_DEFROST_VALVE,
+    COL_SUMP_HEATER,
+    COL_COMPRESSOR_HEATER,
+    COL_WATER_PUMP,
+    COL_WATER_VALVE,
+    COL_HEATED_AT_LEAST_ONCE,
+    COL_START_IS_FINISHED,
+    COL_DRAW_SIGN,
+    COL_MODE,
+    COL_ERRORS,
+    TRACE_COLUMN_COUNT
+};
+
+#define TRACE_RELAYS      (COL_WATER_VALVE - COL_COMPRESSOR + 1)
+
+// Bits of the COL_ERRORS column, in ERRORS field order. The pressure bits
+// stay clear unless the simulator is built with PRESSURE_ENABLED=1.
+#define TRACE_ERR_COMPRESSOR      0x01
+#define TRACE_ERR_DEFROST         0x02
+#define TRACE_ERR_T1              0x04
+#define TRACE_ERR_T2              0x08
+#define TRACE_ERR_T3              0x10
+#define TRACE_ERR_T4              0x20
+#define TRACE_ERR_T5              0x40
+#define TRACE_ERR_T6              0x80
+#define TRACE_ERR_P1              0x100
+#define TRACE_ERR_P2              0x200
+#define TRACE_ERR_HIGH_PRESSURE   0x400
+
+// Values of the COL_MODE column: the firmware's CONTROL_STATE. Traces from
+// before it only hold work and defrost.
+#define TRACE_MODE_WORK       0
+#define TRACE_MODE_DEFROST    1
+#define TRACE_MODE_STARTING   2
+#define TRACE_MODE_SATISFIED  3
+#define TRACE_MODE_FAULT      4
+
+struct TraceColumnInfo {
+    const char* name;
+    uint8_t type;
+};
+
+extern const TraceColumnInfo traceColumns[TRACE_COLUMN_COUNT];
+
+// One loop step, as handed to the writer and returned by the reader.
+struct TraceRow {
+    uint32_t millis;
+    int16_t temps[6];       // waterIntake .. dhwTank, 1/16 degree as in TEMPS
+    uint8_t relays[TRACE_RELAYS];       // compressor .. waterValve
+    uint8_t heatedAtLeastOnce;
+    uint8_t startIsFinished;
+    uint8_t drawSign;
+    uint8_t mode;
+    uint16_t errors;
+};
+
+// Raw column storage for up to TRACE_CHUNK_ROWS rows.
+struct TraceChunk {
+    uint32_t rows;
+    uint32_t u32[TRACE_COLUMN_COUNT][TRACE_CHUNK_ROWS];
+};
+
+// Single producer / single consumer queue of chunk pointers.
+class ChunkQueue {
+public:
+    ChunkQueue() : head(0), tail(0) {}
+    bool push(TraceChunk* chunk);
+    TraceChunk* pop();
+private:
+    TraceChunk* slots[TRACE_QUEUE_SIZE];
+    std::atomic<unsigned> head;
+    std::atomic<unsigned> tail;
+};
+
+// Appends rows from the simulation thread; a background thread compresses
+// full chunks and writes them out. append() never blocks and never touches
+// the file.
+class TraceWriter {
+public:
+    TraceWriter();
+    ~TraceWriter();
+
+    bool open(const char* path);
+    void append(const TraceRow& row);
+    void close();
+    bool isOpen() const { return file != NULL; }
+
+    unsigned long rowsWritten() const { return rowCount; }
+    unsigned long bytesWritten() const { return byteCount; }
+
+private:
+    void handOff();
+    void writerMain();
+    void writeChunk(const TraceChunk* chunk);
+    TraceChunk* takeFreeChunk();
+
+    FILE* file;
+    TraceChunk* current;
+    ChunkQueue full;        // simulation -> writer
+    ChunkQueue recycled;    // writer -> simulation
+    std::vector<TraceChunk*> allChunks;
+    std::atomic<bool> stopping;
+    std::thread writer;
+    std::vector<uint8_t> encoded;
+    unsigned long rowCount;
+    unsigned long byteCount;
+};
+
+// Sequential reader used by the converters.
+class TraceReader {
+public:
+    TraceReader();
+    ~TraceReader();
+
+    bool open(const char* path);
+    // Returns false at end of file or on a malformed chunk.
+    bool next(TraceRow& row);
+    void close();
+    const std::string& error() const { return lastError; }
+
+private:
+    bool readChunk();
+
+    FILE* file;
+    std::vector<uint32_t> columns[TRACE_COLUMN_COUNT];
+    uint32_t rows;
+    uint32_t position;
+    std::string lastError;
+};
+
+// A trace already in memory (typically a mapped file). traceIndex() checks
+// the header and finds every chunk without decoding it; chunks can then be
+// decoded in any order and from any thread.
+struct TraceChunkRef {
+    const uint8_t* columns;     // first column length of the chunk
+    const uint8_t* end;
+    uint32_t rows;
+};
+
+bool traceIndex(const uint8_t* data, size_t size, std::vector<TraceChunkRef>& chunks, std::string& error);
+bool traceDecodeChunk(const TraceChunkRef& ref, TraceChunk& out);
+
+#endif
@@ -0,0 +1,35 @@
+#include "trace.h"
+
+// Converts a binary simulator trace to CSV on stdout.
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <file.trace>\n", argv[0]);
+        return 2;
+    }
+
+    TraceReader reader;
+    if (!reader.open(argv[1])) {
+        fprintf(stderr, "%s: %s\n", argv[1], reader.error().c_str());
+        return 1;
+    }
+
+    for (int c = 0; c < TRACE_COLUMN_COUNT; c++) {
+        printf(c ? ",%s" : "%s", traceColumns[c].name);
+    }
+    printf("\n");
+
+    TraceRow row;
+    while (reader.next(row)) {
+        printf("%u", row.millis);
+        for (int k = 0; k < 6; k++) printf(",%.4f", row.temps[k] / 16.0);
+        for (int k = 0; k < TRACE_RELAYS; k++) printf(",%u", row.relays[k]);
+        printf(",%u,%u,%u,%u,%u\n", row.heatedAtLeastOnce, row.startIsFinished,
+               row.drawSign, row.mode, row.errors);
+    }
+
+    if (!reader.error().empty()) {
+        fprintf(stderr, "%s: %s\n", argv[1], reader.error().c_str());
+        return 1;
+    }
+    return 0;
+}
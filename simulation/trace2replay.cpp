@@ -0,0 +1,32 @@
+#include "trace.h"
+#include "replay.h"
+
+// Extracts the sensor inputs of a binary simulator trace as a replay file,
+// so a recorded run can be fed back with `simulator --replay`.
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <file.trace>\n", argv[0]);
+        return 2;
+    }
+
+    TraceReader reader;
+    if (!reader.open(argv[1])) {
+        fprintf(stderr, "%s: %s\n", argv[1], reader.error().c_str());
+        return 1;
+    }
+
+    writeReplayHeader(stdout);
+    TraceRow row;
+    while (reader.next(row)) {
+        ReplayRow replay;
+        replay.millis = row.millis;
+        for (int k = 0; k < 6; k++) replay.temps[k] = row.temps[k] / 16.0f;
+        writeReplayRow(stdout, replay);
+    }
+
+    if (!reader.error().empty()) {
+        fprintf(stderr, "%s: %s\n", argv[1], reader.error().c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -1,44 +1,155 @@
+#include <Arduino.h>
 #include <Wire.h>
 #include <SPI.h>
 #include <Adafruit_GFX.h>
-#include <Adafruit_SSD1306.h>
 #include <OneWire.h>
 #include <DallasTemperature.h>
+#include <EEPROM.h>
+#include "SSD1306PageDisplay.h"
+#include "ModbusRtuSlave.h"
+#include "FreeRunningAdc.h"
+#ifdef __AVR__
+#include <avr/sleep.h>
+#endif
 
 #define SCREEN_WIDTH 128 // OLED display width, in pixels
 #define SCREEN_HEIGHT 64 // OLED display height, in pixels
 
-// Declaration for an SSD1306 display connected to I2C (SDA, SCL pins)
-#define OLED_RESET     -1 // Reset pin # (or -1 if sharing Arduino reset pin)
-Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
+// Declaration for an SSD1306 display connected to I2C (SDA, SCL pins).
+// Rendered page by page: 128 bytes of RAM instead of a 1 KB framebuffer.
+SSD1306PageDisplay display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire);
 
 
 #define ONE_WIRE_BUS             14                                     // подключения DS18B20 на пине 8
 
+// Температуры хранятся как у DS18B20: int16 в 1/16 °C. Пороги переводятся
+// при компиляции, float остаётся только для вывода на экран и в лог.
+typedef int16_t temp_t;
+#define TEMP(c)            ((temp_t)((c) * 16))               // °C -> 1/16 °C, только для констант
+
+// Давления фреона - int16 в кПа избыточного.
+typedef int16_t pressure_t;
+#define BAR(b)             ((pressure_t)((b) * 100))          // бар -> кПа, только для констант
+
+#define DELTA_1            TEMP(1.0)                               // дельта 1
+#define DELTA_2            TEMP(2.0)                               // дельта 2
+#define DELTA_3            TEMP(3.0)                               // дельта 3
+#define WATER_HYSTERESIS   DELTA_2                                 // нагрев снова, когда вода на столько ниже waterTarget
+
+
+#define minSensorTemp          TEMP(-40.0)                         // мин. температура, нижний придел NTC ERR
+#define maxSensorTemp          TEMP(110.0)                         // макс. температура, верхний придел NTC ERR
+#define startCoolantTemp        TEMP(35.0)                         // стартовая прог-ма по нагнетанию переход в work без подогрева картера компрессора
+#define compressorHeaterTemp    TEMP(-5.0)                         // включение нагревателя картера компрессора
+#define sumpHeaterTemp           TEMP(5.0)                         // целевая температура наружного датчика воздух
+#define sumpSuctionTemp          TEMP(5.0)                         // рабочая температура фреона всасывания выключение оттайки
+#define waterTargetTemp         TEMP(40.0)                         // макс. температура воды нагнетания (потолок кривой)
+#define fanTargetTemp           TEMP(70.0)                         // рабочая температура фреона нагнетания
+#define heatedAtLeastOnceTemp   TEMP(66.0)                         // рабочая температура первоначального выхода перед выходом в ошибку "контрольная точка" 76.0
+#define defrostTemp             TEMP(65.0)                         // рабочая температура фреона нагнетания включения оттайки
+#define dhwTargetTemp           TEMP(50.0)                         // температура бойлера ГВС, нагрев с DELTA_3 ниже
+#define pumpDeltaTemp           TEMP(5.0)                          // перепад T2 - T1 на конденсаторе, который держит циркуляционный насос
+
+// Уставки, которые можно менять по Modbus; значения выше — заводские.
+struct SETPOINTS {
+    temp_t waterLimit;              // waterTargetTemp
+    temp_t fanTarget;               // fanTargetTemp
+    temp_t heatedMark;              // heatedAtLeastOnceTemp
+    temp_t defrostStart;            // defrostTemp
+    temp_t defrostStop;             // sumpSuctionTemp
+    temp_t sumpHeaterBelow;         // sumpHeaterTemp
+    temp_t compressorHeaterBelow;   // compressorHeaterTemp
+    temp_t startCoolant;            // startCoolantTemp
+};
 
-#define DELTA_1            1.0                                // дельта 1
-#define DELTA_2            2.0                                // дельта 2
-#define DELTA_3            3.0                                // дельта 3
+const SETPOINTS defaultSetpoints = {
+    waterTargetTemp,
+    fanTargetTemp,
+    heatedAtLeastOnceTemp,
+    defrostTemp,
+    sumpSuctionTemp,
+    sumpHeaterTemp,
+    compressorHeaterTemp,
+    startCoolantTemp,
+};
 
+SETPOINTS setpoints = defaultSetpoints;
 
-#define minSensorTemp          -40.0                               // мин. температура, нижний придел NTC ERR
-#define maxSensorTemp          110.0                               // макс. температура, верхний придел NTC ERR
-#define startCoolantTemp        35.0                               // стартовая прог-ма по нагнетанию переход в work без подогрева картера компрессора
-#define compressorHeaterTemp    -5.0                               // включение нагревателя картера компрессора
-#define sumpHeaterTemp           5.0                               // целевая температура наружного датчика воздух
-#define sumpSuctionTemp          5.0                               // рабочая температура фреона всасывания выключение оттайки
-#define waterTargetTemp         40.0                               // рабочая температура воды нагнетания
-#define fanTargetTemp           70.0                               // рабочая температура фреона нагнетания
-#define heatedAtLeastOnceTemp   66.0                               // рабочая температура первоначального выхода перед выходом в ошибку "контрольная точка" 76.0
-#define defrostTemp             65.0                               // рабочая температура фреона нагнетания включения оттайки
+// Погодозависимая кривая: температура воды нагнетания от наружного воздуха,
+// точки по возрастанию airOutside. Заводские точки во флеше, рабочие в RAM
+// (меняются по Modbus).
+#define CURVE_POINTS           5
+
+struct CURVE_POINT {
+    temp_t airOutside;
+    temp_t water;
+};
+
+const CURVE_POINT defaultCurve[CURVE_POINTS] PROGMEM = {
+    {TEMP(-20.0), TEMP(40.0)},
+    {TEMP(-10.0), TEMP(38.0)},
+    {TEMP(0.0),   TEMP(35.0)},
+    {TEMP(10.0),  TEMP(31.0)},
+    {TEMP(20.0),  TEMP(27.0)},
+};
+
+CURVE_POINT heatingCurve[CURVE_POINTS];
+temp_t waterTarget = waterTargetTemp;                             // уставка воды на этот цикл: по кривой или ГВС
+temp_t dhwTarget = dhwTargetTemp;                                 // уставка бойлера ГВС (меняется по Modbus)
+temp_t pumpDelta = pumpDeltaTemp;                                 // уставка перепада T2 - T1 (меняется по Modbus)
+
+#define SERIAL_BAUD            115200                             // скорость Serial / RS-485
+#ifndef MODBUS_SLAVE_ID
+#define MODBUS_SLAVE_ID        1                                  // адрес Modbus RTU; 0 - без Modbus, в Serial идёт текстовый лог
+#endif
+
+// Лог: уровень (LOG_LEVEL_NONE/ERROR/INFO/DEBUG) и категории SENSORS, CONTROL,
+// DISPLAY (LOG_CAT_*, 0 или 1). Выключенное не попадает в прошивку.
+#ifndef LOG_LEVEL
+#if MODBUS_SLAVE_ID
+#define LOG_LEVEL              LOG_LEVEL_NONE                     // Serial занят Modbus
+#else
+#define LOG_LEVEL              LOG_LEVEL_INFO
+#endif
+#endif
+#include "Log.h"
+
+#if MODBUS_SLAVE_ID && LOG_LEVEL != LOG_LEVEL_NONE
+#error "Serial is the Modbus port: set LOG_LEVEL to LOG_LEVEL_NONE or MODBUS_SLAVE_ID to 0"
+#endif
+
+#ifndef DHW_ENABLED
+#define DHW_ENABLED            0                                  // 1 - есть бойлер ГВС: датчик T6 и трёхходовой клапан waterValve
+#endif
+#ifndef PRESSURE_ENABLED
+#define PRESSURE_ENABLED       0                                  // 1 - есть датчики давления P1 (нагнетание) и P2 (всасывание)
+#endif
+
+// Датчики давления: 0.5-4.5 В от питания 5 В, на АЦП в свободном режиме.
+#define highPressureChannel    0                                  // АЦП0 (A0): P1, сторона нагнетания
+#define lowPressureChannel     1                                  // АЦП1 (A1): P2, сторона всасывания
+#define highPressureSpan       BAR(45.0)                          // P1 при 4.5 В
+#define lowPressureSpan        BAR(18.0)                          // P2 при 4.5 В
+#define highPressureLimit      BAR(38.0)                          // P1 выше - компрессор стоп, ошибка
+#define defrostPressure        BAR(2.0)                           // P2 ниже - испаритель во льду, оттайка
+#define pressureSettleTime     120000 //2 min                     P2 после пуска компрессора и после оттайки ещё не показатель
+#define PRESSURE_ZERO          (ADC_READING_MAX / 10)             // 0.5 В: 0 бар
+#define PRESSURE_FULL          (ADC_READING_MAX * 9 / 10)         // 4.5 В: верх шкалы
+#define PRESSURE_WIRE_LOW      (ADC_READING_MAX / 20)             // ниже 0.25 В - обрыв датчика
+#define PRESSURE_WIRE_HIGH     (ADC_READING_MAX * 19 / 20)        // выше 4.75 В - замыкание на питание
 
 struct TEMPS {
-    float waterIntake;
-    float waterInject;
-    float coolantIntake;
-    float coolantInject;
-    float airOutside;
-    float airInside;
+    temp_t waterIntake;
+    temp_t waterInject;
+    temp_t coolantIntake;
+    temp_t coolantInject;
+    temp_t airOutside;
+    temp_t dhwTank;
+};
+
+struct PRESSURES {
+    pressure_t high;
+    pressure_t low;
 };
 
 struct DEVICES {
@@ -48,6 +159,7 @@ struct DEVICES {
     bool sumpHeater;
     bool compressorHeater;
     bool waterPump;
+    bool waterValve;
 };
 
 struct ERRORS {
@@ -59,13 +171,18 @@ struct ERRORS {
     bool t4Error;
     bool t5Error;
     bool t6Error;
+    bool p1Error;
+    bool p2Error;
+    bool highPressureError;
 };
 
 struct STATE {
     TEMPS temps;
     DEVICES devices;
     ERRORS errors;
-    int millis;
+    unsigned long millis;
+    uint8_t controlState;           // CONTROL_STATE
+    uint8_t recentFaults;           // ошибок в окне faultWindowTime
 };
 
 
@@ -79,45 +196,330 @@ unsigned int stateIndex = 0;
 #define compressor           12                                     //реле компрессора
 #define fan                  2                                     //реле вентилятора испарителя
 #define defrostValve         16                                     //реле клапана оттайки
-#define sumpHeater           0                                     //реле подогрева поддона
-#define compressorHeater      21                                     //реле подогрева картера компрессора
+#define sumpHeater           23                                     //реле подогрева поддона
+#define compressorHeater      24                                     //реле подогрева картера компрессора
 #define waterCirculationPump  13                                     //реле циркуляционного насоса
-#define waterPump             21                                     //реле клапана
-#define waterValve          21                                     //реле клапана
+#define waterPump             25                                     //реле клапана
+#define waterValve           22                                     //реле трёхходового клапана ГВС, свободный пин (PA0)
+#define fanPwm               4                                     //ШИМ скорости вентилятора испарителя
+
+// Пины 0/1 — UART0 (Serial, Modbus), 20/21 — TWI (SDA/SCL дисплея).
+#define PIN_RESERVED(pin)    ((pin) == 0 || (pin) == 1 || (pin) == 20 || (pin) == 21)
+#if PIN_RESERVED(compressor) || PIN_RESERVED(fan) || PIN_RESERVED(defrostValve) || PIN_RESERVED(sumpHeater) \
+    || PIN_RESERVED(compressorHeater) || PIN_RESERVED(waterPump) || PIN_RESERVED(waterValve) \
+    || PIN_RESERVED(waterCirculationPump) || PIN_RESERVED(fanPwm)
+#error "a relay or PWM output is on a UART0 or TWI pin"
+#endif
+
+// Все выходы: реле, затем ШИМ. Ни один пин не занят дважды.
+constexpr uint8_t outputPins[] = {compressor, fan, defrostValve, sumpHeater, compressorHeater, waterPump,
+                                  waterValve, waterCirculationPump, fanPwm};
+#define OUTPUT_PINS          ((uint8_t)(sizeof(outputPins) / sizeof(outputPins[0])))
+
+// True if no two of outputPins[i..] share a pin; j runs over those after i.
+constexpr bool outputPinsDistinct(uint8_t i = 0, uint8_t j = 1) {
+    return i + 1 >= OUTPUT_PINS ? true
+           : j >= OUTPUT_PINS   ? outputPinsDistinct(i + 1, i + 2)
+                                : outputPins[i] != outputPins[j] && outputPinsDistinct(i, j + 1);
+}
+static_assert(outputPinsDistinct(), "two outputs share a pin");
+
+// ШИМ циркуляционного насоса (waterCirculationPump), скважность analogWrite 0..255
+#define PUMP_DUTY_MIN          64                                   // мин. проток: ниже насос не опускается, пока включён
+#define PUMP_DUTY_MAX          255
+#define PUMP_RAMP_STEP         8                                    // плавный пуск: макс. изменение скважности за цикл
+#define PUMP_GAIN_DIV          4                                    // шаг скважности = ошибка перепада (1/16 °C) / PUMP_GAIN_DIV
+
+// ПИ-регулятор вентилятора по T4 (coolantInject), скважность fanPwm 0..255.
+// Коэффициенты в Q8: скважность * 256 на 1/16 °C ошибки.
+#define FAN_DUTY_MIN           51                                   // мин. обороты: ниже регулятор выключает вентилятор
+#define FAN_DUTY_MAX           255
+#define FAN_KP                 1024                                 // 4 единицы скважности на 1/16 °C, вся шкала на 4 °C
+#define FAN_KI                 8                                    // за цикл 700 мс, интеграл догоняет П-часть за ~2 мин
+#define FAN_Q                  8                                    // дробные биты FAN_KP, FAN_KI и fanIntegral
 
 
 
 #define errorTime              3600000 //10 min                 //период  ошибки, в милисекундах
 #define compressorDelayTime     30000 //5 min                  стартовая прог-ма отложеный старт по нагнетанию (5мин. = 300000)
 #define heatingDelayTime       1200000 //20 min                 стартовая прог-ма отложеный старт по наружной температуре ниже -5,вкл. нагрева картера компрессора
+#define valveDwellTime          180000 //3 min                  мин. время клапана ГВС в одном положении
+#define compressorMinRunTime    180000 //3 min                  мин. работа компрессора, прежде чем вода на уставке его остановит
+#define dhwSliceTime           1800000 //30 min                 макс. время на ГВС подряд
+#define heatingSliceTime        900000 //15 min                 мин. время на отоплении, прежде чем ГВС его прервёт
+#define faultCooldownTime       300000 //5 min                  пауза после ошибки до повторного пуска, удваивается с каждой ошибкой окна
+#define faultWindowTime       21600000 //6 h                    окно подсчёта ошибок от первой из них
+#define FAULT_RETRY_LIMIT            4 //                       ошибок в окне, после которых ждём перезагрузки
+#define counterSaveTime        3600000 //1 h                    период записи счётчиков реле в EEPROM
+
+// Режимы работы контроллера. STATE_HEATING и STATE_DEFROSTING идут первыми:
+// их номера 0 и 1 совпадают со старым mode (work/defrost) в Modbus и в трассе.
+enum CONTROL_STATE : uint8_t {
+    STATE_HEATING,                  // компрессор работает на нагрев воды
+    STATE_DEFROSTING,               // клапан оттайки открыт, вентилятор стоит
+    STATE_STARTING,                 // стартовая программа перед пуском
+    STATE_SATISFIED,                // вода на уставке, компрессор стоит
+    STATE_FAULT,                    // ошибка: всё выключено до повтора или перезагрузки
+    STATE_COUNT,
+    STATE_RESUME = STATE_COUNT,     // в таблице: вернуться в прерванный режим
+    STATE_NONE,                     // в таблице: событие в этом режиме не действует
+};
 
-String mode = "work";
+enum CONTROL_EVENT : uint8_t {
+    EVENT_STARTED,                  // стартовая программа закончена
+    EVENT_WATER_AT_TARGET,          // waterInject >= waterTarget, компрессор отработал compressorMinRunTime
+    EVENT_WATER_LOW,                // waterInject < waterTarget - WATER_HYSTERESIS
+    EVENT_DEFROST,                  // испаритель пора оттаивать
+    EVENT_DEFROSTED,                // испаритель оттаял
+    EVENT_RESTART,                  // повторить стартовую программу
+    EVENT_FAULT,                    // защёлкнута ошибка
+    EVENT_RETRY,                    // пауза после ошибки вышла, ошибки сброшены
+    EVENT_COUNT,
+};
 
+// Переходы: новый режим по текущему режиму и событию.
+const uint8_t transitions[STATE_COUNT][EVENT_COUNT] PROGMEM = {
+    //                STARTED        AT_TARGET        WATER_LOW     DEFROST           DEFROSTED      RESTART         FAULT        RETRY
+    /* HEATING    */ {STATE_NONE,    STATE_SATISFIED, STATE_NONE,   STATE_DEFROSTING, STATE_NONE,    STATE_STARTING, STATE_FAULT, STATE_NONE},
+    /* DEFROSTING */ {STATE_NONE,    STATE_SATISFIED, STATE_NONE,   STATE_NONE,       STATE_HEATING, STATE_NONE,     STATE_FAULT, STATE_NONE},
+    /* STARTING   */ {STATE_HEATING, STATE_SATISFIED, STATE_NONE,   STATE_NONE,       STATE_NONE,    STATE_NONE,     STATE_FAULT, STATE_NONE},
+    /* SATISFIED  */ {STATE_NONE,    STATE_NONE,      STATE_RESUME, STATE_NONE,       STATE_NONE,    STATE_NONE,     STATE_FAULT, STATE_NONE},
+    /* FAULT      */ {STATE_NONE,    STATE_NONE,      STATE_NONE,   STATE_NONE,       STATE_NONE,    STATE_NONE,     STATE_NONE,  STATE_STARTING},
+};
 
-void stopAll(bool withDefrost=false);
+CONTROL_STATE controlState = STATE_STARTING;
+CONTROL_STATE resumeState = STATE_STARTING;                     // куда вернуться из STATE_SATISFIED
+uint16_t stateEntries[STATE_COUNT];                             // счётчики входов в каждый режим
+unsigned long stateSince = 0;                                   // millis() входа в текущий режим
+uint8_t recentFaults = 0;                                       // ошибок с начала окна faultWindowTime
+unsigned long faultWindowStart = 0;                             // millis() первой ошибки окна
+bool faultLatched = false;                                      // FAULT_RETRY_LIMIT ошибок в окне: только перезагрузка
+
+// Счётчики реле: копятся с первого запуска, раз в counterSaveTime пишутся в EEPROM.
+enum RELAY_COUNTER : uint8_t {
+    COUNTER_COMPRESSOR,
+    COUNTER_FAN,
+    COUNTER_DEFROST,
+    COUNTER_SUMP_HEATER,
+    COUNTER_COMPRESSOR_HEATER,
+    COUNTER_PUMP,
+    COUNTER_WATER_VALVE,
+    COUNTER_COUNT,
+};
 
-OneWire oneWire(ONE_WIRE_BUS);
-DallasTemperature sensors(&oneWire);
+struct RELAY_COUNTERS {
+    unsigned long onSeconds;        // наработка, с
+    unsigned long starts;           // включения
+    unsigned long longestSeconds;   // самая долгая работа без остановки, с
+    unsigned long energyWh;         // энергия по номинальной мощности, Вт·ч
+    uint16_t onMs;                  // остаток наработки меньше секунды, мс
+    uint16_t energyWs;              // остаток энергии меньше 1 Вт·ч, Вт·с
+};
 
-DeviceAddress waterIntakeSensor = {
-        0x28, 0x53, 0x8E, 0x95, 0xF0, 0x01, 0x3C, 0x34        // адрес датчика T1
+// Номинальная мощность реле, Вт; 0 - энергия не считается.
+const uint16_t relayPower[COUNTER_COUNT] PROGMEM = {
+    1500,                           // компрессор
+    90,                             // вентилятор, на полных оборотах
+    0,                              // клапан оттайки
+    150,                            // подогрев поддона
+    60,                             // подогрев картера
+    45,                             // насос, на полных оборотах
+    0,                              // клапан ГВС
 };
-DeviceAddress waterInjectSensor = {
-        0x28, 0x8A, 0x3D, 0x95, 0xF0, 0xFF, 0x3C, 0x22         // адрес датчика T2
+
+#define COUNTERS_MAGIC         0x5243                             // в EEPROM лежат счётчики этой раскладки
+#define COUNTERS_ADDRESS       0                                  // адрес в EEPROM
+
+struct SAVED_COUNTERS {
+    uint16_t magic;
+    RELAY_COUNTERS relays[COUNTER_COUNT];
 };
-DeviceAddress coolantIntakeSensor = {
-        0x28, 0xA6, 0x93, 0x95, 0xF0, 0x01, 0x3C, 0x3D         // адрес датчика T3
+
+SAVED_COUNTERS counters;
+unsigned long counterSince[COUNTER_COUNT];                      // millis(), до которого наработка учтена
+unsigned long runSince[COUNTER_COUNT];                          // millis() включения реле
+unsigned long countersSavedTime = 0;
+uint8_t counterLogNext = COUNTER_COUNT;                         // следующее реле в лог после записи
+
+// Тренды: min/max/среднее каждого датчика и доля работы каждого реле за
+// минуту, час и сутки, в кольцах фиксированного размера (не больше 32).
+#define ROLLUP_CHANNELS        (sizeof(TEMPS) / sizeof(temp_t))
+#define ROLLUP_MINUTES         10                                 // последние минуты
+#define ROLLUP_HOURS           24                                 // последние часы
+#define ROLLUP_DAYS            7                                  // последние сутки
+
+struct ROLLUP {
+    temp_t min[ROLLUP_CHANNELS];
+    temp_t max[ROLLUP_CHANNELS];
+    temp_t mean[ROLLUP_CHANNELS];
+    uint8_t duty[COUNTER_COUNT];    // доля отсчётов с включённым реле, 0..255
 };
-DeviceAddress coolantInjectSensor = {
-        0x28, 0x66, 0xC6, 0x95, 0xF0, 0x01, 0x3C, 0xE5        // адрес датчика T4
+
+// Открытый период: суммы, min/max и число отсчётов.
+struct ROLLUP_SUM {
+    int32_t sum[ROLLUP_CHANNELS];
+    temp_t min[ROLLUP_CHANNELS];
+    temp_t max[ROLLUP_CHANNELS];
+    uint32_t on[COUNTER_COUNT];
+    uint32_t samples;
 };
-DeviceAddress outsideAirSensor = {
-        0x28, 0x32, 0xBD, 0x56, 0xB5, 0x01, 0x3C, 0xBF         // адрес датчика T5
+
+// Состояние уровня; кольцо уровня l лежит в rollupRings[l].
+struct ROLLUP_LEVEL {
+    unsigned long periodMs;
+    uint8_t size;
+    uint8_t next;                   // куда ляжет следующий закрытый период
+    uint8_t count;                  // закрытых периодов в кольце
+    unsigned long period;           // номер открытого периода, millis() / periodMs
+    ROLLUP_SUM open;
 };
-DeviceAddress insideAirSensor = {
-        0x28, 0x32, 0xBD, 0x56, 0xB5, 0x01, 0x3C, 0xBF        // адрес датчика T6
+
+ROLLUP rollupMinutes[ROLLUP_MINUTES];
+ROLLUP rollupHours[ROLLUP_HOURS];
+ROLLUP rollupDays[ROLLUP_DAYS];
+
+#define ROLLUP_LEVELS          3
+ROLLUP* const rollupRings[ROLLUP_LEVELS] = {rollupMinutes, rollupHours, rollupDays};
+ROLLUP_LEVEL rollupLevels[ROLLUP_LEVELS] = {
+    {60000UL, ROLLUP_MINUTES, 0, 0, 0, {}},
+    {3600000UL, ROLLUP_HOURS, 0, 0, 0, {}},
+    {86400000UL, ROLLUP_DAYS, 0, 0, 0, {}},
 };
 
+#if LOG_LEVEL != LOG_LEVEL_NONE
+LogBuffer logBuffer;
+#endif
+
+
+void stopAll(bool withDefrost=false);
+bool controlEvent(CONTROL_EVENT event);
+void enterState(CONTROL_STATE to);
+void enterHeating();
+void enterDefrosting();
+void exitDefrosting(CONTROL_STATE to);
+void enterSatisfied();
+void enterFault();
+void startingTick();
+void heatingTick();
+void defrostingTick();
+void faultTick();
+void clearErrors();
+void sumpHeaterCheck();
+bool checkCompressorError();
+void checkDefrostError();
+bool waterPumpControl();
+void pumpSpeedControl();
+void fanControl();
+void defrostStartControl();
+bool defrostStopControl();
+void startCompressor();
+void stopCompressor();
+void startFan();
+void stopFan();
+void startDefrost();
+void stopDefrost();
+void startSumpHeater();
+void stopSumpHeater();
+void startCompressorHeater();
+void stopCompressorHeater();
+void startPump();
+void stopPump();
+void startWaterValve();
+void stopWaterValve();
+void dhwSchedule();
+bool waterAtTarget();
+bool waterLow();
+void relayStarted(RELAY_COUNTER r);
+void relayAccumulate(RELAY_COUNTER r);
+void loadCounters();
+void saveCounters();
+void switchPins();
+void switchCompressorPin();
+void switchFanPin();
+void switchDefrostPin();
+void switchCompressorHeaterPin();
+void switchSumpHeaterPin();
+void switchWaterPumpPin();
+void switchWaterValvePin();
+void switchCirculationPumpPin();
+void switchFanPwmPin();
+void reDrawScreen();
+void drawScreen();
+void drawRelaysState();
+void drawTemp(String text, temp_t temp, int x, int y);
+void drawTemps();
+float toCelsius(temp_t temp);
+temp_t readTemp(const uint8_t* addr);
+void printTemps();
+TEMPS getAllTemps();
+void checkTemps(const TEMPS& temps);
+PRESSURES getPressures();
+pressure_t toPressure(uint16_t reading, pressure_t span);
+void pressureGuard();
+bool hasErrors();
+void controlStep();
+void drawText(String text, int x = 0, int y = 0);
+void drawErrors();
+void drawErrorsScreen();
+void drawStart(temp_t coolantInjectTemp, temp_t airOutsideTemp);
+void start(temp_t coolantInjectTemp, temp_t airOutsideTemp);
+unsigned long calculateDelay(temp_t temp);
+temp_t curveTarget(temp_t airOutside);
+void saveState();
+void updateStateIndex();
+void rollupInit();
+void rollupSample();
+void rollupClear(ROLLUP_SUM& s);
+void rollupMerge(ROLLUP_SUM& into, const ROLLUP_SUM& from);
+void rollupClose(uint8_t l);
+void serviceDelay(unsigned long ms);
+void sleepUntilInterrupt();
+void convertTemperatures();
+void serviceModbus();
+void serviceLog();
+bool readInputRegister(uint16_t reg, uint16_t& value);
+bool readCounterRegister(uint16_t reg, uint16_t& value);
+bool readRollupRegister(uint16_t reg, uint16_t& value);
+bool readHoldingRegister(uint16_t reg, uint16_t& value);
+uint8_t writeHoldingRegister(uint16_t reg, uint16_t value, bool apply);
+temp_t* holdingRegister(uint16_t reg);
+
+OneWire oneWire(ONE_WIRE_BUS);
+DallasTemperature sensors(&oneWire);
+
+// Адреса датчиков DS18B20 (последний байт — CRC).
+#define T1_ADDRESS         0x28, 0x53, 0x8E, 0x95, 0xF0, 0x01, 0x3C, 0x34         // адрес датчика T1
+#define T2_ADDRESS         0x28, 0x8A, 0x3D, 0x95, 0xF0, 0xFF, 0x3C, 0x22         // адрес датчика T2
+#define T3_ADDRESS         0x28, 0xA6, 0x93, 0x95, 0xF0, 0x01, 0x3C, 0x3D         // адрес датчика T3
+#define T4_ADDRESS         0x28, 0x66, 0xC6, 0x95, 0xF0, 0x01, 0x3C, 0xE5         // адрес датчика T4
+#define T5_ADDRESS         0x28, 0x32, 0xBD, 0x56, 0xB5, 0x01, 0x3C, 0xBF         // адрес датчика T5
+#define T6_ADDRESS         0x28, 0x00, 0x00, 0x00, 0x00, 0x00, 0x06, 0xC3         // T6 (бойлер ГВС): заглушка, впишите адрес своего датчика
+
+DeviceAddress waterIntakeSensor = {T1_ADDRESS};
+DeviceAddress waterInjectSensor = {T2_ADDRESS};
+DeviceAddress coolantIntakeSensor = {T3_ADDRESS};
+DeviceAddress coolantInjectSensor = {T4_ADDRESS};
+DeviceAddress outsideAirSensor = {T5_ADDRESS};
+DeviceAddress dhwTankSensor = {T6_ADDRESS};
+
+// Те же адреса для проверки при сборке: у каждого датчика свой.
+constexpr uint8_t sensorAddresses[][8] = {{T1_ADDRESS}, {T2_ADDRESS}, {T3_ADDRESS},
+                                          {T4_ADDRESS}, {T5_ADDRESS}, {T6_ADDRESS}};
+#define SENSOR_COUNT       ((uint8_t)(sizeof(sensorAddresses) / sizeof(sensorAddresses[0])))
+
+// True if sensors i and j have the same address from byte b on.
+constexpr bool sameAddress(uint8_t i, uint8_t j, uint8_t b = 0) {
+    return b == 8 || (sensorAddresses[i][b] == sensorAddresses[j][b] && sameAddress(i, j, b + 1));
+}
+
+// True if no two of sensorAddresses[i..] match; j runs over those after i.
+constexpr bool sensorAddressesDistinct(uint8_t i = 0, uint8_t j = 1) {
+    return i + 1 >= SENSOR_COUNT ? true
+           : j >= SENSOR_COUNT   ? sensorAddressesDistinct(i + 1, i + 2)
+                                 : !sameAddress(i, j) && sensorAddressesDistinct(i, j + 1);
+}
+static_assert(sensorAddressesDistinct(), "two DS18B20 sensors share an address");
+
 bool isCompressorStarted = false;
 unsigned long compressorStartedTime = millis();
 unsigned long compressorStoppedTime = millis();
@@ -142,14 +544,33 @@ bool isPumpStarted = false;
 unsigned long pumpStartedTime = millis();
 unsigned long pumpStoppedTime = millis();
 
+bool isWaterValveStarted = false;                               // клапан на ГВС, иначе на отопление
+unsigned long waterValveStartedTime = millis();
+unsigned long waterValveStoppedTime = millis();
+bool dhwDemand = false;                                         // бойлер ГВС просит нагрева
+
+// Реле в порядке RELAY_COUNTER.
+bool* const relayStates[COUNTER_COUNT] = {
+    &isCompressorStarted,
+    &isFanStarted,
+    &isDefrostStarted,
+    &isSumpHeaterStarted,
+    &isCompressorHeaterStarted,
+    &isPumpStarted,
+    &isWaterValveStarted,
+};
+
+uint8_t pumpDuty = 0;                                           // скважность ШИМ циркуляционного насоса, 0 - стоит
+uint8_t fanDuty = 0;                                            // скважность ШИМ вентилятора, 0 - стоит
+int32_t fanIntegral = 0;                                        // интеграл ПИ-регулятора вентилятора, Q8
+
 
-bool startIsFinished = false;
 unsigned long targetDelay = 0;
 
 
 bool stateHasChanged = true;
 bool tempHasChanged = true;
-float tempsSum = 0;
+long tempsSum = 0;
 
 bool compressorError = false;
 bool defrostError = false;
@@ -159,6 +580,9 @@ bool t3Error = false;
 bool t4Error = false;
 bool t5Error = false;
 bool t6Error = false;
+bool p1Error = false;                                           // обрыв или замыкание датчика P1
+bool p2Error = false;                                           // обрыв или замыкание датчика P2
+bool highPressureError = false;                                 // P1 дошло до highPressureLimit
 
 bool heatedAtLeastOnce = false;
 bool drawSign = false;
@@ -173,28 +597,52 @@ int waterPumpFlag = 0;
 int waterValveFlag = 0;
 
 TEMPS t;
+PRESSURES p;
+
+#if PRESSURE_ENABLED
+// Каналы АЦП в порядке PRESSURES.
+const uint8_t pressureChannels[] = {highPressureChannel, lowPressureChannel};
+static_assert(sizeof pressureChannels <= ADC_CHANNELS_MAX, "more pressure channels than ADC_CHANNELS_MAX");
+FreeRunningAdc pressureAdc(pressureChannels, sizeof pressureChannels);
+
+ISR(ADC_vect) {
+    pressureAdc.onConversion(ADC);
+}
+#endif
+
+#if MODBUS_SLAVE_ID
+ModbusRtuSlave modbus(Serial, MODBUS_SLAVE_ID, readInputRegister, readHoldingRegister, writeHoldingRegister);
+#endif
 
 void setup() {
-    Serial.begin(115200);
+    memcpy_P(heatingCurve, defaultCurve, sizeof(heatingCurve));
+
+    Serial.begin(SERIAL_BAUD);
+#if MODBUS_SLAVE_ID
+    modbus.begin(SERIAL_BAUD);
+#endif
 
     //   SSD1306_SWITCHCAPVCC = generate display voltage from 3.3V internally
     if (!display.begin(SSD1306_SWITCHCAPVCC, 0x3c)) { // Address 0x3D for 128x64
-        Serial.println(F("SSD1306 allocation failed"));
+        LOG_ERROR(DISPLAY, F("SSD1306 init failed"));
         //        for (;;); // Don't proceed, loop forever
     }
 
-    // Show initial display buffer contents on the screen --
-    // the library initializes this with an Adafruit splash screen.
-      display.display();
-      delay(200); // Pause for 2 seconds
+    // Controller RAM holds noise after power-up; push one blank frame.
+    display.firstPage();
+    while (display.nextPage());
+    delay(200);
 
     // Wire.begin();
     sensors.begin();
+    sensors.setWaitForConversion(false);            // convertTemperatures() sleeps instead
     sensors.setResolution(waterInjectSensor, 8);
     sensors.setResolution(coolantIntakeSensor, 8);
     sensors.setResolution(coolantInjectSensor, 8);
     sensors.setResolution(outsideAirSensor, 8);
-    // sensors.setResolution(insideAirSensor, 8);
+#if DHW_ENABLED
+    sensors.setResolution(dhwTankSensor, 8);
+#endif
 
 
 
@@ -206,6 +654,13 @@ void setup() {
     pinMode(waterPump, OUTPUT);              // пин вкл/выкл. реле водяного насоса У6
     pinMode(waterValve, OUTPUT);
     // пин вкл/выкл. реле водяного клапана У7
+    pinMode(waterCirculationPump, OUTPUT);    // ШИМ скорости циркуляционного насоса
+    pinMode(fanPwm, OUTPUT);                  // ШИМ скорости вентилятора
+#if PRESSURE_ENABLED
+    pressureAdc.begin();                      // к концу delay() ниже уже есть показания
+#endif
+    loadCounters();
+    rollupInit();
     stopAll(true);
     switchPins();
     delay(1000);
@@ -216,142 +671,356 @@ void setup() {
 
 void loop() {
 
-    delay(700);
+    serviceDelay(700);
 
     t = getAllTemps();
+#if PRESSURE_ENABLED
+    p = getPressures();
+#endif
 
 //    saveState();
 
-    if (compressorError || defrostError || t1Error || t2Error || t3Error || t4Error || t5Error) {
-        stopAll(true);
-        Serial.println("DrawErrors");
+    controlStep();
+    saveCounters();
+    rollupSample();
+
+    if (controlState == STATE_FAULT) {
+        LOG_INFO(CONTROL, F("DrawErrors"));
         drawErrors();
-        return;
+    } else {
+        reDrawScreen();
     }
 
-    reDrawScreen();
-    if(t.waterInject >= waterTargetTemp) {
-        //TODO add something on screen later;
-        stopAll();
-        return;
-    }
-    start(t.coolantInject, t.airOutside);
+//    switchPins();
+}
 
+bool hasErrors() {
+    return compressorError || defrostError || t1Error || t2Error || t3Error || t4Error || t5Error
+           || (DHW_ENABLED && t6Error) || (PRESSURE_ENABLED && (p1Error || p2Error || highPressureError));
+}
 
-    sumpHeaterCheck();              // нужна ли оттайка
-    compressorControl();            // управление компрессором
-    if (isCompressorStarted) {
-        checkCompressorError();
-        waterPumpControl();             // управление водяным насосом
-        fanControl();                   // управление вентилятором
-        defrostStartControl();               // управление оттайкой
-        defrostStopControl();               // управление оттайкой
-        checkDefrostError();
+// Entry, exit and per-cycle actions of each state; NULL where there are none.
+// The exit action is told the state that comes next.
+struct STATE_HANDLERS {
+    void (*enter)();
+    void (*exit)(CONTROL_STATE to);
+    void (*tick)();
+};
+
+const STATE_HANDLERS stateHandlers[STATE_COUNT] = {
+    // enter            exit            tick
+    {enterHeating,      NULL,           heatingTick},       // STATE_HEATING
+    {enterDefrosting,   exitDefrosting, defrostingTick},    // STATE_DEFROSTING
+    {NULL,              NULL,           startingTick},      // STATE_STARTING
+    {enterSatisfied,    NULL,           NULL},              // STATE_SATISFIED
+    {enterFault,        NULL,           faultTick},         // STATE_FAULT
+};
+
+// Relay decisions for one cycle on the readings in t. Split out of loop() so
+// host tools can drive the control rules without sensors or display.
+void controlStep() {
+    if (hasErrors()) controlEvent(EVENT_FAULT);
+    waterTarget = curveTarget(t.airOutside);
+#if DHW_ENABLED
+    if (controlState != STATE_DEFROSTING && controlState != STATE_FAULT) dhwSchedule();
+    if (isWaterValveStarted) waterTarget = dhwTarget;
+#endif
+    if (waterAtTarget()) {
+        if (!isCompressorStarted || millis() - compressorStartedTime >= compressorMinRunTime) {
+            controlEvent(EVENT_WATER_AT_TARGET);
+        }
+    } else if (waterLow()) {
+        controlEvent(EVENT_WATER_LOW);
     }
 
-//    switchPins();
+    void (*tick)() = stateHandlers[controlState].tick;
+    if (tick) tick();
+    pumpSpeedControl();
+    // Relays still switch only in setup(), but the speeds have to reach the
+    // pump and the fan every cycle.
+    switchCirculationPumpPin();
+    switchFanPwmPin();
 }
 
+// True if the water the valve sends the heat to needs none: the DHW tank
+// back at dhwTarget, or the heating supply at waterTarget.
+bool waterAtTarget() {
+    if (isWaterValveStarted) return !dhwDemand;
+    return t.waterInject >= waterTarget;
+}
 
-void sumpHeaterCheck() {
-    if (t.airOutside <= sumpHeaterTemp ) {
-        startSumpHeater();
+// True if that water has cooled far enough to call for heat again. Between
+// the two neither event fires, so a satisfied unit stays off and a heating
+// one keeps running until the water is back at target.
+bool waterLow() {
+    if (isWaterValveStarted) return dhwDemand;
+    return t.waterInject < waterTarget - WATER_HYSTERESIS;
+}
+
+// Shares the compressor between heating and DHW through the diverter
+// valve. The valve holds each position for valveDwellTime, long enough for
+// T2 to show the circuit it now serves. DHW goes first: it takes the valve
+// when heating has nothing to heat or has had heatingSliceTime, and keeps
+// it until the tank is at dhwTarget or for dhwSliceTime. Heating demand is
+// only known from T2 while the valve is on heating, so a DHW slice always
+// ends by handing back to heating. Runs on the curve's waterTarget.
+void dhwSchedule() {
+    if (t.dhwTank <= dhwTarget - DELTA_3) dhwDemand = true;
+    if (t.dhwTank >= dhwTarget) dhwDemand = false;
+
+    unsigned long held = millis() - (isWaterValveStarted ? waterValveStartedTime : waterValveStoppedTime);
+    if (held < valveDwellTime) return;
+    if (isWaterValveStarted) {
+        if (dhwDemand && held < dhwSliceTime) return;
+        stopWaterValve();
+    } else {
+        if (!dhwDemand || (t.waterInject < waterTarget && held < heatingSliceTime)) return;
+        startWaterValve();
     }
+    // The discharge now follows the other tank; a drop is not frost.
+    heatedAtLeastOnce = false;
+}
 
-    if (t.airOutside >= sumpHeaterTemp + DELTA_2) {
-        stopSumpHeater();
+// Looks the event up in the transition table for the current state; true
+// if it moved to another state.
+bool controlEvent(CONTROL_EVENT event) {
+    uint8_t to = pgm_read_byte(&transitions[controlState][event]);
+    if (to == STATE_NONE) return false;
+    if (to == STATE_RESUME) to = resumeState;
+    if (to == STATE_SATISFIED) resumeState = controlState;
+    enterState((CONTROL_STATE)to);
+    return true;
+}
+
+// Leaves the current state for `to`, running the exit and entry actions,
+// and counts the entry.
+void enterState(CONTROL_STATE to) {
+    void (*exit)(CONTROL_STATE) = stateHandlers[controlState].exit;
+    if (exit) exit(to);
+    controlState = to;
+    stateEntries[to]++;
+    stateSince = millis();
+    stateHasChanged = true;
+    void (*enter)() = stateHandlers[to].enter;
+    if (enter) enter();
+}
+
+void enterHeating() {
+    startCompressor();
+}
+
+// Also entered on return from STATE_SATISFIED, with the compressor off.
+void enterDefrosting() {
+    startCompressor();
+    stopFan();
+    startDefrost();
+}
+
+// The fan comes back only for heating. SATISFIED and FAULT would stop it
+// again at once, which pulses the relay and counts a start for nothing.
+void exitDefrosting(CONTROL_STATE to) {
+    stopDefrost();
+    if (to == STATE_HEATING) startFan();
+    heatedAtLeastOnce = false;
+}
+
+// The discharge cools while the compressor rests, so a restart would read
+// as frost if heatedAtLeastOnce survived it.
+void enterSatisfied() {
+    stopAll();
+    heatedAtLeastOnce = false;
+}
+
+// Counts the fault in its window and records it in states[]. The window
+// opens at the first fault after the last one has run out.
+void enterFault() {
+    stopAll(true);
+    if (!recentFaults || millis() - faultWindowStart >= faultWindowTime) {
+        recentFaults = 0;
+        faultWindowStart = millis();
     }
+    recentFaults++;
+    faultLatched = recentFaults >= FAULT_RETRY_LIMIT;
+    LOG_ERROR(CONTROL, F("Fault "), (int)recentFaults, faultLatched ? F(" latched") : F(""));
+    saveState();
 }
 
-void compressorControl() {
+void startingTick() {
+    start(t.coolantInject, t.airOutside);
+    controlEvent(EVENT_STARTED);
+}
 
-    if (t.waterInject <= waterTargetTemp ) {
-        startCompressor();
+void heatingTick() {
+    sumpHeaterCheck();
+    if (checkCompressorError()) return;
+    if (waterPumpControl()) return;
+    fanControl();
+    defrostStartControl();
+}
+
+void defrostingTick() {
+    sumpHeaterCheck();
+    waterPumpControl();
+    fanControl();
+    if (defrostStopControl()) return;
+    checkDefrostError();
+}
+
+// Everything stays off for faultCooldownTime, doubled for every earlier
+// fault in the window; then the errors are cleared and the start program
+// runs again. A sensor still out of range latches its error on the next
+// reading, which counts as the next fault. Once latched, only a reboot
+// clears it.
+void faultTick() {
+    if (faultLatched) return;
+    if (millis() - stateSince < (unsigned long)faultCooldownTime << (recentFaults - 1)) return;
+    clearErrors();
+    controlEvent(EVENT_RETRY);
+    LOG_INFO(CONTROL, F("Retry after fault "), (int)recentFaults);
+    saveState();
+}
+
+void clearErrors() {
+    compressorError = defrostError = false;
+    t1Error = t2Error = t3Error = t4Error = t5Error = t6Error = false;
+    p1Error = p2Error = highPressureError = false;
+    heatedAtLeastOnce = false;
+    drawSign = false;
+}
+
+
+void sumpHeaterCheck() {
+    if (t.airOutside <= setpoints.sumpHeaterBelow) {
+        startSumpHeater();
     }
 
-    if (heatedAtLeastOnce && t.waterInject >= waterTargetTemp + DELTA_2 && !isDefrostStarted) {
-        stopAll();
-        startIsFinished = false;
+    if (t.airOutside >= setpoints.sumpHeaterBelow + DELTA_2) {
+        stopSumpHeater();
     }
 }
 
-void checkCompressorError() {
-    if (!isFanStarted) return;
-    if (millis() - fanStartedTime >= errorTime ) {
-        if(heatedAtLeastOnce) {
-            stopAll();
-            compressorError = true;
-        } else {
-            heatedAtLeastOnce = true;
-            startDefrost();
-            fanStartedTime = millis();
-            drawSign= true;
-        }
+// Fan running for errorTime without the discharge reaching fanTarget: a
+// fault once it has reached heatedMark, otherwise one defrost first. True if the state changed.
+bool checkCompressorError() {
+    if (!isFanStarted || millis() - fanStartedTime < errorTime) return false;
+    if (heatedAtLeastOnce) {
+        compressorError = true;
+        return controlEvent(EVENT_FAULT);
     }
+    heatedAtLeastOnce = true;
+    fanStartedTime = millis();
+    drawSign = true;
+    return controlEvent(EVENT_DEFROST);
 }
 
 
 void checkDefrostError() {
-    if (!isDefrostStarted)  return;
     if (millis() - defrostStartedTime >= errorTime ) {
-        stopAll();
-        compressorError = true;
+        defrostError = true;
+        controlEvent(EVENT_FAULT);
     }
 }
 
 
 
-void waterPumpControl() {
-    if (!isCompressorStarted) return;
-
-    if (t.coolantInject >= waterTargetTemp) {
+// True if the pump stop sent the controller back to the start program.
+bool waterPumpControl() {
+    if (t.coolantInject >= waterTarget) {
         startPump();
     }
-    if (heatedAtLeastOnce && (t.coolantInject <= (waterTargetTemp - DELTA_2))) {
+    if (heatedAtLeastOnce && (t.coolantInject <= (waterTarget - DELTA_2))) {
         stopPump();
-        startIsFinished = false;
+        return controlEvent(EVENT_RESTART);
     }
+    return false;
 }
 
-void fanControl() {
-    if (!isCompressorStarted) return;
-
+// Circulation pump speed: an integrating loop that holds the condenser's
+// T2 - T1 at pumpDelta. A wider spread means the water is not carrying the
+// heat away, so the pump speeds up; a narrower one means it can slow down.
+// The duty moves at most PUMP_RAMP_STEP per cycle, which is also the soft
+// start from PUMP_DUTY_MIN, and stays at or above that floor while the pump
+// relay is on. A lost T1 reads -55 °C and drives the pump to full speed.
+void pumpSpeedControl() {
+    if (!isPumpStarted) {
+        pumpDuty = 0;
+        return;
+    }
+    int16_t step = (t.waterInject - t.waterIntake - pumpDelta) / PUMP_GAIN_DIV;
+    if (step > PUMP_RAMP_STEP) step = PUMP_RAMP_STEP;
+    if (step < -PUMP_RAMP_STEP) step = -PUMP_RAMP_STEP;
+    int16_t duty = (pumpDuty < PUMP_DUTY_MIN ? PUMP_DUTY_MIN : pumpDuty) + step;
+    if (duty < PUMP_DUTY_MIN) duty = PUMP_DUTY_MIN;
+    if (duty > PUMP_DUTY_MAX) duty = PUMP_DUTY_MAX;
+    pumpDuty = duty;
+}
 
-    if (t.coolantInject >= heatedAtLeastOnceTemp) {
+// Evaporator fan speed: a PI loop that holds the discharge (T4) at
+// fanTarget. More air lifts the evaporator and with it the discharge, so
+// a discharge below target asks for more fan. All in Q8 fixed point. The
+// integral only moves while the output is not already pinned in the
+// direction it would push, and never leaves 0..FAN_DUTY_MAX, so it does
+// not wind up through a long saturation. The relay goes off only when the
+// loop asks for no air at all, and back on once it asks for FAN_DUTY_MIN.
+// While the defrost valve is open the fan is forced off. Every stop clears
+// the integral, so a run starts on the proportional part alone instead of
+// the duty the last run ended on.
+void fanControl() {
+    if (t.coolantInject >= setpoints.heatedMark) {
         heatedAtLeastOnce = true;
     }
-
-    if (t.coolantInject >= fanTargetTemp) {
+    if (t.coolantInject >= setpoints.fanTarget) {
         drawSign= false;
-        stopFan();
+        // The fan no longer stops here, so checkCompressorError() times
+        // the run since the discharge last reached fanTarget.
+        fanStartedTime = millis();
     }
-    if (t.coolantInject <= (fanTargetTemp - DELTA_2)) {
-        startFan();
+
+    if (isDefrostStarted) {
+        stopFan();
+        return;
     }
-}
 
-void defrostStartControl() {
-    if (!isCompressorStarted || !heatedAtLeastOnce) return;
-    if (isDefrostStarted) return;
-//    Serial.print('Check defrost ');
-    Serial.println((int) isDefrostStarted);
+    int16_t error = setpoints.fanTarget - t.coolantInject;
+    int32_t proportional = (int32_t)error * FAN_KP;
+    int32_t out = (proportional + fanIntegral) >> FAN_Q;
+    if ((error > 0 && out < FAN_DUTY_MAX) || (error < 0 && out > 0)) {
+        fanIntegral += (int32_t)error * FAN_KI;
+        if (fanIntegral < 0) fanIntegral = 0;
+        if (fanIntegral > (int32_t)FAN_DUTY_MAX << FAN_Q) fanIntegral = (int32_t)FAN_DUTY_MAX << FAN_Q;
+        out = (proportional + fanIntegral) >> FAN_Q;
+    }
 
-    if (t.coolantInject <= defrostTemp) {
+    if (out <= 0) {
         stopFan();
-        startDefrost();
-        mode = "defrost";
+        return;
+    }
+    if (out < FAN_DUTY_MIN) {
+        if (!isFanStarted) return;
+        out = FAN_DUTY_MIN;
     }
+    startFan();
+    fanDuty = out > FAN_DUTY_MAX ? FAN_DUTY_MAX : out;
 }
-void defrostStopControl() {
-    if (!isDefrostStarted) return;
 
-    if (t.coolantIntake >= sumpSuctionTemp) {
-        stopDefrost();
-        startFan();
-        heatedAtLeastOnce = false;
-        mode = "work";
+// Frost shows first as a falling suction pressure; the discharge
+// temperature only follows once the evaporator has lost most of its air.
+void defrostStartControl() {
+    if (heatedAtLeastOnce && t.coolantInject <= setpoints.defrostStart) {
+        controlEvent(EVENT_DEFROST);
+        return;
+    }
+#if PRESSURE_ENABLED
+    // P2 is still low straight after a defrost, so it waits after that too.
+    if (millis() - compressorStartedTime >= pressureSettleTime
+        && millis() - defrostStoppedTime >= pressureSettleTime && p.low <= defrostPressure) {
+        controlEvent(EVENT_DEFROST);
     }
+#endif
+}
 
+bool defrostStopControl() {
+    return t.coolantIntake >= setpoints.defrostStop && controlEvent(EVENT_DEFROSTED);
 }
 
 
@@ -361,7 +1030,10 @@ void stopAll(bool withDefrost) {
     stopPump();
     stopSumpHeater();
     stopCompressorHeater();
-    if(withDefrost)stopDefrost();
+    if (withDefrost) {
+        stopDefrost();
+        stopWaterValve();               // обесточенный клапан стоит на отоплении
+    }
 }
 
 void startCompressor() {
@@ -369,6 +1041,7 @@ void startCompressor() {
 //     digitalWrite(compressor, LOW);
     compressorFlag = 1;
     isCompressorStarted = true;
+    relayStarted(COUNTER_COMPRESSOR);
     compressorStartedTime = millis();
     stateHasChanged = true;
 }
@@ -377,6 +1050,7 @@ void stopCompressor() {
     // if (!isCompressorStarted) return;
 //     digitalWrite(compressor, HIGH);
     compressorFlag = -1;
+    if (isCompressorStarted) relayAccumulate(COUNTER_COMPRESSOR);
     isCompressorStarted = false;
     compressorStoppedTime = millis();
     stateHasChanged = true;
@@ -387,6 +1061,8 @@ void startFan() {
 //     digitalWrite(fan, LOW);
     fanFlag = 1;
     isFanStarted = true;
+    relayStarted(COUNTER_FAN);
+    fanDuty = FAN_DUTY_MIN;
     fanStartedTime = millis();
     stateHasChanged = true;
 }
@@ -395,7 +1071,10 @@ void stopFan() {
     // if (!isFanStarted) return;
 //     digitalWrite(fan, HIGH);
     fanFlag = -1;
+    if (isFanStarted) relayAccumulate(COUNTER_FAN);
     isFanStarted = false;
+    fanDuty = 0;
+    fanIntegral = 0;
     fanStoppedTime = millis();
     stateHasChanged = true;
 }
@@ -405,6 +1084,7 @@ void startDefrost() {
 //     digitalWrite(defrostValve, LOW);
     defrostFlag = 1;
     isDefrostStarted = true;
+    relayStarted(COUNTER_DEFROST);
     defrostStartedTime = millis();
     stateHasChanged = true;
 }
@@ -413,6 +1093,7 @@ void stopDefrost() {
     // if (!isDefrostStarted) return;
 //     digitalWrite(defrostValve, HIGH);
     defrostFlag = -1;
+    if (isDefrostStarted) relayAccumulate(COUNTER_DEFROST);
     isDefrostStarted = false;
     defrostStoppedTime = millis();
     stateHasChanged = true;
@@ -423,6 +1104,7 @@ void startSumpHeater() {
 //     digitalWrite(sumpHeater, LOW);
     sumpHeaterFlag = 1;
     isSumpHeaterStarted = true;
+    relayStarted(COUNTER_SUMP_HEATER);
     sumpHeaterStartedTime = millis();
     stateHasChanged = true;
 }
@@ -431,6 +1113,7 @@ void stopSumpHeater() {
     // if (!isSumpHeaterStarted) return;
 //     digitalWrite(sumpHeater, HIGH);
     sumpHeaterFlag = -1;
+    if (isSumpHeaterStarted) relayAccumulate(COUNTER_SUMP_HEATER);
     isSumpHeaterStarted = false;
     sumpHeaterStoppedTime = millis();
     stateHasChanged = true;
@@ -441,6 +1124,7 @@ void startCompressorHeater() {
 //     digitalWrite(compressorHeater, LOW);
     compressorHeaterFlag = 1;
     isCompressorHeaterStarted = true;
+    relayStarted(COUNTER_COMPRESSOR_HEATER);
     compressorHeaterStartedTime = millis();
     stateHasChanged = true;
 }
@@ -449,10 +1133,11 @@ void stopCompressorHeater() {
     // if (!isCompressorHeaterStarted) return;
 //     digitalWrite(compressorHeater, HIGH);
     compressorHeaterFlag = -1;
+    if (isCompressorHeaterStarted) relayAccumulate(COUNTER_COMPRESSOR_HEATER);
     isCompressorHeaterStarted = false;
     compressorHeaterStoppedTime = millis();
     stateHasChanged = true;
-    Serial.println("stopped");
+    LOG_DEBUG(CONTROL, F("CompressorHeater stopped"));
 }
 
 void startPump() {
@@ -460,6 +1145,7 @@ void startPump() {
 //     digitalWrite(waterPump, LOW);
     waterPumpFlag = 1;
     isPumpStarted = true;
+    relayStarted(COUNTER_PUMP);
     pumpStartedTime = millis();
     stateHasChanged = true;
 }
@@ -468,11 +1154,86 @@ void stopPump() {
     // if (isPumpStarted) return;
 //     digitalWrite(waterPump, HIGH);
     waterPumpFlag = -1;
+    if (isPumpStarted) relayAccumulate(COUNTER_PUMP);
     isPumpStarted = false;
     pumpStoppedTime = millis();
     stateHasChanged = true;
 }
 
+void startWaterValve() {
+    if (isWaterValveStarted) return;
+//     digitalWrite(waterValve, LOW);
+    waterValveFlag = 1;
+    isWaterValveStarted = true;
+    relayStarted(COUNTER_WATER_VALVE);
+    waterValveStartedTime = millis();
+    stateHasChanged = true;
+}
+
+void stopWaterValve() {
+    // if (!isWaterValveStarted) return;
+//     digitalWrite(waterValve, HIGH);
+    waterValveFlag = -1;
+    if (isWaterValveStarted) relayAccumulate(COUNTER_WATER_VALVE);
+    isWaterValveStarted = false;
+    waterValveStoppedTime = millis();
+    stateHasChanged = true;
+}
+
+// Counts a start of relay r; its running time is counted from here.
+void relayStarted(RELAY_COUNTER r) {
+    counters.relays[r].starts++;
+    counterSince[r] = runSince[r] = millis();
+}
+
+// Adds the time relay r has run since it was last counted, and the energy
+// of those seconds at its rated power; called on every stop and before the
+// counters are read or saved. Part-seconds and part-Wh carry over, so
+// short runs add up and calling it more often loses nothing. O(1).
+void relayAccumulate(RELAY_COUNTER r) {
+    RELAY_COUNTERS& c = counters.relays[r];
+    unsigned long ms = c.onMs + (millis() - counterSince[r]);
+    unsigned long seconds = ms / 1000;
+    counterSince[r] = millis();
+    c.onSeconds += seconds;
+    c.onMs = ms % 1000;
+    unsigned long ws = c.energyWs + seconds * pgm_read_word(&relayPower[r]);
+    c.energyWh += ws / 3600;
+    c.energyWs = ws % 3600;
+    unsigned long run = (millis() - runSince[r]) / 1000;
+    if (run > c.longestSeconds) c.longestSeconds = run;
+}
+
+// Counters from EEPROM, or zeros if it holds something else.
+void loadCounters() {
+    EEPROM.get(COUNTERS_ADDRESS, counters);
+    if (counters.magic != COUNTERS_MAGIC) {
+        memset(&counters, 0, sizeof counters);
+        counters.magic = COUNTERS_MAGIC;
+    }
+}
+
+// Every counterSaveTime: brings the running relays up to date and writes
+// the counters to EEPROM. put() skips unchanged bytes, so the cells wear at
+// most once an hour. The saved counters then go to the log one relay per
+// call, a line at a time being what the log ring holds.
+void saveCounters() {
+    if (counterLogNext < COUNTER_COUNT) {
+        const RELAY_COUNTERS& c = counters.relays[counterLogNext];
+        (void)c;                        // unused with the log compiled out
+        LOG_INFO(CONTROL, F("Relay "), (int)counterLogNext, F(" on "), c.onSeconds, F(" s, "), c.starts,
+                 F(" starts, longest "), c.longestSeconds, F(" s, "), c.energyWh, F(" Wh"));
+        counterLogNext++;
+    }
+    if (millis() - countersSavedTime < counterSaveTime) return;
+    countersSavedTime = millis();
+    for (uint8_t r = 0; r < COUNTER_COUNT; r++) {
+        if (*relayStates[r]) relayAccumulate((RELAY_COUNTER)r);
+    }
+    EEPROM.put(COUNTERS_ADDRESS, counters);
+    counterLogNext = 0;
+}
+
 void switchPins() {
     switchCompressorPin();
     switchFanPin();
@@ -480,6 +1241,9 @@ void switchPins() {
     switchCompressorHeaterPin();
     switchSumpHeaterPin();
     switchWaterPumpPin();
+    switchWaterValvePin();
+    switchCirculationPumpPin();
+    switchFanPwmPin();
 }
 
 void switchCompressorPin() {
@@ -571,6 +1335,31 @@ void switchWaterPumpPin() {
 }
 
 
+void switchWaterValvePin() {
+    switch (waterValveFlag) {
+        case 1:
+            digitalWrite(waterValve, LOW);
+            break;
+        case -1:
+            digitalWrite(waterValve, HIGH);
+            break;
+        default:
+            break;
+    }
+    waterValveFlag = 0;
+}
+
+
+void switchCirculationPumpPin() {
+    analogWrite(waterCirculationPump, pumpDuty);
+}
+
+
+void switchFanPwmPin() {
+    analogWrite(fanPwm, fanDuty);
+}
+
+
 
 
 void reDrawScreen() {
@@ -580,7 +1369,13 @@ void reDrawScreen() {
     tempHasChanged = false;
     stateHasChanged = false;
 
-    display.clearDisplay();
+    printTemps();
+
+    // Sent a page at a time from serviceDelay().
+    display.startFrame(drawScreen);
+}
+
+void drawScreen() {
     display.setTextSize(2);
     display.setTextColor(SSD1306_WHITE);
     display.cp437(true);
@@ -594,8 +1389,6 @@ void reDrawScreen() {
         display.setCursor(4, 26);
         display.println("!");
     }
-
-    display.display();
 }
 
 
@@ -626,18 +1419,41 @@ void drawRelaysState() {
         display.setCursor(53, 16);
         display.print("CH");
     }
+    if (isWaterValveStarted) {
+        display.setCursor(53, 8);
+        display.print("HW");
+    }
 }
 
-void drawTemp(String text, float temp, int x, int y) {
+void drawTemp(String text, temp_t temp, int x, int y) {
     display.setCursor(x, y);
 
-    Serial.print(text);
-    Serial.println(temp);
     display.print(text);
-    display.println(temp);
+    display.println(toCelsius(temp));
 
 
 }
+
+// The only place a temperature becomes a float: text output.
+float toCelsius(temp_t temp) {
+    return temp / 16.0;
+}
+
+// DS18B20 reading in 1/16 °C. getTemp() returns the library's raw 1/128 °C,
+// so no float conversion runs on the read path; a missing sensor reads
+// DEVICE_DISCONNECTED_RAW (-55 °C) and trips the range check.
+temp_t readTemp(const uint8_t* addr) {
+    return (temp_t)(sensors.getTemp(addr) >> 3);
+}
+
+// Log echo of what drawTemps() shows; kept out of the page loop so it is
+// sent once per frame, not once per page.
+void printTemps() {
+    LOG_DEBUG(DISPLAY, F("T2:"), toCelsius(t.waterInject));
+    LOG_DEBUG(DISPLAY, F("T3:"), toCelsius(t.coolantIntake));
+    LOG_DEBUG(DISPLAY, F("T4:"), toCelsius(t.coolantInject));
+    LOG_DEBUG(DISPLAY, F("T5:"), toCelsius(t.airOutside));
+}
 void drawTemps() {
 
 
@@ -646,67 +1462,109 @@ void drawTemps() {
     // drawTemp("T1:", t.waterIntake, 1, 29);
 
     drawTemp("T2:", t.waterInject, 1, 51);
-//    Serial.print("T3:");Serial.println(t.coolantIntake);
     drawTemp("T3:", t.coolantIntake, 70, 29);
 
     drawTemp("T4:", t.coolantInject, 70, 51);
 
     drawTemp("T5:", t.airOutside, 70, 5);
 
-    // drawTemp("T6:", t.airInside, 91, 51);
+#if DHW_ENABLED
+    drawTemp("T6:", t.dhwTank, 20, 40);
+#endif
 
 }
 
 TEMPS getAllTemps() {
 
-    sensors.requestTemperatures();
+    convertTemperatures();
 
     TEMPS temps = {
 //         5.0,5.0,5.0,5.0,5.0,5.0,
-        sensors.getTempC(waterIntakeSensor),
-        sensors.getTempC(waterInjectSensor),
-        sensors.getTempC(coolantIntakeSensor),
-        sensors.getTempC(coolantInjectSensor),
-        sensors.getTempC(outsideAirSensor),
-        sensors.getTempC(insideAirSensor),
+        readTemp(waterIntakeSensor),
+        readTemp(waterInjectSensor),
+        readTemp(coolantIntakeSensor),
+        readTemp(coolantInjectSensor),
+        readTemp(outsideAirSensor),
+        readTemp(dhwTankSensor),
     };
 
-    // Serial.println(temps.waterIntake);
-    Serial.println(temps.waterInject);
-    Serial.println(temps.coolantIntake);
-    Serial.println(temps.coolantInject);
-    Serial.println(temps.airOutside);
-    Serial.print("Compressor ");Serial.println((int)isCompressorStarted);
-    Serial.print("Fan ");Serial.println((int)isFanStarted);
-    Serial.print("Defrost ");Serial.println((int)isDefrostStarted);
-    Serial.print("SumpHeater ");Serial.println((int)isSumpHeaterStarted);
-    Serial.print("CompressorHeater ");Serial.println((int)isCompressorHeaterStarted);
-    Serial.print("Pump ");Serial.println((int)isPumpStarted);
-    Serial.println();
+    LOG_DEBUG(SENSORS, F("T2 "), toCelsius(temps.waterInject), F(" T3 "), toCelsius(temps.coolantIntake),
+              F(" T4 "), toCelsius(temps.coolantInject), F(" T5 "), toCelsius(temps.airOutside));
+    LOG_DEBUG(CONTROL, F("Compressor "), (int)isCompressorStarted, F(" Fan "), (int)isFanStarted,
+              F(" Defrost "), (int)isDefrostStarted, F(" SumpHeater "), (int)isSumpHeaterStarted,
+              F(" CompressorHeater "), (int)isCompressorHeaterStarted, F(" Pump "), (int)isPumpStarted);
+
+    checkTemps(temps);
+
+    return temps;
+}
 
+// Latches sensor range errors and notes whether the screen needs a redraw.
+void checkTemps(const TEMPS& temps) {
     // if(temps.waterIntake   < minSensorTemp || temps.waterIntake   > maxSensorTemp) t1Error = true;// else t1Error = false;
     if (temps.waterInject   < minSensorTemp || temps.waterInject   > maxSensorTemp) t2Error = true; // else t1Error = false;
     if (temps.coolantIntake < minSensorTemp || temps.coolantIntake > maxSensorTemp) t3Error = true; // else t1Error = false;
     if (temps.coolantInject < minSensorTemp || temps.coolantInject > maxSensorTemp) t4Error = true; // else t1Error = false;
     if (temps.airOutside    < minSensorTemp || temps.airOutside    > maxSensorTemp) t5Error = true; // else t1Error = false;
-    // if(temps.airInside     < minSensorTemp || temps.airInside     > maxSensorTemp) t6Error = true;// else t1Error = false;
-
-    float newTempsSum =  abs(temps.waterIntake) + abs(temps.waterInject) + abs(temps.coolantIntake) + abs(temps.coolantInject) + abs(temps.airOutside);
+#if DHW_ENABLED
+    if (temps.dhwTank       < minSensorTemp || temps.dhwTank       > maxSensorTemp) t6Error = true;
+#endif
+
+    long newTempsSum =  (long)abs(temps.waterIntake) + abs(temps.waterInject) + abs(temps.coolantIntake) + abs(temps.coolantInject) + abs(temps.airOutside);
+#if DHW_ENABLED
+    newTempsSum += abs(temps.dhwTank);
+#endif
     if (tempsSum != newTempsSum) tempHasChanged = true;
     tempsSum = newTempsSum;
+}
 
-    return temps;
+#if PRESSURE_ENABLED
+// Latest readings of the free-running ADC; nothing waits. Latches a broken
+// or shorted transducer and a discharge pressure over highPressureLimit.
+PRESSURES getPressures() {
+    uint16_t high = pressureAdc.read(0);
+    uint16_t low = pressureAdc.read(1);
+    if (high < PRESSURE_WIRE_LOW || high > PRESSURE_WIRE_HIGH) p1Error = true;
+    if (low < PRESSURE_WIRE_LOW || low > PRESSURE_WIRE_HIGH) p2Error = true;
+
+    PRESSURES pressures = {
+        toPressure(high, highPressureSpan),
+        toPressure(low, lowPressureSpan),
+    };
+    if (pressures.high >= highPressureLimit) highPressureError = true;
+    LOG_DEBUG(SENSORS, F("P1 "), pressures.high, F(" P2 "), pressures.low);
+    return pressures;
+}
+
+// Transducer reading to kPa: PRESSURE_ZERO is 0, PRESSURE_FULL is `span`.
+pressure_t toPressure(uint16_t reading, pressure_t span) {
+    return (pressure_t)(((int32_t)reading - PRESSURE_ZERO) * span / (PRESSURE_FULL - PRESSURE_ZERO));
+}
+
+// High-pressure cutout between cycles. The compressor relay drops on the
+// first service pass that sees P1 at highPressureLimit, within about a
+// millisecond; the fault follows at the next controlStep().
+void pressureGuard() {
+    if (!isCompressorStarted) return;
+    if (toPressure(pressureAdc.read(0), highPressureSpan) < highPressureLimit) return;
+    highPressureError = true;
+    stopCompressor();
+    switchCompressorPin();
+    LOG_ERROR(CONTROL, F("High pressure"));
 }
+#endif
 
-void drawText(String text, int x = 0, int y = 0) {
+void drawText(String text, int x, int y) {
     display.setCursor(x, y);
     display.print(text);
 
 }
 
 void drawErrors() {
+    display.startFrame(drawErrorsScreen);
+}
 
-    display.clearDisplay();
+void drawErrorsScreen() {
     display.setTextSize(2);
     display.setTextColor(SSD1306_WHITE);
     display.cp437(true);
@@ -733,92 +1591,87 @@ void drawErrors() {
     if (defrostError) {
         drawText("D", 110, 44);
     }
-
-
-    display.display();
+    if (p1Error || p2Error || highPressureError) {
+        drawText("P", 110, 22);
+    }
 }
 
-void drawStart(float coolantInjectTemp, float airOutsideTemp ) {
-    display.clearDisplay();
+void drawStart(temp_t coolantInjectTemp, temp_t airOutsideTemp ) {
     unsigned int delaySeconds = (targetDelay - millis())/1000;
     unsigned int totalDelayMinutes = targetDelay/1000/60;
 
-    display.setTextColor(SSD1306_WHITE);
-    display.cp437(true);
+    LOG_DEBUG(DISPLAY, F("T4:"), toCelsius(coolantInjectTemp));
+    LOG_DEBUG(DISPLAY, F("T5:"), toCelsius(airOutsideTemp));
 
-    display.setTextSize(1);
-
-    display.setCursor(0, 0);
-    display.print("Starting delay ");
-    display.print(totalDelayMinutes);
-    display.println("m:");
+    serviceDelay(100);
 
-    display.setTextSize(1);
-    if (isSumpHeaterStarted) drawText("SH", 90, 22);
-    if (isCompressorHeaterStarted) drawText("CH", 90, 32);
+    display.firstPage();
+    do {
+        display.setTextColor(SSD1306_WHITE);
+        display.cp437(true);
 
+        display.setTextSize(1);
 
-    display.setTextSize(2);
-    display.setCursor(0, 20);
-    display.print(delaySeconds);
-    display.println('s');
+        display.setCursor(0, 0);
+        display.print("Starting delay ");
+        display.print(totalDelayMinutes);
+        display.println("m:");
 
-    display.setTextSize(1);
-    drawTemp("T4:", coolantInjectTemp, 0, 42);
-    drawTemp("T5:", airOutsideTemp, 0, 55);
+        display.setTextSize(1);
+        if (isSumpHeaterStarted) drawText("SH", 90, 22);
+        if (isCompressorHeaterStarted) drawText("CH", 90, 32);
 
-    delay(100);
 
-    display.display();
+        display.setTextSize(2);
+        display.setCursor(0, 20);
+        display.print(delaySeconds);
+        display.println('s');
+
+        display.setTextSize(1);
+        drawTemp("T4:", coolantInjectTemp, 0, 42);
+        drawTemp("T5:", airOutsideTemp, 0, 55);
+    } while (display.nextPage());
 }
 
-void start(float coolantInjectTemp, float airOutsideTemp) {
-    if (startIsFinished) return;
-
-    if (coolantInjectTemp >= startCoolantTemp ) {   //T4 >= 35
+void start(temp_t coolantInjectTemp, temp_t airOutsideTemp) {
+    if (coolantInjectTemp >= setpoints.startCoolant) {   //T4 >= 35
         stopAll();
     }
 
     targetDelay = millis() + calculateDelay(airOutsideTemp);
 
     while (millis() <= targetDelay) {
-        sensors.requestTemperatures();
-        airOutsideTemp = sensors.getTempC(outsideAirSensor);
-        drawStart(sensors.getTempC(coolantInjectSensor), airOutsideTemp);
+        serviceModbus();
+        convertTemperatures();
+        airOutsideTemp = readTemp(outsideAirSensor);
+        drawStart(readTemp(coolantInjectSensor), airOutsideTemp);
 
-        if (airOutsideTemp <= sumpHeaterTemp) {
+        if (airOutsideTemp <= setpoints.sumpHeaterBelow) {
             startSumpHeater();
         }
-        if (airOutsideTemp <= compressorHeaterTemp) {
+        if (airOutsideTemp <= setpoints.compressorHeaterBelow) {
             startCompressorHeater();
         }
-        if (airOutsideTemp >= sumpHeaterTemp + DELTA_1) {
+        if (airOutsideTemp >= setpoints.sumpHeaterBelow + DELTA_1) {
             stopSumpHeater();
             stopCompressorHeater();
         }
     }
-
-    startIsFinished = true;
-
 }
 
-unsigned long calculateDelay(float temp) {
+unsigned long calculateDelay(temp_t temp) {
      return 300;
     return compressorDelayTime;
 
-    int intTemp = (int)temp;
-    if(temp >= 0.0) {
-        Serial.print(temp);
-        Serial.print(" delay is ");
-        Serial.println(compressorDelayTime);
+    int intTemp = temp / 16;
+    if(temp >= 0) {
+        LOG_INFO(CONTROL, toCelsius(temp), F(" delay is "), compressorDelayTime);
         return compressorDelayTime;
     }
 
 
-    Serial.print(temp);
-    Serial.print(" delay is ");
-    Serial.println((unsigned long)((15.0 - temp) * 60000.0));
-    return (unsigned long)((15.0 - temp) * 60000.0);
+    LOG_INFO(CONTROL, toCelsius(temp), F(" delay is "), (unsigned long)(TEMP(15.0) - temp) * 60000UL / 16);
+    return (unsigned long)(TEMP(15.0) - temp) * 60000UL / 16;
 }
 
 void saveState() {
@@ -830,6 +1683,7 @@ void saveState() {
         isSumpHeaterStarted,
         isCompressorHeaterStarted,
         isPumpStarted,
+        isWaterValveStarted,
     };
 
     ERRORS errors = {
@@ -841,6 +1695,9 @@ void saveState() {
         t4Error,
         t5Error,
         t6Error,
+        p1Error,
+        p2Error,
+        highPressureError,
     };
 
     states[stateIndex] = {
@@ -848,14 +1705,347 @@ void saveState() {
         devices,
         errors,
         millis(),
+        controlState,
+        recentFaults,
     };
     updateStateIndex();
 }
 
 void updateStateIndex() {
-    if (stateIndex < maxStateIndex) {
+    if (stateIndex < maxStateIndex - 1) {
         stateIndex++;
     } else {
         stateIndex = 0;
     }
-}
\ No newline at end of file
+}
+
+void rollupInit() {
+    for (uint8_t l = 0; l < ROLLUP_LEVELS; l++) {
+        ROLLUP_LEVEL& level = rollupLevels[l];
+        level.next = level.count = 0;
+        level.period = millis() / level.periodMs;
+        rollupClear(level.open);
+    }
+}
+
+// Adds this cycle's readings in t and relay states to the open minute.
+// When a period ends it is closed into its ring and its sums are merged
+// into the open period one level up. A sample costs one update and a close
+// one merge; nothing is ever rescanned. Periods are aligned, so a level
+// can only end when the one below it does.
+void rollupSample() {
+    for (uint8_t l = 0; l < ROLLUP_LEVELS; l++) {
+        ROLLUP_LEVEL& level = rollupLevels[l];
+        unsigned long period = millis() / level.periodMs;
+        if (period == level.period) break;
+        if (level.open.samples) {
+            rollupClose(l);
+            if (l + 1 < ROLLUP_LEVELS) rollupMerge(rollupLevels[l + 1].open, level.open);
+        }
+        level.period = period;
+        rollupClear(level.open);
+    }
+
+    ROLLUP_SUM& open = rollupLevels[0].open;
+    const temp_t* temps = (const temp_t*)&t;
+    for (uint8_t c = 0; c < ROLLUP_CHANNELS; c++) {
+        open.sum[c] += temps[c];
+        if (temps[c] < open.min[c]) open.min[c] = temps[c];
+        if (temps[c] > open.max[c]) open.max[c] = temps[c];
+    }
+    for (uint8_t r = 0; r < COUNTER_COUNT; r++) open.on[r] += *relayStates[r];
+    open.samples++;
+}
+
+void rollupClear(ROLLUP_SUM& s) {
+    memset(&s, 0, sizeof s);
+    for (uint8_t c = 0; c < ROLLUP_CHANNELS; c++) {
+        s.min[c] = INT16_MAX;
+        s.max[c] = INT16_MIN;
+    }
+}
+
+void rollupMerge(ROLLUP_SUM& into, const ROLLUP_SUM& from) {
+    for (uint8_t c = 0; c < ROLLUP_CHANNELS; c++) {
+        into.sum[c] += from.sum[c];
+        if (from.min[c] < into.min[c]) into.min[c] = from.min[c];
+        if (from.max[c] > into.max[c]) into.max[c] = from.max[c];
+    }
+    for (uint8_t r = 0; r < COUNTER_COUNT; r++) into.on[r] += from.on[r];
+    into.samples += from.samples;
+}
+
+// Writes the open period of level `l` into its ring, over the oldest one.
+void rollupClose(uint8_t l) {
+    ROLLUP_LEVEL& level = rollupLevels[l];
+    const ROLLUP_SUM& s = level.open;
+    ROLLUP& r = rollupRings[l][level.next];
+    for (uint8_t c = 0; c < ROLLUP_CHANNELS; c++) {
+        r.min[c] = s.min[c];
+        r.max[c] = s.max[c];
+        r.mean[c] = s.sum[c] / (int32_t)s.samples;
+    }
+    for (uint8_t k = 0; k < COUNTER_COUNT; k++) r.duty[k] = s.on[k] * 255 / s.samples;
+    level.next = (level.next + 1) % level.size;
+    if (level.count < level.size) level.count++;
+}
+
+// Water target for the outdoor temperature: linear between the curve
+// points, flat beyond the ends, never above setpoints.waterLimit. All in
+// 1/16 °C; one 32-bit division.
+temp_t curveTarget(temp_t airOutside) {
+    const CURVE_POINT* p = heatingCurve;
+    temp_t target;
+    uint8_t i = 0;
+    while (i < CURVE_POINTS - 1 && airOutside > p[i].airOutside) i++;
+    if (i == 0 || airOutside >= p[i].airOutside) {
+        target = p[i].water;
+    } else {
+        // p[i - 1].airOutside < airOutside < p[i].airOutside, so dx > 0.
+        int16_t dx = p[i].airOutside - p[i - 1].airOutside;
+        target = p[i - 1].water + (int32_t)(airOutside - p[i - 1].airOutside) * (p[i].water - p[i - 1].water) / dx;
+    }
+    return target < setpoints.waterLimit ? target : setpoints.waterLimit;
+}
+
+// delay() that does the deferred work while it waits: the Modbus requests,
+// the log, the high-pressure cutout and one display page per pass. With
+// nothing left to do the MCU sleeps until the next interrupt.
+void serviceDelay(unsigned long ms) {
+    unsigned long started = millis();
+    while (millis() - started < ms) {
+        serviceModbus();
+        serviceLog();
+#if PRESSURE_ENABLED
+        pressureGuard();
+#endif
+        if (display.flushStep()) continue;
+        sleepUntilInterrupt();
+    }
+}
+
+// Idle sleep: the CPU stops while Timer0, the UART and the TWI keep running.
+// Any interrupt wakes it: serial input, or at the latest the 1.024 ms
+// Timer0 overflow that drives millis(). The tick stays on on purpose:
+// micros() times the Modbus silence gap, and a masked Timer0 would leave
+// it stale for a byte that arrives during sleep.
+void sleepUntilInterrupt() {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_mode();
+}
+
+// Starts a conversion on every sensor and sleeps through it.
+void convertTemperatures() {
+    sensors.requestTemperatures();
+    serviceDelay(sensors.millisToWaitForConversion(sensors.getResolution()));
+}
+
+void serviceModbus() {
+#if MODBUS_SLAVE_ID
+    modbus.poll();
+#endif
+}
+
+void serviceLog() {
+#if LOG_LEVEL != LOG_LEVEL_NONE
+    logBuffer.drain(Serial);
+#endif
+}
+
+// Modbus map, served from the live globals.
+//   Input registers (04):   0-5  TEMPS, 1/16 °C, signed
+//                           6    DEVICES, bit 0 compressor .. bit 6 waterValve
+//                           7    ERRORS, bit 0 compressorError .. bit 7 t6Error,
+//                                bit 8 p1Error .. bit 10 highPressureError
+//                           8    controlState: 0 heating, 1 defrosting, 2 starting,
+//                                3 satisfied, 4 fault
+//                           9-10 millis(), high word first
+//                           11   waterTarget: the heating curve's, or dhwTarget
+//                                while the valve is on DHW, 1/16 °C
+//                           12   seconds in controlState, saturating
+//                           13-17 entries into each state, same order
+//                           18   pumpDuty: circulation pump PWM, 0..255, 0 stopped
+//                           19   fanDuty: evaporator fan PWM, 0..255, 0 stopped
+//                           20   faults in the current window
+//                           21   1 if faults are latched until reboot
+//                           22-23 PRESSURES, kPa gauge, signed; 0 unless
+//                                built with PRESSURE_ENABLED
+//                           32-87 relay counters, 8 per relay in RELAY_COUNTER
+//                                order: seconds on, starts, longest run in
+//                                seconds, energy in Wh; 32 bits each, high
+//                                word first
+//                           0x1000 + level * 0x400 + field * 0x20 + age
+//                                rollups: level 0 minutes, 1 hours, 2 days;
+//                                field 3 * channel + 0 min, 1 max, 2 mean
+//                                (1/16 °C, TEMPS order), then 18 + relay for
+//                                its duty (0..255); age 0 the last closed
+//                                period, 0x8000 where there is none yet
+//   Holding registers (03/06/16), 1/16 °C, signed, within
+//   minSensorTemp..maxSensorTemp:
+//                           0-7  SETPOINTS
+//                           8-17 heatingCurve, airOutside and water per point
+//                           18   dhwTarget
+//                           19   pumpDelta: T2 - T1 the circulation pump holds
+#define MODBUS_TEMPS_REGS       (sizeof(TEMPS) / sizeof(temp_t))
+#define MODBUS_SETPOINTS_REGS   (sizeof(SETPOINTS) / sizeof(temp_t))
+#define MODBUS_CURVE_REGS       (CURVE_POINTS * 2)
+static_assert(sizeof(CURVE_POINT) == 2 * sizeof(temp_t), "holdingRegister() reads heatingCurve as temp_t[]");
+#define MODBUS_COUNTERS_BASE    32
+#define MODBUS_COUNTER_REGS     8                               // per relay
+#define MODBUS_ROLLUP_BASE      0x1000
+#define MODBUS_ROLLUP_FIELDS    (3 * ROLLUP_CHANNELS + COUNTER_COUNT)
+#define MODBUS_ROLLUP_NONE      0x8000
+
+// The holding register `reg` in RAM, or NULL outside the map.
+temp_t* holdingRegister(uint16_t reg) {
+    if (reg < MODBUS_SETPOINTS_REGS) return (temp_t*)&setpoints + reg;
+    reg -= MODBUS_SETPOINTS_REGS;
+    if (reg < MODBUS_CURVE_REGS) return (temp_t*)heatingCurve + reg;
+    reg -= MODBUS_CURVE_REGS;
+    if (reg == 0) return &dhwTarget;
+    if (reg == 1) return &pumpDelta;
+    return NULL;
+}
+
+bool readInputRegister(uint16_t reg, uint16_t& value) {
+    if (reg >= MODBUS_ROLLUP_BASE) return readRollupRegister(reg - MODBUS_ROLLUP_BASE, value);
+    if (reg >= MODBUS_COUNTERS_BASE) return readCounterRegister(reg - MODBUS_COUNTERS_BASE, value);
+    if (reg < MODBUS_TEMPS_REGS) {
+        value = (uint16_t)((const temp_t*)&t)[reg];
+        return true;
+    }
+    switch (reg - MODBUS_TEMPS_REGS) {
+        case 0:
+            value = isCompressorStarted | isFanStarted << 1 | isDefrostStarted << 2
+                  | isSumpHeaterStarted << 3 | isCompressorHeaterStarted << 4 | isPumpStarted << 5
+                  | isWaterValveStarted << 6;
+            return true;
+        case 1:
+            value = compressorError | defrostError << 1 | t1Error << 2 | t2Error << 3
+                  | t3Error << 4 | t4Error << 5 | t5Error << 6 | t6Error << 7
+                  | p1Error << 8 | p2Error << 9 | highPressureError << 10;
+            return true;
+        case 2:
+            value = controlState;
+            return true;
+        case 3:
+            value = millis() >> 16;
+            return true;
+        case 4:
+            value = millis() & 0xFFFF;
+            return true;
+        case 5:
+            value = (uint16_t)waterTarget;
+            return true;
+        case 6: {
+            unsigned long seconds = (millis() - stateSince) / 1000;
+            value = seconds > 0xFFFF ? 0xFFFF : seconds;
+            return true;
+        }
+        default:
+            reg -= MODBUS_TEMPS_REGS + 7;
+            if (reg < STATE_COUNT) {
+                value = stateEntries[reg];
+                return true;
+            }
+            switch (reg - STATE_COUNT) {
+                case 0:
+                    value = pumpDuty;
+                    return true;
+                case 1:
+                    value = fanDuty;
+                    return true;
+                case 2:
+                    value = recentFaults;
+                    return true;
+                case 3:
+                    value = faultLatched;
+                    return true;
+                case 4:
+                    value = (uint16_t)p.high;
+                    return true;
+                case 5:
+                    value = (uint16_t)p.low;
+                    return true;
+                default:
+                    return false;
+            }
+    }
+}
+
+// Counter register `reg` from MODBUS_COUNTERS_BASE, with a running relay
+// brought up to date first.
+bool readCounterRegister(uint16_t reg, uint16_t& value) {
+    uint8_t r = reg / MODBUS_COUNTER_REGS;
+    if (r >= COUNTER_COUNT) return false;
+    if (*relayStates[r]) relayAccumulate((RELAY_COUNTER)r);
+    const RELAY_COUNTERS& c = counters.relays[r];
+    unsigned long v;
+    switch (reg % MODBUS_COUNTER_REGS / 2) {
+        case 0:
+            v = c.onSeconds;
+            break;
+        case 1:
+            v = c.starts;
+            break;
+        case 2:
+            v = c.longestSeconds;
+            break;
+        default:
+            v = c.energyWh;
+            break;
+    }
+    value = reg % 2 ? v & 0xFFFF : v >> 16;
+    return true;
+}
+
+// Rollup register `reg` from MODBUS_ROLLUP_BASE. Consecutive addresses run
+// back in time, so one request reads a whole trend of one field.
+bool readRollupRegister(uint16_t reg, uint16_t& value) {
+    uint8_t l = reg >> 10;
+    uint8_t field = reg >> 5 & 0x1F;
+    uint8_t age = reg & 0x1F;
+    if (l >= ROLLUP_LEVELS || field >= MODBUS_ROLLUP_FIELDS) return false;
+    const ROLLUP_LEVEL& level = rollupLevels[l];
+    if (age >= level.size) return false;
+    if (age >= level.count) {
+        value = MODBUS_ROLLUP_NONE;
+        return true;
+    }
+    const ROLLUP& r = rollupRings[l][(level.next + level.size - 1 - age) % level.size];
+    if (field >= 3 * ROLLUP_CHANNELS) {
+        value = r.duty[field - 3 * ROLLUP_CHANNELS];
+        return true;
+    }
+    switch (field % 3) {
+        case 0:
+            value = (uint16_t)r.min[field / 3];
+            break;
+        case 1:
+            value = (uint16_t)r.max[field / 3];
+            break;
+        default:
+            value = (uint16_t)r.mean[field / 3];
+            break;
+    }
+    return true;
+}
+
+bool readHoldingRegister(uint16_t reg, uint16_t& value) {
+    const temp_t* r = holdingRegister(reg);
+    if (!r) return false;
+    value = (uint16_t)*r;
+    return true;
+}
+
+uint8_t writeHoldingRegister(uint16_t reg, uint16_t value, bool apply) {
+    temp_t* r = holdingRegister(reg);
+    if (!r) return MODBUS_ILLEGAL_ADDRESS;
+    temp_t temp = (temp_t)value;
+    if (temp < minSensorTemp || temp > maxSensorTemp) return MODBUS_ILLEGAL_VALUE;
+    if (apply) {
+        *r = temp;
+        stateHasChanged = true;
+    }
+    return 0;
+}
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 // Basic Arduino types
 typedef bool boolean;
@@ -24,4 +25,27 @@ unsigned long millis() { return 0; }
 // Mock digitalWrite function
 void digitalWrite(uint8_t pin, uint8_t val) {}
 
+// Clock for tests that depend on time; they move it by hand
+unsigned long mockMicros = 0;
+unsigned long micros() { return mockMicros; }
+
+// Serial port interfaces, for tests that provide their own port
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    size_t write(const uint8_t* buffer, size_t size) {
+        size_t n = 0;
+        while (size--) n += write(*buffer++);
+        return n;
+    }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
 #endif
@@ -0,0 +1,278 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <cstdio>
+#include <cstring>
+#include "../../include/ModbusRtuSlave.h"
+
+// Framing and replies of ModbusRtuSlave against a port the tests fill by
+// hand, with the clock in mockMicros. Runs in env:native.
+
+#define SLAVE_ID 1
+#define GAP_US 2000                 // past the 1750 us gap at 115200 baud
+
+// Serial port: bytes queued by the test come out of read(), replies are kept.
+class MockPort : public Stream {
+public:
+    uint8_t rx[256];
+    int rxHead, rxTail;
+    uint8_t tx[256];
+    int txLength;
+
+    void clear() {
+        rxHead = rxTail = txLength = 0;
+    }
+    void queue(const uint8_t* bytes, int n) {
+        memcpy(rx + rxTail, bytes, n);
+        rxTail += n;
+    }
+    size_t write(uint8_t c) {
+        tx[txLength++] = c;
+        return 1;
+    }
+    using Print::write;
+    int available() { return rxTail - rxHead; }
+    int read() { return rxHead < rxTail ? rx[rxHead++] : -1; }
+    int peek() { return rxHead < rxTail ? rx[rxHead] : -1; }
+};
+
+MockPort port;
+
+// Registers: input 0-9 read 100 + address, holding 0-3 in holding[]; a
+// holding register refuses values above 1000.
+uint16_t holding[4];
+
+bool readInput(uint16_t reg, uint16_t& value) {
+    if (reg >= 10) return false;
+    value = 100 + reg;
+    return true;
+}
+
+bool readHolding(uint16_t reg, uint16_t& value) {
+    if (reg >= 4) return false;
+    value = holding[reg];
+    return true;
+}
+
+uint8_t writeHolding(uint16_t reg, uint16_t value, bool apply) {
+    if (reg >= 4) return MODBUS_ILLEGAL_ADDRESS;
+    if (value > 1000) return MODBUS_ILLEGAL_VALUE;
+    if (apply) holding[reg] = value;
+    return 0;
+}
+
+ModbusRtuSlave slave(port, SLAVE_ID, readInput, readHolding, writeHolding);
+
+uint16_t crc16(const uint8_t* data, int n) {
+    uint16_t crc = 0xFFFF;
+    while (n--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+    return crc;
+}
+
+// Appends the CRC to the n bytes in frame; returns the new length.
+int withCrc(uint8_t* frame, int n) {
+    uint16_t crc = crc16(frame, n);
+    frame[n] = crc & 0xFF;
+    frame[n + 1] = crc >> 8;
+    return n + 2;
+}
+
+// Lets the line go quiet for longer than the frame gap.
+void silence() {
+    mockMicros += GAP_US;
+    slave.poll();
+}
+
+void setUp(void) {
+    port.clear();
+    memset(holding, 0, sizeof holding);
+    mockMicros = 0;
+    slave.begin(115200);
+}
+
+void tearDown(void) {
+}
+
+void test_read_input(void) {
+    printf("Testing a read of input registers...\n");
+    uint8_t request[8] = {SLAVE_ID, MODBUS_READ_INPUT, 0, 2, 0, 3};
+    port.queue(request, withCrc(request, 6));
+    slave.poll();
+
+    // Answered at the request's length, without waiting for the gap.
+    uint8_t expected[11] = {SLAVE_ID, MODBUS_READ_INPUT, 6, 0, 102, 0, 103, 0, 104};
+    TEST_ASSERT_EQUAL_MESSAGE(withCrc(expected, 9), port.txLength, "Reply length");
+    TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(expected, port.tx, 11, "Reply bytes");
+}
+
+void test_crc_rejected(void) {
+    printf("Testing CRC rejection...\n");
+    uint8_t request[8] = {SLAVE_ID, MODBUS_READ_INPUT, 0, 0, 0, 1};
+    withCrc(request, 6);
+    request[7] ^= 0x01;
+    port.queue(request, 8);
+    slave.poll();
+    silence();
+    TEST_ASSERT_EQUAL_MESSAGE(0, port.txLength, "A frame with a bad CRC gets no reply");
+
+    // The next good request is answered.
+    withCrc(request, 6);
+    port.queue(request, 8);
+    slave.poll();
+    TEST_ASSERT_EQUAL_MESSAGE(7, port.txLength, "Request after a bad frame");
+}
+
+void test_exceptions(void) {
+    printf("Testing exception replies...\n");
+    uint8_t request[8] = {SLAVE_ID, MODBUS_READ_INPUT, 0, 9, 0, 2};       // 9-10, 10 is outside
+    port.queue(request, withCrc(request, 6));
+    slave.poll();
+    uint8_t address[5] = {SLAVE_ID, MODBUS_READ_INPUT | 0x80, MODBUS_ILLEGAL_ADDRESS};
+    withCrc(address, 3);
+    TEST_ASSERT_EQUAL_MESSAGE(5, port.txLength, "Illegal address reply length");
+    TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(address, port.tx, 5, "Illegal address reply");
+
+    // An unknown function has no length to end on, so it ends at the gap.
+    port.clear();
+    uint8_t unknown[8] = {SLAVE_ID, 0x05, 0, 1, 0xFF, 0};
+    port.queue(unknown, withCrc(unknown, 6));
+    slave.poll();
+    TEST_ASSERT_EQUAL_MESSAGE(0, port.txLength, "No reply before the gap");
+    silence();
+    uint8_t function[5] = {SLAVE_ID, 0x05 | 0x80, MODBUS_ILLEGAL_FUNCTION};
+    withCrc(function, 3);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(function, port.tx, 5, "Illegal function reply");
+
+    port.clear();
+    uint8_t value[8] = {SLAVE_ID, MODBUS_WRITE_SINGLE, 0, 1, 0x07, 0xD0};    // 2000
+    port.queue(value, withCrc(value, 6));
+    slave.poll();
+    TEST_ASSERT_EQUAL_MESSAGE(MODBUS_WRITE_SINGLE | 0x80, port.tx[1], "Illegal value function");
+    TEST_ASSERT_EQUAL_MESSAGE(MODBUS_ILLEGAL_VALUE, port.tx[2], "Illegal value code");
+    TEST_ASSERT_EQUAL_MESSAGE(0, holding[1], "Refused value not written");
+}
+
+void test_broadcast(void) {
+    printf("Testing broadcast...\n");
+    uint8_t request[8] = {0, MODBUS_WRITE_SINGLE, 0, 2, 0x01, 0x2C};      // 300
+    port.queue(request, withCrc(request, 6));
+    slave.poll();
+    TEST_ASSERT_EQUAL_MESSAGE(300, holding[2], "Broadcast write applied");
+    TEST_ASSERT_EQUAL_MESSAGE(0, port.txLength, "Broadcast never answered");
+}
+
+void test_write_multiple_bounds(void) {
+    printf("Testing write multiple bounds...\n");
+    // One refused value: nothing of the request lands.
+    uint8_t request[13] = {SLAVE_ID, MODBUS_WRITE_MULTIPLE, 0, 0, 0, 2, 4, 0, 10, 0x07, 0xD0};
+    port.queue(request, withCrc(request, 11));
+    slave.poll();
+    TEST_ASSERT_EQUAL_MESSAGE(MODBUS_ILLEGAL_VALUE, port.tx[2], "Refused value");
+    TEST_ASSERT_EQUAL_MESSAGE(0, holding[0], "No partial write");
+
+    // Past the last register.
+    port.clear();
+    uint8_t past[13] = {SLAVE_ID, MODBUS_WRITE_MULTIPLE, 0, 3, 0, 2, 4, 0, 1, 0, 2};
+    port.queue(past, withCrc(past, 11));
+    slave.poll();
+    TEST_ASSERT_EQUAL_MESSAGE(MODBUS_ILLEGAL_ADDRESS, port.tx[2], "Past the map");
+    TEST_ASSERT_EQUAL_MESSAGE(0, holding[3], "No partial write past the map");
+
+    // Byte count that disagrees with the register count.
+    port.clear();
+    uint8_t mismatch[11] = {SLAVE_ID, MODBUS_WRITE_MULTIPLE, 0, 0, 0, 2, 2, 0, 1};
+    port.queue(mismatch, withCrc(mismatch, 9));
+    slave.poll();
+    TEST_ASSERT_EQUAL_MESSAGE(MODBUS_ILLEGAL_VALUE, port.tx[2], "Byte count mismatch");
+
+    // Byte count larger than a frame holds: ends at the gap, refused.
+    port.clear();
+    uint8_t tooLong[11] = {SLAVE_ID, MODBUS_WRITE_MULTIPLE, 0, 0, 0, 30, 60, 0, 1};
+    port.queue(tooLong, withCrc(tooLong, 9));
+    slave.poll();
+    TEST_ASSERT_EQUAL_MESSAGE(0, port.txLength, "Oversized request waits for the gap");
+    silence();
+    TEST_ASSERT_EQUAL_MESSAGE(MODBUS_ILLEGAL_VALUE, port.tx[2], "Oversized byte count");
+
+    // A good one is echoed and applied.
+    port.clear();
+    uint8_t good[13] = {SLAVE_ID, MODBUS_WRITE_MULTIPLE, 0, 1, 0, 2, 4, 0, 7, 0, 8};
+    port.queue(good, withCrc(good, 11));
+    slave.poll();
+    TEST_ASSERT_EQUAL_MESSAGE(8, port.txLength, "Echo length");
+    TEST_ASSERT_EQUAL_MESSAGE(7, holding[1], "First register written");
+    TEST_ASSERT_EQUAL_MESSAGE(8, holding[2], "Second register written");
+}
+
+void test_other_slave_response(void) {
+    printf("Testing another slave's response on the bus...\n");
+    // Slave 2 answers a read of 4 registers: 13 bytes, function 03 like a
+    // request. It is not cut at byte 8 and gets no reply.
+    uint8_t response[13] = {2, MODBUS_READ_HOLDING, 8, SLAVE_ID, MODBUS_READ_INPUT, 0, 0, 0, 1, 0, 0};
+    port.queue(response, withCrc(response, 11));
+    slave.poll();
+    silence();
+    TEST_ASSERT_EQUAL_MESSAGE(0, port.txLength, "No reply to another slave's frame");
+
+    // The same response and a request to this slave, read in one go with
+    // no gap seen between them: the request is still found and answered.
+    uint8_t request[8] = {SLAVE_ID, MODBUS_READ_INPUT, 0, 0, 0, 1};
+    withCrc(request, 6);
+    port.queue(response, 13);
+    port.queue(request, 8);
+    slave.poll();
+    silence();
+    uint8_t expected[7] = {SLAVE_ID, MODBUS_READ_INPUT, 2, 0, 100};
+    withCrc(expected, 5);
+    TEST_ASSERT_EQUAL_MESSAGE(7, port.txLength, "Request after another slave's frame");
+    TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(expected, port.tx, 7, "Reply after another slave's frame");
+}
+
+void test_long_foreign_frame(void) {
+    printf("Testing a frame longer than the buffer...\n");
+    // 100 bytes of another station's traffic, then a request to this slave
+    // without a gap: only the newest bytes are kept, and they hold it.
+    uint8_t traffic[100];
+    for (int i = 0; i < 100; i++) traffic[i] = (uint8_t)(i * 7 + 3);
+    uint8_t request[8] = {SLAVE_ID, MODBUS_READ_HOLDING, 0, 0, 0, 1};
+    withCrc(request, 6);
+    port.queue(traffic, 100);
+    port.queue(request, 8);
+    slave.poll();
+    silence();
+    TEST_ASSERT_EQUAL_MESSAGE(7, port.txLength, "Request after a long frame");
+    TEST_ASSERT_EQUAL_MESSAGE(MODBUS_READ_HOLDING, port.tx[1], "Reply function");
+}
+
+void test_split_request(void) {
+    printf("Testing a request split across polls...\n");
+    uint8_t request[8] = {SLAVE_ID, MODBUS_READ_INPUT, 0, 1, 0, 1};
+    withCrc(request, 6);
+    for (int i = 0; i < 8; i++) {
+        TEST_ASSERT_EQUAL_MESSAGE(0, port.txLength, "No reply before the last byte");
+        port.queue(request + i, 1);
+        slave.poll();
+        mockMicros += 100;          // under the gap between bytes
+    }
+    TEST_ASSERT_EQUAL_MESSAGE(7, port.txLength, "Reply after the last byte");
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    printf("\n=== Running Modbus Tests ===\n");
+
+    RUN_TEST(test_read_input);
+    RUN_TEST(test_crc_rejected);
+    RUN_TEST(test_exceptions);
+    RUN_TEST(test_broadcast);
+    RUN_TEST(test_write_multiple_bounds);
+    RUN_TEST(test_other_slave_response);
+    RUN_TEST(test_long_foreign_frame);
+    RUN_TEST(test_split_request);
+
+    printf("\n=== Tests Complete ===\n");
+    return UNITY_END();
+}